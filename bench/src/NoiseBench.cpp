@@ -0,0 +1,249 @@
+// Noise benchmarks.
+//
+// Author:  Tim Finer
+// Email:   tfiner@csu.fullerton.edu
+//
+// CPSC-597 Fall 2015 Master's Project
+//
+// Times CNoise and CFractal, which pick their dimension count at runtime,
+// against CNoiseT and CFractalT, which have it fixed at compile time, for
+// 1 to 4 dimensions. Then it compares the Perlin and simplex bases, times
+// the cellular F1/F2 search point by point and in batches, times a 3D noise
+// volume laid out the way CPixelBuffer::Make3DNoise() builds one,
+// point by point and in batches, and the cost of a 3D fBm gradient, analytic
+// against central differences.
+//
+
+#include "Noise.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <vector>
+
+
+namespace {
+
+    const auto sampleCount = 1 << 18;
+    const auto seed = 238653u;
+    const auto octaves = 8.0f;
+
+    // Keeps the compiler from throwing the results away
+    volatile float sink;
+
+
+    // Points spread over many lattice cells, MAX_DIMENSIONS floats per point
+    std::vector<float> MakePoints() {
+        CRandom r(seed);
+        auto points = std::vector<float>(sampleCount * MAX_DIMENSIONS);
+        for (auto& p : points)
+            p = float(r.RandomD(-100.0, 100.0));
+        return points;
+    }
+
+
+    // Nanoseconds per call of fn(point), the best of a few runs
+    template<typename Fn>
+    double TimeSamples(std::vector<float>& points, Fn fn) {
+        auto best = 1e30;
+        for (auto run = 0; run < 3; ++run) {
+            auto sum = 0.0f;
+            const auto start = std::chrono::steady_clock::now();
+            for (auto i = 0; i < sampleCount; ++i)
+                sum += fn(&points[i * MAX_DIMENSIONS]);
+            const auto elapsed = std::chrono::steady_clock::now() - start;
+            sink = sum;
+            best = std::min(best, std::chrono::duration<double, std::nano>(elapsed).count() / sampleCount);
+        }
+        return best;
+    }
+
+
+    void Report(int dims, const char* name, double runtime, double fixed) {
+        std::printf("%dD  %-20s %8.1f ns %8.1f ns %8.2fx\n", dims, name, runtime, fixed, runtime / fixed);
+    }
+
+
+    template<int D>
+    void BenchDimension(std::vector<float>& points) {
+        auto runtime = CFractal(D, seed, 0.5f, 2.0f);
+        auto fixed = CFractalT<D>(seed, 0.5f, 2.0f);
+
+        Report(D, "Noise",
+            TimeSamples(points, [&](float* f) { return runtime.Noise(f); }),
+            TimeSamples(points, [&](float* f) { return fixed.Noise(f); }));
+        Report(D, "fBm",
+            TimeSamples(points, [&](float* f) { return runtime.fBm(f, octaves); }),
+            TimeSamples(points, [&](float* f) { return fixed.fBm(f, octaves); }));
+        Report(D, "Turbulence",
+            TimeSamples(points, [&](float* f) { return runtime.Turbulence(f, octaves); }),
+            TimeSamples(points, [&](float* f) { return fixed.Turbulence(f, octaves); }));
+        Report(D, "RidgedMultifractal",
+            TimeSamples(points, [&](float* f) { return runtime.RidgedMultifractal(f, octaves, 1.0f, 2.0f); }),
+            TimeSamples(points, [&](float* f) { return fixed.RidgedMultifractal(f, octaves, 1.0f, 2.0f); }));
+    }
+
+
+    // fBm over each basis, a point at a time and with fBmN()
+    template<int D>
+    void BenchBasis(std::vector<float>& points) {
+        const auto perlin = CFractalT<D>(seed, 0.5f, 2.0f, PerlinBasis);
+        const auto simplex = CFractalT<D>(seed, 0.5f, 2.0f, SimplexBasis);
+
+        // fBmN() wants one array per coordinate
+        std::vector<float> coord[D], value(sampleCount);
+        const float* pCoord[MAX_DIMENSIONS] = {};
+        for (auto d = 0; d < D; ++d) {
+            coord[d].resize(sampleCount);
+            for (auto i = 0; i < sampleCount; ++i)
+                coord[d][i] = points[i * MAX_DIMENSIONS + d];
+            pCoord[d] = coord[d].data();
+        }
+        auto timeBatch = [&](const CFractal& fractal) {
+            auto best = 1e30;
+            for (auto run = 0; run < 3; ++run) {
+                const auto start = std::chrono::steady_clock::now();
+                fractal.fBmN(pCoord, value.data(), sampleCount, octaves);
+                best = std::min(best, std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / sampleCount);
+                sink = value[0];
+            }
+            return best;
+        };
+
+        Report(D, "fBm",
+            TimeSamples(points, [&](float* f) { return perlin.fBm(f, octaves); }),
+            TimeSamples(points, [&](float* f) { return simplex.fBm(f, octaves); }));
+        Report(D, "fBmN", timeBatch(perlin), timeBatch(simplex));
+    }
+
+
+    // Cellular F1 and F2, a point at a time and with CellularN()
+    template<int D>
+    void BenchCellular(std::vector<float>& points) {
+        const auto noise = CNoiseT<D>(seed, CellularBasis);
+
+        std::vector<float> coord[D], f1(sampleCount), f2(sampleCount);
+        const float* pCoord[MAX_DIMENSIONS] = {};
+        for (auto d = 0; d < D; ++d) {
+            coord[d].resize(sampleCount);
+            for (auto i = 0; i < sampleCount; ++i)
+                coord[d][i] = points[i * MAX_DIMENSIONS + d];
+            pCoord[d] = coord[d].data();
+        }
+        auto batch = 1e30;
+        for (auto run = 0; run < 3; ++run) {
+            const auto start = std::chrono::steady_clock::now();
+            noise.CellularN(pCoord, f1.data(), f2.data(), sampleCount);
+            batch = std::min(batch, std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / sampleCount);
+            sink = f1[0] + f2[0];
+        }
+
+        Report(D, "F1 and F2",
+            TimeSamples(points, [&](float* f) { float a, b; noise.Cellular(f, &a, &b); return a + b; }),
+            batch);
+    }
+
+
+    // A height and its gradient, the way a terrain normal needs them
+    void BenchGradient(std::vector<float>& points) {
+        const auto fractal = CFractalT<3>(seed, 0.5f, 2.0f);
+        const auto step = 1e-3f;
+
+        const auto height = TimeSamples(points, [&](float* f) { return fractal.fBm(f, octaves); });
+        const auto analytic = TimeSamples(points, [&](float* f) {
+            float gradient[3];
+            return fractal.fBmGradient(f, octaves, gradient) + gradient[0] + gradient[1] + gradient[2];
+        });
+        const auto differences = TimeSamples(points, [&](float* f) {
+            auto sum = fractal.fBm(f, octaves);
+            for (auto d = 0; d < 3; ++d) {
+                float a[3] = { f[0], f[1], f[2] }, b[3] = { f[0], f[1], f[2] };
+                a[d] += step;
+                b[d] -= step;
+                sum += (fractal.fBm(a, octaves) - fractal.fBm(b, octaves)) / (2 * step);
+            }
+            return sum;
+        });
+
+        std::printf("\n3D fBm with gradient\n");
+        std::printf("    %-20s %8.1f ns\n", "height only", height);
+        std::printf("    %-20s %8.1f ns %8.2fx\n", "fBmGradient", analytic, analytic / height);
+        std::printf("    %-20s %8.1f ns %8.2fx\n", "central differences", differences, differences / height);
+    }
+
+
+    // Mvoxels per second for fn(nz) filling z slice nz of a volumeSize^3 volume, the best of a few runs
+    const auto volumeSize = 64;
+
+    template<typename Fn>
+    double TimeVolume(Fn fn) {
+        auto best = 1e30;
+        for (auto run = 0; run < 3; ++run) {
+            const auto start = std::chrono::steady_clock::now();
+            for (auto z = 0; z < volumeSize; ++z)
+                fn(z);
+            best = std::min(best, std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+        }
+        return volumeSize * volumeSize * volumeSize * 0.001 / best;
+    }
+
+
+    // The cloud volume's fBm, one voxel at a time against a slice at a time with fBmN()
+    void BenchVolume() {
+        const auto fractal = CFractal(3, seed, 0.5f, 2.0f);
+        const auto sliceSize = volumeSize * volumeSize;
+        auto x = std::vector<float>(sliceSize), y = x, z = x, value = x;
+
+        const auto single = TimeVolume([&](int nz) {
+            float f[3];
+            f[2] = nz * 0.0625f;
+            for (auto i = 0; i < sliceSize; ++i) {
+                f[0] = (i % volumeSize) * 0.0625f;
+                f[1] = (i / volumeSize) * 0.0625f;
+                value[i] = fractal.fBm(f, 4.0f);
+            }
+            sink = value[0];
+        });
+        const auto batch = TimeVolume([&](int nz) {
+            for (auto i = 0; i < sliceSize; ++i) {
+                x[i] = (i % volumeSize) * 0.0625f;
+                y[i] = (i / volumeSize) * 0.0625f;
+                z[i] = nz * 0.0625f;
+            }
+            fractal.fBmN(x.data(), y.data(), z.data(), value.data(), sliceSize, 4.0f);
+            sink = value[0];
+        });
+
+        std::printf("\n%d^3 voxel volume, 4 octaves\n", volumeSize);
+        std::printf("    %-20s %8.2f Mvoxels/s\n", "fBm", single);
+        std::printf("    %-20s %8.2f Mvoxels/s %8.2fx\n", "fBmN", batch, batch / single);
+    }
+
+} // namespace {
+
+
+int main() {
+    auto points = MakePoints();
+
+    std::printf("%d samples, %g octaves\n", sampleCount, octaves);
+    std::printf("    %-20s %11s %11s %9s\n", "", "CFractal", "CFractalT", "speedup");
+    BenchDimension<1>(points);
+    BenchDimension<2>(points);
+    BenchDimension<3>(points);
+    BenchDimension<4>(points);
+
+    std::printf("\n    %-20s %11s %11s %9s\n", "", "Perlin", "simplex", "speedup");
+    BenchBasis<1>(points);
+    BenchBasis<2>(points);
+    BenchBasis<3>(points);
+    BenchBasis<4>(points);
+
+    std::printf("\n    %-20s %11s %11s %9s\n", "", "Cellular", "CellularN", "speedup");
+    BenchCellular<1>(points);
+    BenchCellular<2>(points);
+    BenchCellular<3>(points);
+    BenchCellular<4>(points);
+    BenchVolume();
+    BenchGradient(points);
+    return 0;
+}
@@ -0,0 +1,267 @@
+// Noise benchmark suite.
+//
+// Author:  Tim Finer
+// Email:   tfiner@csu.fullerton.edu
+//
+// CPSC-597 Fall 2015 Master's Project
+//
+// Times every CFractal method, Noise() through fBmTest(), for each basis,
+// 1 to 4 dimensions and a range of octave counts, and reports ns/sample and
+// samples/sec for each. The results can be written as JSON, and compared
+// against a JSON file from an earlier run:
+//
+//   noisesuite --json base.json
+//   ...change something...
+//   noisesuite --baseline base.json --threshold 10
+//
+// exits with 1 if anything got more than 10% slower than in base.json.
+//
+// Options:
+//   --json FILE         Write the results to FILE
+//   --baseline FILE     Compare against the results in FILE
+//   --threshold PCT     How much slower than the baseline counts as a regression (default 5)
+//   --samples N         Points per run (default 16384)
+//   --runs N            Runs per measurement, the fastest is kept (default 5)
+//   --filter TEXT       Only the methods whose names contain TEXT
+//
+
+#include "Noise.h"
+#include "Simd.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+
+namespace {
+
+    const auto seed = 238653u;
+    const float octaveCounts[] = { 2.0f, 4.0f, 8.0f, 4.5f };
+
+    const NoiseBasis bases[] = { PerlinBasis, SimplexBasis, CellularBasis };
+    const char* const basisNames[] = { "Perlin", "simplex", "cellular" };
+
+    enum Method { NoiseMethod, fBmMethod, TurbulenceMethod, MultifractalMethod, HeterofractalMethod,
+        HybridMultifractalMethod, RidgedMultifractalMethod, fBmTestMethod, MethodCount };
+    const char* const methodNames[] = { "Noise", "fBm", "Turbulence", "Multifractal", "Heterofractal",
+        "HybridMultifractal", "RidgedMultifractal", "fBmTest" };
+
+    // Keeps the compiler from throwing the results away
+    volatile float sink;
+
+
+    struct Options {
+        const char* json = nullptr;
+        const char* baseline = nullptr;
+        const char* filter = nullptr;
+        double threshold = 5.0;
+        int samples = 1 << 14;
+        int runs = 5;
+    };
+
+
+    struct Result {
+        std::string method, basis;
+        int dimensions;
+        float octaves;          // 0 for Noise(), which has none
+        double nsPerSample;
+        double samplesPerSec;
+    };
+
+
+    // Nanoseconds per call of fn(point), the fastest of several runs
+    template<typename Fn>
+    double TimeSamples(const std::vector<float>& points, int runs, Fn fn) {
+        const auto count = int(points.size() / MAX_DIMENSIONS);
+        auto best = 1e30;
+        for (auto run = 0; run < runs; ++run) {
+            auto sum = 0.0f;
+            const auto start = std::chrono::steady_clock::now();
+            for (auto i = 0; i < count; ++i)
+                sum += fn(&points[i * MAX_DIMENSIONS]);
+            const auto elapsed = std::chrono::steady_clock::now() - start;
+            sink = sum;
+            best = std::min(best, std::chrono::duration<double, std::nano>(elapsed).count() / count);
+        }
+        return best;
+    }
+
+
+    // The switch is outside the timing loop, so each method's call gets inlined into its own loop
+    double TimeMethod(const CFractal& fractal, Method method, float octaves, const std::vector<float>& points, int runs) {
+        switch (method) {
+        case NoiseMethod:
+            return TimeSamples(points, runs, [&](const float* f) { return fractal.Noise(f); });
+        case fBmMethod:
+            return TimeSamples(points, runs, [&](const float* f) { return fractal.fBm(f, octaves); });
+        case TurbulenceMethod:
+            return TimeSamples(points, runs, [&](const float* f) { return fractal.Turbulence(f, octaves); });
+        case MultifractalMethod:
+            return TimeSamples(points, runs, [&](const float* f) { return fractal.Multifractal(f, octaves, 0.7f); });
+        case HeterofractalMethod:
+            return TimeSamples(points, runs, [&](const float* f) { return fractal.Heterofractal(f, octaves, 0.7f); });
+        case HybridMultifractalMethod:
+            return TimeSamples(points, runs, [&](const float* f) { return fractal.HybridMultifractal(f, octaves, 0.7f, 1.0f); });
+        case RidgedMultifractalMethod:
+            return TimeSamples(points, runs, [&](const float* f) { return fractal.RidgedMultifractal(f, octaves, 1.0f, 2.0f); });
+        default:
+            return TimeSamples(points, runs, [&](const float* f) { return fractal.fBmTest(f, octaves); });
+        }
+    }
+
+
+    // Points spread over many lattice cells, MAX_DIMENSIONS floats per point
+    std::vector<float> MakePoints(int samples) {
+        CRandom r(seed);
+        auto points = std::vector<float>(samples * MAX_DIMENSIONS);
+        for (auto& p : points)
+            p = float(r.RandomD(-100.0, 100.0));
+        return points;
+    }
+
+
+    std::string Key(const Result& r) {
+        char octaves[32];
+        std::snprintf(octaves, sizeof(octaves), "%g", r.octaves);
+        return r.method + "/" + r.basis + "/" + std::to_string(r.dimensions) + "D/" + octaves;
+    }
+
+
+    // One result per line, so ReadJson() doesn't need a real parser
+    bool WriteJson(const char* path, const Options& options, const std::vector<Result>& results) {
+        auto file = std::fopen(path, "w");
+        if (!file) {
+            std::fprintf(stderr, "Can't write %s\n", path);
+            return false;
+        }
+        std::fprintf(file, "{\n  \"samples\": %d,\n  \"runs\": %d,\n  \"simd_width\": %d,\n  \"results\": [\n",
+            options.samples, options.runs, SIMD_WIDTH);
+        for (size_t i = 0; i < results.size(); ++i) {
+            const auto& r = results[i];
+            std::fprintf(file, "    {\"method\": \"%s\", \"basis\": \"%s\", \"dimensions\": %d, \"octaves\": %g, "
+                "\"ns_per_sample\": %.3f, \"samples_per_sec\": %.0f}%s\n", r.method.c_str(), r.basis.c_str(),
+                r.dimensions, r.octaves, r.nsPerSample, r.samplesPerSec, i + 1 < results.size() ? "," : "");
+        }
+        std::fprintf(file, "  ]\n}\n");
+        std::fclose(file);
+        return true;
+    }
+
+
+    // Reads back the result lines of a file WriteJson() wrote
+    bool ReadJson(const char* path, std::vector<Result>& results) {
+        auto file = std::fopen(path, "r");
+        if (!file) {
+            std::fprintf(stderr, "Can't read %s\n", path);
+            return false;
+        }
+        char line[512];
+        while (std::fgets(line, sizeof(line), file)) {
+            char method[64], basis[64];
+            Result r;
+            if (std::sscanf(line, " {\"method\": \"%63[^\"]\", \"basis\": \"%63[^\"]\", \"dimensions\": %d, \"octaves\": %f, "
+                "\"ns_per_sample\": %lf, \"samples_per_sec\": %lf", method, basis, &r.dimensions, &r.octaves,
+                &r.nsPerSample, &r.samplesPerSec) == 6) {
+                r.method = method;
+                r.basis = basis;
+                results.push_back(r);
+            }
+        }
+        std::fclose(file);
+        return true;
+    }
+
+
+    bool ParseOptions(int argc, char** argv, Options& options) {
+        for (auto i = 1; i < argc; ++i) {
+            const auto hasValue = i + 1 < argc;
+            if (!std::strcmp(argv[i], "--json") && hasValue)
+                options.json = argv[++i];
+            else if (!std::strcmp(argv[i], "--baseline") && hasValue)
+                options.baseline = argv[++i];
+            else if (!std::strcmp(argv[i], "--threshold") && hasValue)
+                options.threshold = std::atof(argv[++i]);
+            else if (!std::strcmp(argv[i], "--samples") && hasValue)
+                options.samples = std::max(1, std::atoi(argv[++i]));
+            else if (!std::strcmp(argv[i], "--runs") && hasValue)
+                options.runs = std::max(1, std::atoi(argv[++i]));
+            else if (!std::strcmp(argv[i], "--filter") && hasValue)
+                options.filter = argv[++i];
+            else {
+                std::fprintf(stderr, "usage: %s [--json FILE] [--baseline FILE] [--threshold PCT] "
+                    "[--samples N] [--runs N] [--filter TEXT]\n", argv[0]);
+                return false;
+            }
+        }
+        return true;
+    }
+
+} // namespace {
+
+
+int main(int argc, char** argv) {
+    Options options;
+    if (!ParseOptions(argc, argv, options))
+        return 2;
+
+    std::vector<Result> baseline;
+    if (options.baseline && !ReadJson(options.baseline, baseline))
+        return 2;
+
+    const auto points = MakePoints(options.samples);
+    std::printf("%d samples, fastest of %d runs, SIMD width %d\n", options.samples, options.runs, SIMD_WIDTH);
+    std::printf("%-20s %-9s %3s %7s %12s %14s%s\n", "method", "basis", "dim", "octaves", "ns/sample", "samples/sec",
+        baseline.empty() ? "" : "   vs baseline");
+
+    std::vector<Result> results;
+    auto regressions = 0;
+    for (auto m = 0; m < MethodCount; ++m) {
+        const auto method = Method(m);
+        if (options.filter && !std::strstr(methodNames[m], options.filter))
+            continue;
+        for (auto b = 0; b < 3; ++b) {
+            for (auto d = 1; d <= MAX_DIMENSIONS; ++d) {
+                const auto fractal = CFractal(d, seed, 0.5f, 2.0f, bases[b]);
+                for (auto octaves : octaveCounts) {
+                    Result r;
+                    r.method = methodNames[m];
+                    r.basis = basisNames[b];
+                    r.dimensions = d;
+                    r.octaves = method == NoiseMethod ? 0.0f : octaves;
+                    r.nsPerSample = TimeMethod(fractal, method, octaves, points, options.runs);
+                    r.samplesPerSec = 1e9 / r.nsPerSample;
+                    std::printf("%-20s %-9s %2dD %7g %12.1f %14.0f", r.method.c_str(), r.basis.c_str(), d, r.octaves,
+                        r.nsPerSample, r.samplesPerSec);
+
+                    const auto key = Key(r);
+                    const auto old = std::find_if(baseline.begin(), baseline.end(), [&](const Result& prior) { return Key(prior) == key; });
+                    if (old != baseline.end()) {
+                        const auto change = 100.0 * (r.nsPerSample / old->nsPerSample - 1.0);
+                        const auto regressed = change > options.threshold;
+                        regressions += regressed;
+                        std::printf("   %+7.1f%%%s", change, regressed ? "  REGRESSION" : "");
+                    }
+                    std::printf("\n");
+                    results.push_back(r);
+
+                    // Noise() doesn't take an octave count
+                    if (method == NoiseMethod)
+                        break;
+                }
+            }
+        }
+    }
+
+    if (options.json && !WriteJson(options.json, options, results))
+        return 2;
+    if (!baseline.empty()) {
+        std::printf("\n%d of %d measurements more than %g%% slower than %s\n", regressions, int(results.size()),
+            options.threshold, options.baseline);
+        return regressions ? 1 : 0;
+    }
+    return 0;
+}
@@ -0,0 +1,138 @@
+// Persistent cache for precomputed tables and procedural textures.
+//
+// Author:  Tim Finer
+// Email:   tfiner@csu.fullerton.edu
+//
+// CPSC-597 Fall 2015 Master's Project
+//
+
+#include "Master.h"
+#include "AssetCache.h"
+#include "PixelBuffer.h"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+
+bool CMappedFile::Open(const char *pszFile)
+{
+	Close();
+#ifdef _WIN32
+	HANDLE hFile = CreateFileA(pszFile, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if(hFile == INVALID_HANDLE_VALUE)
+		return false;
+	LARGE_INTEGER nSize;
+	HANDLE hMapping = NULL;
+	if(GetFileSizeEx(hFile, &nSize) && nSize.QuadPart > 0)
+		hMapping = CreateFileMappingA(hFile, NULL, PAGE_WRITECOPY, 0, 0, NULL);
+	void *pData = hMapping ? MapViewOfFile(hMapping, FILE_MAP_COPY, 0, 0, 0) : NULL;
+	if(!pData)
+	{
+		if(hMapping)
+			CloseHandle(hMapping);
+		CloseHandle(hFile);
+		return false;
+	}
+	m_hFile = hFile;
+	m_hMapping = hMapping;
+	m_nSize = (size_t)nSize.QuadPart;
+#else
+	int fd = open(pszFile, O_RDONLY);
+	if(fd < 0)
+		return false;
+	struct stat st;
+	void *pData = MAP_FAILED;
+	if(fstat(fd, &st) == 0 && st.st_size > 0)
+		pData = mmap(NULL, (size_t)st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if(pData == MAP_FAILED)
+		return false;
+	m_nSize = (size_t)st.st_size;
+#endif
+	m_pData = pData;
+	return true;
+}
+
+void CMappedFile::Close()
+{
+	if(!m_pData)
+		return;
+#ifdef _WIN32
+	UnmapViewOfFile(m_pData);
+	CloseHandle((HANDLE)m_hMapping);
+	CloseHandle((HANDLE)m_hFile);
+#else
+	munmap(m_pData, m_nSize);
+#endif
+	m_pData = m_hFile = m_hMapping = NULL;
+	m_nSize = 0;
+}
+
+
+const std::string &CAssetCache::GetDirectory()
+{
+	static std::string strDirectory;
+	if(strDirectory.empty())
+	{
+		char szPath[1024] = {0};
+#ifdef _WIN32
+		GetModuleFileNameA(NULL, szPath, sizeof(szPath)-1);
+		const char *pszSeparators = "\\/";
+#else
+		if(readlink("/proc/self/exe", szPath, sizeof(szPath)-1) < 0)
+			szPath[0] = 0;
+		const char *pszSeparators = "/";
+#endif
+		strDirectory = szPath;
+		size_t nSlash = strDirectory.find_last_of(pszSeparators);
+		strDirectory = (nSlash == std::string::npos) ? std::string(".") : strDirectory.substr(0, nSlash);
+	}
+	return strDirectory;
+}
+
+std::string CAssetCache::GetPath(const CAssetKey &key)
+{
+	char szFile[256];
+	sprintf(szFile, "/%s-%016llx.asset", key.GetName(), key.GetHash());
+	return GetDirectory() + szFile;
+}
+
+bool CAssetCache::Load(CPixelBuffer &pb, const CAssetKey &key)
+{
+	std::string strPath = GetPath(key);
+	if(!pb.MapFile(strPath.c_str(), key.GetHash()))
+		return false;
+	LogInfo("CAssetCache::Load() - Mapped %s", strPath.c_str());
+	return true;
+}
+
+bool CAssetCache::Save(const CPixelBuffer &pb, const CAssetKey &key)
+{
+	// Write to a name only this process uses, then move it into place
+	std::string strPath = GetPath(key);
+	char szSuffix[32];
+#ifdef _WIN32
+	sprintf(szSuffix, ".%lu.tmp", GetCurrentProcessId());
+#else
+	sprintf(szSuffix, ".%d.tmp", (int)getpid());
+#endif
+	std::string strTemp = strPath + szSuffix;
+	if(!pb.SaveFile(strTemp.c_str(), key.GetHash()))
+	{
+		LogError("CAssetCache::Save() - Unable to write %s", strTemp.c_str());
+		remove(strTemp.c_str());
+		return false;
+	}
+
+	// If another process got there first its copy is just as good as ours
+	if(rename(strTemp.c_str(), strPath.c_str()) != 0)
+	{
+		remove(strTemp.c_str());
+		return false;
+	}
+	return true;
+}
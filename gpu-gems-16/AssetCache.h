@@ -0,0 +1,141 @@
+// Persistent cache for precomputed tables and procedural textures.
+//
+// Author:  Tim Finer
+// Email:   tfiner@csu.fullerton.edu
+//
+// CPSC-597 Fall 2015 Master's Project
+//
+
+#ifndef __AssetCache_h__
+#define __AssetCache_h__
+
+#include <functional>
+#include <string>
+
+class CPixelBuffer;
+
+
+// Bump this whenever a generator's output or the file layout changes, so that
+// stale files left next to the executable are regenerated instead of mapped.
+#define ASSET_VERSION		1
+#define ASSET_MAGIC			"SKYA"
+#define ASSET_DATA_OFFSET	64		// Keeps the mapped pixels ALIGN_SIZE aligned
+
+
+// The on-disk header. The pixel data follows at ASSET_DATA_OFFSET, laid out
+// exactly as it is in CPixelBuffer's memory.
+struct SAssetHeader
+{
+	char szMagic[4];				// ASSET_MAGIC
+	unsigned int nVersion;			// ASSET_VERSION
+	unsigned long long nKey;		// CAssetKey hash of the generator parameters
+	int nWidth;
+	int nHeight;
+	int nDepth;
+	int nChannels;
+	int nFormat;
+	int nDataType;
+	unsigned int nDataSize;			// Bytes of pixel data after the header
+	unsigned int nReserved;
+};
+
+
+/*******************************************************************************
+* Class: CAssetKey
+********************************************************************************
+* A 64-bit FNV-1a hash of a generator's name and every parameter that affects
+* its output (radii, scale depths, seeds, sizes...). Two keys are only equal if
+* the generator would produce the same bytes.
+*******************************************************************************/
+class CAssetKey
+{
+protected:
+	std::string m_strName;
+	unsigned long long m_nHash;
+
+	void AddBytes(const void *p, int nBytes)
+	{
+		for(int i=0; i<nBytes; i++)
+		{
+			m_nHash ^= ((const unsigned char *)p)[i];
+			m_nHash *= 1099511628211ULL;
+		}
+	}
+
+public:
+	CAssetKey(const char *pszName) : m_strName(pszName)
+	{
+		m_nHash = 14695981039346656037ULL;
+		AddBytes(pszName, (int)m_strName.size());
+		Add(ASSET_VERSION);
+	}
+
+	CAssetKey &Add(int n)				{ AddBytes(&n, sizeof(n)); return *this; }
+	CAssetKey &Add(float f)				{ AddBytes(&f, sizeof(f)); return *this; }
+
+	const char *GetName() const			{ return m_strName.c_str(); }
+	unsigned long long GetHash() const	{ return m_nHash; }
+};
+
+
+/*******************************************************************************
+* Class: CMappedFile
+********************************************************************************
+* A copy-on-write view of an entire file (MapViewOfFile on Windows, mmap
+* elsewhere). Writes through the pointer never reach the file.
+*******************************************************************************/
+class CMappedFile
+{
+protected:
+	void *m_pData;
+	size_t m_nSize;
+	void *m_hFile;					// Windows file and mapping handles
+	void *m_hMapping;
+
+	CMappedFile(const CMappedFile &);
+	void operator=(const CMappedFile &);
+
+public:
+	CMappedFile()					{ m_pData = m_hFile = m_hMapping = NULL; m_nSize = 0; }
+	~CMappedFile()					{ Close(); }
+
+	bool Open(const char *pszFile);
+	void Close();
+
+	void *GetData() const			{ return m_pData; }
+	size_t GetSize() const			{ return m_nSize; }
+};
+
+
+/*******************************************************************************
+* Class: CAssetCache
+********************************************************************************
+* Keeps generated pixel buffers in versioned binary files next to the
+* executable, named after the key. On a warm start the file is mapped straight
+* into the CPixelBuffer as its backing store, so there is no parsing, copying,
+* or regeneration. Files are written to a temporary name and renamed into
+* place, so many processes starting at once never see a partial file.
+*******************************************************************************/
+class CAssetCache
+{
+public:
+	// The directory the cache files live in (the executable's directory)
+	static const std::string &GetDirectory();
+	static std::string GetPath(const CAssetKey &key);
+
+	// Maps the cached copy of key into pb, returns false if there is none
+	static bool Load(CPixelBuffer &pb, const CAssetKey &key);
+	static bool Save(const CPixelBuffer &pb, const CAssetKey &key);
+
+	// Loads key into pb, or calls fnMake() to generate pb and saves the result
+	static void LoadOrMake(CPixelBuffer &pb, const CAssetKey &key, const std::function<void()> &fnMake)
+	{
+		if(!Load(pb, key))
+		{
+			fnMake();
+			Save(pb, key);
+		}
+	}
+};
+
+#endif // __AssetCache_h__
@@ -0,0 +1,37 @@
+//
+// The atmosphere parameters shared by all of the scattering shaders, pulled in
+// with #include "Atmosphere.glsl" (see CShaderObject::ReadSource()). It must
+// come before any other declarations because of the #extension line.
+// CGameEngine keeps a single uniform buffer with this layout bound to every
+// program, so the layout must match SAtmosphereParams in GameEngine.h.
+//
+// Author:  Tim Finer
+// Email:   tfiner@csu.fullerton.edu
+//
+
+#extension GL_ARB_uniform_buffer_object : require
+
+layout(std140) uniform AtmosphereParams
+{
+	// Updated every frame
+	vec3 v3CameraPos;			// The camera's current position
+	float fCameraHeight;		// The camera's current height
+	float fCameraHeight2;		// fCameraHeight^2
+
+	// Updated only when a parameter changes
+	vec3 v3LightPos;			// The direction vector to the light source
+	float fOuterRadius;			// The outer (atmosphere) radius
+	vec3 v3InvWavelength;		// 1 / pow(wavelength, 4) for the red, green, and blue channels
+	float fInnerRadius;			// The inner (planetary) radius
+	float fOuterRadius2;		// fOuterRadius^2
+	float fInnerRadius2;		// fInnerRadius^2
+	float fKrESun;				// Kr * ESun
+	float fKmESun;				// Km * ESun
+	float fKr4PI;				// Kr * 4 * PI
+	float fKm4PI;				// Km * 4 * PI
+	float fScale;				// 1 / (fOuterRadius - fInnerRadius)
+	float fScaleDepth;			// The scale depth (i.e. the altitude at which the atmosphere's average density is found)
+	float fScaleOverScaleDepth;	// fScale / fScaleDepth
+	float g;					// The Mie phase asymmetry factor
+	float g2;					// g^2
+};
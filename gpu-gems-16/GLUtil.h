@@ -74,6 +74,28 @@ public:
 inline CGLUtil *GLUtil()			{ return CGLUtil::m_pMain; }
 
 
+// The uniforms that are set by hand every frame. CShaderObject finds all of
+// them when a program links, so setting one by enum is just an array index.
+// Everything else goes through the slower name lookup.
+enum ShaderUniform
+{
+	UniformTest,				// sampler2D s2Test
+	UniformExposure,			// float fExposure
+	UniformInscatter,			// sampler3D s3Inscatter
+	UniformInscatterSize,		// vec4 v4InscatterSize
+	UniformOpticalDepth,		// sampler2D s2OpticalDepth
+	UniformOpticalDepthSize,	// float fOpticalDepthSize
+	UniformCount
+};
+
+inline const char *GetUniformName(ShaderUniform nUniform)
+{
+	static const char *pszNames[UniformCount] = {
+		"s2Test", "fExposure", "s3Inscatter", "v4InscatterSize", "s2OpticalDepth", "fOpticalDepthSize"
+	};
+	return pszNames[nUniform];
+}
+
 
 class CShaderObject
 {
@@ -82,6 +104,7 @@ protected:
 	GLhandleARB m_hVertexShader;
 	GLhandleARB m_hFragmentShader;
 	std::map<std::string, GLint> m_mapParameters;
+	GLint m_nUniforms[UniformCount];
 
 	void LogGLErrors()
 	{
@@ -108,6 +131,8 @@ public:
 		m_hProgram = glCreateProgramObjectARB();
 		m_hVertexShader = glCreateShaderObjectARB(GL_VERTEX_SHADER_ARB);
 		m_hFragmentShader = glCreateShaderObjectARB(GL_FRAGMENT_SHADER_ARB);
+		for(int i=0; i<UniformCount; i++)
+			m_nUniforms[i] = -1;
 	}
 	~CShaderObject()
 	{
@@ -116,25 +141,56 @@ public:
 		glDeleteObjectARB(m_hProgram);
 	}
 
+	// Reads a GLSL source file, expanding #include "file" lines in place the
+	// same way the Cg shaders pull in Common.cg
+	static bool ReadSource(const char *pszFile, std::string &strSource)
+	{
+		std::ifstream ifSource(pszFile, std::ios::binary);
+		if(!ifSource)
+		{
+			LogError("Unable to open shader %s", pszFile);
+			return false;
+		}
+		std::string strLine;
+		for(int nLine=1; std::getline(ifSource, strLine); nLine++)
+		{
+			if(strLine.compare(0, 10, "#include \"") == 0)
+			{
+				size_t nEnd = strLine.find('"', 10);
+				if(nEnd == std::string::npos || !ReadSource(strLine.substr(10, nEnd-10).c_str(), strSource))
+				{
+					LogError("Bad #include in shader %s(%d)", pszFile, nLine);
+					return false;
+				}
+				char szLine[32];
+				sprintf(szLine, "#line %d\n", nLine+1);
+				strSource += szLine;
+			}
+			else
+			{
+				strSource += strLine;
+				strSource += '\n';
+			}
+		}
+		return true;
+	}
+
 	bool Load(const char *pszPath, const char *pszPath2=NULL)
 	{
-		char szPath[_MAX_PATH], *psz;
-		int bSuccess;
+		char szPath[_MAX_PATH];
+		std::string strSource;
+		const char *psz;
+		int nBytes, bSuccess;
 
 		sprintf(szPath, "%s.vert", pszPath);
 		LogInfo("Compiling GLSL shader %s", szPath);
-		std::ifstream ifVertexShader(szPath, std::ios::binary);
-		ifVertexShader.seekg(0, std::ios::end);
-		auto nBytes = static_cast<int>(ifVertexShader.tellg());
-		ifVertexShader.seekg(0, std::ios::beg);
-		psz = new char[nBytes+1];
-		ifVertexShader.read(psz, nBytes);
-		psz[nBytes] = 0;
-		ifVertexShader.close();
-		glShaderSourceARB(m_hVertexShader, 1, (const char **)&psz, &nBytes);
+		if(!ReadSource(szPath, strSource))
+			return false;
+		psz = strSource.c_str();
+		nBytes = (int)strSource.size();
+		glShaderSourceARB(m_hVertexShader, 1, &psz, &nBytes);
 		glCompileShaderARB(m_hVertexShader);
 		glGetObjectParameterivARB(m_hVertexShader, GL_OBJECT_COMPILE_STATUS_ARB, &bSuccess);
-		delete psz;
 		if(!bSuccess)
 		{
 			LogError("Failed to compile vertex shader %s", szPath);
@@ -145,17 +201,14 @@ public:
 
 		sprintf(szPath, "%s.frag", pszPath2 ? pszPath2 : pszPath);
 		LogInfo("Compiling GLSL shader %s", szPath);
-		std::ifstream ifFragmentShader(szPath, std::ios::binary);
-		ifFragmentShader.seekg(0, std::ios::end);
-		nBytes = static_cast<int>(ifFragmentShader.tellg());
-		ifFragmentShader.seekg(0, std::ios::beg);
-		psz = new char[nBytes];
-		ifFragmentShader.read(psz, nBytes);
-		ifFragmentShader.close();
-		glShaderSourceARB(m_hFragmentShader, 1, (const char **)&psz, &nBytes);
+		strSource.clear();
+		if(!ReadSource(szPath, strSource))
+			return false;
+		psz = strSource.c_str();
+		nBytes = (int)strSource.size();
+		glShaderSourceARB(m_hFragmentShader, 1, &psz, &nBytes);
 		glCompileShaderARB(m_hFragmentShader);
 		glGetObjectParameterivARB(m_hFragmentShader, GL_OBJECT_COMPILE_STATUS_ARB, &bSuccess);
-		delete psz;
 		if(!bSuccess)
 		{
 			LogError("Failed to compile fragment shader %s", szPath);
@@ -178,9 +231,37 @@ public:
 		}
 
 		LogGLInfoLog(m_hProgram);
+		ResolveUniforms();
 		return true;
 	}
 
+	// Asks the linked program for all of its active uniforms. This fills the
+	// name map the string functions use and the ShaderUniform slots.
+	void ResolveUniforms()
+	{
+		m_mapParameters.clear();
+		GLint nUniforms = 0, nMaxLength = 0;
+		glGetObjectParameterivARB(m_hProgram, GL_OBJECT_ACTIVE_UNIFORMS_ARB, &nUniforms);
+		glGetObjectParameterivARB(m_hProgram, GL_OBJECT_ACTIVE_UNIFORM_MAX_LENGTH_ARB, &nMaxLength);
+		std::vector<char> szName(nMaxLength+1);
+		for(int i=0; i<nUniforms; i++)
+		{
+			GLint nSize;
+			GLenum nType;
+			glGetActiveUniformARB(m_hProgram, i, (GLsizei)szName.size(), NULL, &nSize, &nType, &szName[0]);
+			char *pszBracket = strchr(&szName[0], '[');	// Arrays come back as "name[0]"
+			if(pszBracket)
+				*pszBracket = 0;
+			m_mapParameters[&szName[0]] = glGetUniformLocationARB(m_hProgram, &szName[0]);
+		}
+
+		for(int i=0; i<UniformCount; i++)
+		{
+			std::map<std::string, GLint>::iterator it = m_mapParameters.find(GetUniformName((ShaderUniform)i));
+			m_nUniforms[i] = (it == m_mapParameters.end()) ? -1 : it->second;
+		}
+	}
+
 	void Enable()
 	{
 		glUseProgramObjectARB(m_hProgram);
@@ -192,6 +273,20 @@ public:
       LOG_GL_ERRORS();
 	}
 
+	// Points the named uniform block at a buffer binding point (see CUniformBuffer)
+	bool BindUniformBlock(const char *pszBlock, GLuint nBinding, int nSize)
+	{
+		GLuint nIndex = glGetUniformBlockIndex(m_hProgram, pszBlock);
+		if(nIndex == GL_INVALID_INDEX)
+			return false;
+		GLint nBlockSize;
+		glGetActiveUniformBlockiv(m_hProgram, nIndex, GL_UNIFORM_BLOCK_DATA_SIZE, &nBlockSize);
+		if(nBlockSize > nSize)
+			LogError("CShaderObject::BindUniformBlock() - %s is %d bytes, the buffer only has %d", pszBlock, nBlockSize, nSize);
+		glUniformBlockBinding(m_hProgram, nIndex, nBinding);
+		return true;
+	}
+
 	GLint GetUniformParameterID(const char *pszParameter)
 	{
 		std::map<std::string, GLint>::iterator it = m_mapParameters.find(pszParameter);
@@ -211,6 +306,25 @@ public:
 		glUniform1iARB(n, nID);
 	}
 	*/
+	GLint GetUniformParameterID(ShaderUniform nUniform) const	{ return m_nUniforms[nUniform]; }
+	void SetUniformParameter1i(ShaderUniform nUniform, int n1)
+	{
+		glUniform1iARB(m_nUniforms[nUniform], n1);
+	}
+	void SetUniformParameter1f(ShaderUniform nUniform, float p1)
+	{
+		glUniform1fARB(m_nUniforms[nUniform], p1);
+	}
+	void SetUniformParameter3f(ShaderUniform nUniform, float p1, float p2, float p3)
+	{
+		glUniform3fARB(m_nUniforms[nUniform], p1, p2, p3);
+	}
+	void SetUniformParameter4f(ShaderUniform nUniform, float p1, float p2, float p3, float p4)
+	{
+		glUniform4fARB(m_nUniforms[nUniform], p1, p2, p3, p4);
+	}
+
+	// The slow path, for uniforms that are not worth a ShaderUniform slot
 	void SetUniformParameter1i(const char *pszParameter, int n1)
 	{
 		glUniform1iARB(GetUniformParameterID(pszParameter), n1);
@@ -223,6 +337,44 @@ public:
 	{
 		glUniform3fARB(GetUniformParameterID(pszParameter), p1, p2, p3);
 	}
+	void SetUniformParameter4f(const char *pszParameter, float p1, float p2, float p3, float p4)
+	{
+		glUniform4fARB(GetUniformParameterID(pszParameter), p1, p2, p3, p4);
+	}
 };
 
 
+/*******************************************************************************
+* Class: CUniformBuffer
+********************************************************************************
+* A GL_UNIFORM_BUFFER attached to a fixed binding point. Every program whose
+* block is bound to the same point with CShaderObject::BindUniformBlock() sees
+* the same values, so they are uploaded once instead of once per program.
+*******************************************************************************/
+class CUniformBuffer
+{
+protected:
+	GLuint m_nBuffer;
+
+public:
+	CUniformBuffer()				{ m_nBuffer = 0; }
+	~CUniformBuffer()				{ if(m_nBuffer) glDeleteBuffers(1, &m_nBuffer); }
+
+	void Init(GLuint nBinding, int nSize)
+	{
+		if(!m_nBuffer)
+			glGenBuffers(1, &m_nBuffer);
+		glBindBuffer(GL_UNIFORM_BUFFER, m_nBuffer);
+		glBufferData(GL_UNIFORM_BUFFER, nSize, NULL, GL_DYNAMIC_DRAW);
+		glBindBuffer(GL_UNIFORM_BUFFER, 0);
+		glBindBufferBase(GL_UNIFORM_BUFFER, nBinding, m_nBuffer);
+	}
+
+	// Copies nBytes starting at nOffset in pData to the same offset in the buffer
+	void Update(const void *pData, int nOffset, int nBytes)
+	{
+		glBindBuffer(GL_UNIFORM_BUFFER, m_nBuffer);
+		glBufferSubData(GL_UNIFORM_BUFFER, nOffset, nBytes, (const char *)pData + nOffset);
+		glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	}
+};
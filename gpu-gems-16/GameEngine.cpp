@@ -33,10 +33,20 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "GameEngine.h"
 #include "GLUtil.h"
 
+#include <chrono>
+#include <stddef.h>
+
+
+// Resolution of the inscatter table: altitude, view angle, light angle, and view-light angle
+static const int INSCATTER_SIZE[4] = { 32, 128, 32, 8 };
+static const int INSCATTER_SAMPLES = 32;
+
 
 CGameEngine::CGameEngine()
 {
 	m_bUseHDR = false;
+	m_bUseInscatterLUT = false;
+	m_bUseOpticalDepthTable = false;
 
 	//GetApp()->MessageBox((const char *)glGetString(GL_EXTENSIONS));
 	GLUtil()->Init();
@@ -83,7 +93,39 @@ CGameEngine::CGameEngine()
 
 	m_fRayleighScaleDepth = 0.25f;
 	m_fMieScaleDepth = 0.1f;
-	m_pbOpticalDepth.MakeOpticalDepthBuffer(m_fInnerRadius, m_fOuterRadius, m_fRayleighScaleDepth, m_fMieScaleDepth);
+	CAssetKey keyOpticalDepth("OpticalDepth");
+	keyOpticalDepth.Add(m_fInnerRadius).Add(m_fOuterRadius).Add(m_fRayleighScaleDepth).Add(m_fMieScaleDepth).Add(64).Add(50);
+	CAssetCache::LoadOrMake(m_pbOpticalDepth, keyOpticalDepth, [this]() {
+		m_pbOpticalDepth.MakeOpticalDepthBuffer(m_fInnerRadius, m_fOuterRadius, m_fRayleighScaleDepth, m_fMieScaleDepth, 64, 50);
+	});
+	m_tOpticalDepth.Init(&m_pbOpticalDepth, true, false);
+
+	// The inscatter table bakes in everything but the sun's brightness and the phase function
+	CScatteringParams params;
+	params.m_fInnerRadius = m_fInnerRadius;
+	params.m_fOuterRadius = m_fOuterRadius;
+	params.m_fScaleDepth = m_fRayleighScaleDepth;
+	params.m_Kr = m_Kr;
+	params.m_Km = m_Km;
+	params.m_ESun = m_ESun;
+	params.m_g = m_g;
+	CAssetKey keyInscatter("Inscatter");
+	keyInscatter.Add(m_fInnerRadius).Add(m_fOuterRadius).Add(m_fRayleighScaleDepth).Add(m_Kr).Add(m_Km);
+	for(int i=0; i<3; i++)
+	{
+		params.m_fWavelength4[i] = m_fWavelength4[i];
+		keyInscatter.Add(m_fWavelength4[i]);
+	}
+	for(int i=0; i<4; i++)
+		keyInscatter.Add(INSCATTER_SIZE[i]);
+	keyInscatter.Add(INSCATTER_SAMPLES).Add(GL_HALF_FLOAT);
+
+	CPixelBuffer pbInscatter;
+	CAssetCache::LoadOrMake(pbInscatter, keyInscatter, [&]() {
+		pbInscatter.MakeInscatterBuffer(CScattering(params), INSCATTER_SIZE[0], INSCATTER_SIZE[1], INSCATTER_SIZE[2], INSCATTER_SIZE[3], INSCATTER_SAMPLES);
+		pbInscatter.Quantize(GL_HALF_FLOAT, "Inscatter");
+	});
+	m_tInscatter.Init(&pbInscatter, true, false);
 
 	m_shSkyFromSpace.Load("SkyFromSpace");
 	m_shSkyFromAtmosphere.Load("SkyFromAtmosphere");
@@ -91,11 +133,36 @@ CGameEngine::CGameEngine()
 	m_shGroundFromAtmosphere.Load("GroundFromAtmosphere");
 	m_shSpaceFromSpace.Load("SpaceFromSpace");
 	m_shSpaceFromAtmosphere.Load("SpaceFromAtmosphere");
+	m_shSkyLUT.Load("SkyLUT", "SkyFromAtmosphere");
+	m_shGroundLUT.Load("GroundLUT", "GroundFromAtmosphere");
+	m_shSkyOD.Load("SkyOD", "SkyFromAtmosphere");
+	m_shGroundOD.Load("GroundOD", "GroundFromAtmosphere");
+	m_shSpaceOD.Load("SpaceOD", "SpaceFromAtmosphere");
+
+	// Every scattering program reads the same AtmosphereParams buffer
+	CShaderObject *pAtmosphereShaders[] = {
+		&m_shSkyFromSpace, &m_shSkyFromAtmosphere, &m_shGroundFromSpace, &m_shGroundFromAtmosphere,
+		&m_shSpaceFromSpace, &m_shSpaceFromAtmosphere, &m_shSkyLUT, &m_shGroundLUT,
+		&m_shSkyOD, &m_shGroundOD, &m_shSpaceOD
+	};
+	for(CShaderObject *pShader : pAtmosphereShaders)
+		pShader->BindUniformBlock("AtmosphereParams", ATMOSPHERE_BINDING, sizeof(SAtmosphereParams));
+	m_ubAtmosphere.Init(ATMOSPHERE_BINDING, sizeof(SAtmosphereParams));
+	m_bAtmosphereDirty = true;
+
+	m_nLodBias = 0;
+	m_lodGround.Init(m_fInnerRadius, 8);
+	m_lodSky.Init(m_fOuterRadius, 8);
+	m_terrain.Init(m_fInnerRadius, 0.5f * (m_fOuterRadius - m_fInnerRadius), 238653);
+	KeepCameraAboveGround();		// The saved position is right on the inner radius, under any mountains Init() has raised
+	m_szFrameStats[0] = 0;
 
 
 	CPixelBuffer pb;
-	pb.Init(256, 256, 1);
-	pb.MakeGlow2D(40.0f, 0.1f);
+	CAssetCache::LoadOrMake(pb, CAssetKey("MoonGlow").Add(256).Add(40.0f).Add(0.1f), [&pb]() {
+		pb.Init(256, 256, 1);
+		pb.MakeGlow2D(40.0f, 0.1f);
+	});
 	m_tMoonGlow.Init(&pb);
 }
 
@@ -108,14 +175,15 @@ CGameEngine::~CGameEngine()
 void CGameEngine::RenderFrame(int nMilliseconds)
 {
 	// Determine the FPS
-	static char szFrameCount[20] = {0};
 	static int nTime = 0;
 	static int nFrames = 0;
 	nTime += nMilliseconds;
 	if(nTime >= 1000)
 	{
 		m_fFPS = (float)(nFrames * 1000) / (float)nTime;
-		sprintf(szFrameCount, "%2.2f FPS", m_fFPS);
+		sprintf(m_szFrameStats, "%2.2f FPS, ground LOD %d (%d tris), sky LOD %d (%d tris), terrain %d/%d patches", m_fFPS,
+			m_lodGround.GetLevel(), m_terrain.GetTriangleCount(m_lodGround.GetLevel()), m_lodSky.GetLevel(), m_lodSky.GetMesh().GetTriangleCount(),
+			m_terrain.GetDisplacedCount(), TERRAIN_PATCHES_X * TERRAIN_PATCHES_Y);
 		nTime = nFrames = 0;
 	}
 	nFrames++;
@@ -123,6 +191,11 @@ void CGameEngine::RenderFrame(int nMilliseconds)
 	// Move the camera
 	HandleInput(nMilliseconds * 0.001f);
 
+	// Picks up whatever terrain the workers have finished since the last frame, without waiting on the rest.
+	// This comes before the camera is kept above the ground, so a patch never comes in around it.
+	m_terrain.Update(m_3DCamera.GetPosition());
+	KeepCameraAboveGround();
+
 	m_pBuffer.MakeCurrent();
 	glViewport(0, 0, 1024, 1024);
 	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
@@ -134,35 +207,30 @@ void CGameEngine::RenderFrame(int nMilliseconds)
 
 	CVector vCamera = m_3DCamera.GetPosition();
 	CVector vUnitCamera = vCamera / vCamera.Magnitude();
+	UpdateAtmosphereParams(vCamera);
+
+	// The scene renders to the 1024x1024 pbuffer with a 45 degree field of view
+	float fProjectionScale = 512.0f / tanf(DEGTORAD(22.5f));
+	int nGroundLod = m_lodGround.GetLevel(), nSkyLod = m_lodSky.GetLevel();
+	m_lodGround.SelectLevel(vCamera.Magnitude(), fProjectionScale, (float)m_nLodBias);
+	m_lodSky.SelectLevel(vCamera.Magnitude(), fProjectionScale, (float)m_nLodBias);
+	if(nGroundLod != m_lodGround.GetLevel() || nSkyLod != m_lodSky.GetLevel())
+		LogInfo("CGameEngine::RenderFrame() - Ground LOD %d, sky LOD %d", m_lodGround.GetLevel(), m_lodSky.GetLevel());
 
 	CShaderObject *pSpaceShader = NULL;
 	if(vCamera.Magnitude() < m_fOuterRadius)
 		pSpaceShader = &m_shSpaceFromAtmosphere;
 	else if(vCamera.z > 0.0f)
 		pSpaceShader = &m_shSpaceFromSpace;
+	if(pSpaceShader && m_bUseOpticalDepthTable)
+		pSpaceShader = &m_shSpaceOD;
 
 	if(pSpaceShader)
 	{
 		pSpaceShader->Enable();
-		pSpaceShader->SetUniformParameter3f("v3CameraPos", vCamera.x, vCamera.y, vCamera.z);
-		pSpaceShader->SetUniformParameter3f("v3LightPos", m_vLightDirection.x, m_vLightDirection.y, m_vLightDirection.z);
-		pSpaceShader->SetUniformParameter3f("v3InvWavelength", 1/m_fWavelength4[0], 1/m_fWavelength4[1], 1/m_fWavelength4[2]);
-		pSpaceShader->SetUniformParameter1f("fCameraHeight", vCamera.Magnitude());
-		pSpaceShader->SetUniformParameter1f("fCameraHeight2", vCamera.MagnitudeSquared());
-		pSpaceShader->SetUniformParameter1f("fInnerRadius", m_fInnerRadius);
-		pSpaceShader->SetUniformParameter1f("fInnerRadius2", m_fInnerRadius*m_fInnerRadius);
-		pSpaceShader->SetUniformParameter1f("fOuterRadius", m_fOuterRadius);
-		pSpaceShader->SetUniformParameter1f("fOuterRadius2", m_fOuterRadius*m_fOuterRadius);
-		pSpaceShader->SetUniformParameter1f("fKrESun", m_Kr*m_ESun);
-		pSpaceShader->SetUniformParameter1f("fKmESun", m_Km*m_ESun);
-		pSpaceShader->SetUniformParameter1f("fKr4PI", m_Kr4PI);
-		pSpaceShader->SetUniformParameter1f("fKm4PI", m_Km4PI);
-		pSpaceShader->SetUniformParameter1f("fScale", 1.0f / (m_fOuterRadius - m_fInnerRadius));
-		pSpaceShader->SetUniformParameter1f("fScaleDepth", m_fRayleighScaleDepth);
-		pSpaceShader->SetUniformParameter1f("fScaleOverScaleDepth", (1.0f / (m_fOuterRadius - m_fInnerRadius)) / m_fRayleighScaleDepth);
-		pSpaceShader->SetUniformParameter1f("g", m_g);
-		pSpaceShader->SetUniformParameter1f("g2", m_g*m_g);
-		pSpaceShader->SetUniformParameter1i("s2Test", 0);
+		pSpaceShader->SetUniformParameter1i(UniformTest, 0);
+		if(m_bUseOpticalDepthTable)
+			BindOpticalDepthTable(pSpaceShader);
 	}
 
 	m_tMoonGlow.Enable();
@@ -182,31 +250,21 @@ void CGameEngine::RenderFrame(int nMilliseconds)
 		pSpaceShader->Disable();
 
 	CShaderObject *pGroundShader;
-	if(vCamera.Magnitude() >= m_fOuterRadius)
+	if(m_bUseInscatterLUT)
+		pGroundShader = &m_shGroundLUT;
+	else if(m_bUseOpticalDepthTable)
+		pGroundShader = &m_shGroundOD;
+	else if(vCamera.Magnitude() >= m_fOuterRadius)
 		pGroundShader = &m_shGroundFromSpace;
 	else
 		pGroundShader = &m_shGroundFromAtmosphere;
 
 	pGroundShader->Enable();
-	pGroundShader->SetUniformParameter3f("v3CameraPos", vCamera.x, vCamera.y, vCamera.z);
-	pGroundShader->SetUniformParameter3f("v3LightPos", m_vLightDirection.x, m_vLightDirection.y, m_vLightDirection.z);
-	pGroundShader->SetUniformParameter3f("v3InvWavelength", 1/m_fWavelength4[0], 1/m_fWavelength4[1], 1/m_fWavelength4[2]);
-	pGroundShader->SetUniformParameter1f("fCameraHeight", vCamera.Magnitude());
-	pGroundShader->SetUniformParameter1f("fCameraHeight2", vCamera.MagnitudeSquared());
-	pGroundShader->SetUniformParameter1f("fInnerRadius", m_fInnerRadius);
-	pGroundShader->SetUniformParameter1f("fInnerRadius2", m_fInnerRadius*m_fInnerRadius);
-	pGroundShader->SetUniformParameter1f("fOuterRadius", m_fOuterRadius);
-	pGroundShader->SetUniformParameter1f("fOuterRadius2", m_fOuterRadius*m_fOuterRadius);
-	pGroundShader->SetUniformParameter1f("fKrESun", m_Kr*m_ESun);
-	pGroundShader->SetUniformParameter1f("fKmESun", m_Km*m_ESun);
-	pGroundShader->SetUniformParameter1f("fKr4PI", m_Kr4PI);
-	pGroundShader->SetUniformParameter1f("fKm4PI", m_Km4PI);
-	pGroundShader->SetUniformParameter1f("fScale", 1.0f / (m_fOuterRadius - m_fInnerRadius));
-	pGroundShader->SetUniformParameter1f("fScaleDepth", m_fRayleighScaleDepth);
-	pGroundShader->SetUniformParameter1f("fScaleOverScaleDepth", (1.0f / (m_fOuterRadius - m_fInnerRadius)) / m_fRayleighScaleDepth);
-	pGroundShader->SetUniformParameter1f("g", m_g);
-	pGroundShader->SetUniformParameter1f("g2", m_g*m_g);
-	pGroundShader->SetUniformParameter1i("s2Test", 0);
+	pGroundShader->SetUniformParameter1i(UniformTest, 0);
+	if(m_bUseInscatterLUT)
+		BindInscatterTable(pGroundShader);
+	else if(m_bUseOpticalDepthTable)
+		BindOpticalDepthTable(pGroundShader);
 
 	/*
 	if(vCamera.z < 0 && pGroundShader == &m_shGroundFromAtmosphere)
@@ -221,36 +279,24 @@ void CGameEngine::RenderFrame(int nMilliseconds)
 		pGroundShader->SetUniformParameter1f("g2", -0.75f * -0.75f);
 	}
 	*/
-	GLUquadricObj *pSphere = gluNewQuadric();
-	gluSphere(pSphere, m_fInnerRadius, 100, 50);
-	gluDeleteQuadric(pSphere);
+	m_terrain.Draw(m_lodGround.GetLevel());
 	pGroundShader->Disable();
 
 	CShaderObject *pSkyShader;
-	if(vCamera.Magnitude() >= m_fOuterRadius)
+	if(m_bUseInscatterLUT)
+		pSkyShader = &m_shSkyLUT;
+	else if(m_bUseOpticalDepthTable)
+		pSkyShader = &m_shSkyOD;
+	else if(vCamera.Magnitude() >= m_fOuterRadius)
 		pSkyShader = &m_shSkyFromSpace;
 	else
 		pSkyShader = &m_shSkyFromAtmosphere;
 
 	pSkyShader->Enable();
-	pSkyShader->SetUniformParameter3f("v3CameraPos", vCamera.x, vCamera.y, vCamera.z);
-	pSkyShader->SetUniformParameter3f("v3LightPos", m_vLightDirection.x, m_vLightDirection.y, m_vLightDirection.z);
-	pSkyShader->SetUniformParameter3f("v3InvWavelength", 1/m_fWavelength4[0], 1/m_fWavelength4[1], 1/m_fWavelength4[2]);
-	pSkyShader->SetUniformParameter1f("fCameraHeight", vCamera.Magnitude());
-	pSkyShader->SetUniformParameter1f("fCameraHeight2", vCamera.MagnitudeSquared());
-	pSkyShader->SetUniformParameter1f("fInnerRadius", m_fInnerRadius);
-	pSkyShader->SetUniformParameter1f("fInnerRadius2", m_fInnerRadius*m_fInnerRadius);
-	pSkyShader->SetUniformParameter1f("fOuterRadius", m_fOuterRadius);
-	pSkyShader->SetUniformParameter1f("fOuterRadius2", m_fOuterRadius*m_fOuterRadius);
-	pSkyShader->SetUniformParameter1f("fKrESun", m_Kr*m_ESun);
-	pSkyShader->SetUniformParameter1f("fKmESun", m_Km*m_ESun);
-	pSkyShader->SetUniformParameter1f("fKr4PI", m_Kr4PI);
-	pSkyShader->SetUniformParameter1f("fKm4PI", m_Km4PI);
-	pSkyShader->SetUniformParameter1f("fScale", 1.0f / (m_fOuterRadius - m_fInnerRadius));
-	pSkyShader->SetUniformParameter1f("fScaleDepth", m_fRayleighScaleDepth);
-	pSkyShader->SetUniformParameter1f("fScaleOverScaleDepth", (1.0f / (m_fOuterRadius - m_fInnerRadius)) / m_fRayleighScaleDepth);
-	pSkyShader->SetUniformParameter1f("g", m_g);
-	pSkyShader->SetUniformParameter1f("g2", m_g*m_g);
+	if(m_bUseInscatterLUT)
+		BindInscatterTable(pSkyShader);
+	else if(m_bUseOpticalDepthTable)
+		BindOpticalDepthTable(pSkyShader);
 
 	/*
 	if(vCamera.z < 0 && pSkyShader == &m_shSkyFromAtmosphere)
@@ -269,9 +315,7 @@ void CGameEngine::RenderFrame(int nMilliseconds)
 	//glEnable(GL_BLEND);
 	glBlendFunc(GL_ONE, GL_ONE);
 
-	pSphere = gluNewQuadric();
-	gluSphere(pSphere, m_fOuterRadius, 100, 50);
-	gluDeleteQuadric(pSphere);
+	m_lodSky.Draw();
 
 	//glDisable(GL_BLEND);
 	glFrontFace(GL_CCW);
@@ -316,6 +360,138 @@ void CGameEngine::RenderFrame(int nMilliseconds)
 	// glFlush();
 }
 
+void CGameEngine::UpdateAtmosphereParams(const CVector &vCamera)
+{
+	m_atmosphere.v3CameraPos[0] = vCamera.x;
+	m_atmosphere.v3CameraPos[1] = vCamera.y;
+	m_atmosphere.v3CameraPos[2] = vCamera.z;
+	m_atmosphere.fCameraHeight = vCamera.Magnitude();
+	m_atmosphere.fCameraHeight2 = vCamera.MagnitudeSquared();
+	if(!m_bAtmosphereDirty)
+	{
+		m_ubAtmosphere.Update(&m_atmosphere, 0, offsetof(SAtmosphereParams, fPadding));
+		return;
+	}
+
+	m_atmosphere.v3LightPos[0] = m_vLightDirection.x;
+	m_atmosphere.v3LightPos[1] = m_vLightDirection.y;
+	m_atmosphere.v3LightPos[2] = m_vLightDirection.z;
+	for(int i=0; i<3; i++)
+		m_atmosphere.v3InvWavelength[i] = 1 / m_fWavelength4[i];
+	m_atmosphere.fOuterRadius = m_fOuterRadius;
+	m_atmosphere.fInnerRadius = m_fInnerRadius;
+	m_atmosphere.fOuterRadius2 = m_fOuterRadius*m_fOuterRadius;
+	m_atmosphere.fInnerRadius2 = m_fInnerRadius*m_fInnerRadius;
+	m_atmosphere.fKrESun = m_Kr*m_ESun;
+	m_atmosphere.fKmESun = m_Km*m_ESun;
+	m_atmosphere.fKr4PI = m_Kr4PI;
+	m_atmosphere.fKm4PI = m_Km4PI;
+	m_atmosphere.fScale = 1.0f / (m_fOuterRadius - m_fInnerRadius);
+	m_atmosphere.fScaleDepth = m_fRayleighScaleDepth;
+	m_atmosphere.fScaleOverScaleDepth = m_atmosphere.fScale / m_fRayleighScaleDepth;
+	m_atmosphere.g = m_g;
+	m_atmosphere.g2 = m_g*m_g;
+	m_ubAtmosphere.Update(&m_atmosphere, 0, sizeof(m_atmosphere));
+	m_bAtmosphereDirty = false;
+}
+
+void CGameEngine::BindInscatterTable(CShaderObject *pShader)
+{
+	// Texture unit 0 belongs to whatever the fragment shaders texture with
+	glActiveTextureARB(GL_TEXTURE1_ARB);
+	m_tInscatter.Bind();
+	glActiveTextureARB(GL_TEXTURE0_ARB);
+	pShader->SetUniformParameter1i(UniformInscatter, 1);
+	pShader->SetUniformParameter4f(UniformInscatterSize, (float)INSCATTER_SIZE[0], (float)INSCATTER_SIZE[1], (float)INSCATTER_SIZE[2], (float)INSCATTER_SIZE[3]);
+}
+
+void CGameEngine::BindOpticalDepthTable(CShaderObject *pShader)
+{
+	// Texture unit 1 is the inscatter table's, so keep them apart
+	glActiveTextureARB(GL_TEXTURE2_ARB);
+	m_tOpticalDepth.Bind();
+	glActiveTextureARB(GL_TEXTURE0_ARB);
+	pShader->SetUniformParameter1i(UniformOpticalDepth, 2);
+	pShader->SetUniformParameter1f(UniformOpticalDepthSize, (float)m_pbOpticalDepth.GetWidth());
+}
+
+void CGameEngine::BenchmarkOpticalDepth()
+{
+	// Draws the ground and sky from the current camera with the scale() shaders
+	// and then with the optical depth table shaders. glFinish() brackets each
+	// run so the clock covers the GPU's work and not just the submission.
+	const int nDraws = 50;
+	const double fGroundVertices = (double)nDraws * m_lodGround.GetMesh().GetVertexCount();
+	const double fSkyVertices = (double)nDraws * m_lodSky.GetMesh().GetVertexCount();
+
+	CVector vCamera = m_3DCamera.GetPosition();
+	bool bFromSpace = vCamera.Magnitude() >= m_fOuterRadius;
+	UpdateAtmosphereParams(vCamera);
+	struct SVariant
+	{
+		const char *pszName;
+		CShaderObject *pGroundShader;
+		CShaderObject *pSkyShader;
+		bool bTable;
+	} variants[2] = {
+		{ "scale() polynomial", bFromSpace ? &m_shGroundFromSpace : &m_shGroundFromAtmosphere, bFromSpace ? &m_shSkyFromSpace : &m_shSkyFromAtmosphere, false },
+		{ "optical depth table", &m_shGroundOD, &m_shSkyOD, true }
+	};
+
+	m_pBuffer.MakeCurrent();
+	glViewport(0, 0, 1024, 1024);
+	glPushMatrix();
+	glLoadMatrixf(m_3DCamera.GetViewMatrix());
+	C3DObject obj;
+	glMultMatrixf(obj.GetModelMatrix(&m_3DCamera));
+
+	for(int nVariant=0; nVariant<2; nVariant++)
+	{
+		const SVariant &v = variants[nVariant];
+		double fMilliseconds[2];
+		for(int nPass=0; nPass<2; nPass++)
+		{
+			CShaderObject *pShader = nPass ? v.pSkyShader : v.pGroundShader;
+			pShader->Enable();
+			if(v.bTable)
+				BindOpticalDepthTable(pShader);
+			glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+			glFinish();
+
+			auto tStart = std::chrono::high_resolution_clock::now();
+			for(int i=0; i<nDraws; i++)
+				(nPass ? m_lodSky : m_lodGround).Draw();
+			glFinish();
+			fMilliseconds[nPass] = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - tStart).count();
+			pShader->Disable();
+		}
+		LogInfo("CGameEngine::BenchmarkOpticalDepth() - %s: ground %.3f ms, sky %.3f ms per draw (%.1f, %.1f Mvertices/s)", v.pszName,
+			fMilliseconds[0] / nDraws, fMilliseconds[1] / nDraws, fGroundVertices * 0.001 / fMilliseconds[0], fSkyVertices * 0.001 / fMilliseconds[1]);
+	}
+	glPopMatrix();
+
+	// Report how far the polynomial strays from the table for the current radii and scale depth,
+	// relative to the depth straight up from the ground. Only upward rays are compared, since
+	// scale() was only ever fit to those.
+	const float *pTable = (const float *)m_pbOpticalDepth.GetBuffer();
+	int nSize = m_pbOpticalDepth.GetWidth();
+	float fMaxError = 0, fSumError = 0;
+	int nCount = 0;
+	for(int nAngle=0; nAngle<=nSize/2; nAngle++)
+	{
+		float fCos = 1.0f - (nAngle+nAngle) / (float)nSize;
+		for(int nHeight=0; nHeight<nSize; nHeight++)
+		{
+			float fDepth = expf(-(float)nHeight / nSize / m_fRayleighScaleDepth);
+			float fError = fabsf(fDepth * ScatteringScale(fCos, m_fRayleighScaleDepth) - pTable[(nAngle*nSize + nHeight) * 4 + 1]) / pTable[1];
+			fMaxError = Max(fMaxError, fError);
+			fSumError += fError;
+			nCount++;
+		}
+	}
+	LogInfo("CGameEngine::BenchmarkOpticalDepth() - scale() vs. table Rayleigh optical depth: %.2f%% mean, %.2f%% max error", 100.0f * fSumError / nCount, 100.0f * fMaxError);
+}
+
 void CGameEngine::OnChar(WPARAM c)
 {
 	switch(c)
@@ -327,6 +503,23 @@ void CGameEngine::OnChar(WPARAM c)
 		case 'h':
 			m_bUseHDR = !m_bUseHDR;
 			break;
+		case 'l':
+			m_bUseInscatterLUT = !m_bUseInscatterLUT;
+			break;
+		case 'o':
+			m_bUseOpticalDepthTable = !m_bUseOpticalDepthTable;
+			break;
+		case 'b':
+			BenchmarkOpticalDepth();
+			break;
+		case '[':
+			if(m_nLodBias > -SPHERE_LOD_LEVELS)
+				m_nLodBias--;
+			break;
+		case ']':
+			if(m_nLodBias < SPHERE_LOD_LEVELS)
+				m_nLodBias++;
+			break;
 		case '+':
 			m_nSamples++;
 			break;
@@ -336,6 +529,28 @@ void CGameEngine::OnChar(WPARAM c)
 	}
 }
 
+// The rendered ground is flat between the heights at the mesh's vertices, and
+// coarser levels skip some of them, so the camera keeps some clearance above
+// the height right under it. That is the height as drawn, which is the plain
+// sphere until the patch under the camera has been displaced, so the camera
+// can't be held up by mountains that aren't there yet.
+void CGameEngine::KeepCameraAboveGround()
+{
+	const float CLEARANCE = 0.02f;
+
+	CVector vPos = m_3DCamera.GetPosition();
+	float fMagnitude = vPos.Magnitude();
+	float fGround = m_fInnerRadius + m_terrain.GetHeight(vPos) + CLEARANCE;
+	if(fMagnitude < fGround)
+	{
+		vPos *= fGround / fMagnitude;
+		CDoubleVector vLifted(vPos.x, vPos.y, vPos.z);
+		CVector vStop(0.0f);
+		m_3DCamera.SetPosition(vLifted);
+		m_3DCamera.SetVelocity(vStop);
+	}
+}
+
 void CGameEngine::HandleInput(float fSeconds) {
 /*
 	if((GetKeyState('1') & 0x8000))
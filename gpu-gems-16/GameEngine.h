@@ -34,13 +34,48 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "GLUtil.h"
 #include "PBuffer.h"
 #include "Font.h"
+#include "SphereMesh.h"
+#include "Terrain.h"
 
 
+// The uniform buffer binding point the AtmosphereParams block is attached to
+#define ATMOSPHERE_BINDING	0
+
+// The std140 layout of the AtmosphereParams block in Atmosphere.glsl. Each
+// vec3 takes up 12 bytes but must start on a 16 byte boundary.
+struct SAtmosphereParams
+{
+	// Updated every frame
+	float v3CameraPos[3];
+	float fCameraHeight;
+	float fCameraHeight2;
+	float fPadding[3];
+
+	// Updated only when m_bAtmosphereDirty is set
+	float v3LightPos[3];
+	float fOuterRadius;
+	float v3InvWavelength[3];
+	float fInnerRadius;
+	float fOuterRadius2;
+	float fInnerRadius2;
+	float fKrESun;
+	float fKmESun;
+	float fKr4PI;
+	float fKm4PI;
+	float fScale;
+	float fScaleDepth;
+	float fScaleOverScaleDepth;
+	float g;
+	float g2;
+	float fPadding2;
+};
+
 
 class CGameEngine
 {
 protected:
 	float m_fFPS;
+	char m_szFrameStats[128];
 	int m_nTime;
 
 	C3DObject m_3DCamera;
@@ -49,6 +84,8 @@ protected:
 	
 	// Variables that can be tweaked with keypresses
 	bool m_bUseHDR;
+	bool m_bUseInscatterLUT;
+	bool m_bUseOpticalDepthTable;
 	int m_nSamples;
 	GLenum m_nPolygonMode;
 	float m_Kr, m_Kr4PI;
@@ -67,6 +104,8 @@ protected:
 	CPixelBuffer m_pbOpticalDepth;
 
 	CTexture m_tMoonGlow;
+	CTexture m_tInscatter;
+	CTexture m_tOpticalDepth;
 
 	CShaderObject m_shSkyFromSpace;
 	CShaderObject m_shSkyFromAtmosphere;
@@ -74,9 +113,36 @@ protected:
 	CShaderObject m_shGroundFromAtmosphere;
 	CShaderObject m_shSpaceFromSpace;
 	CShaderObject m_shSpaceFromAtmosphere;
+	CShaderObject m_shSkyLUT;
+	CShaderObject m_shGroundLUT;
+	CShaderObject m_shSkyOD;
+	CShaderObject m_shGroundOD;
+	CShaderObject m_shSpaceOD;
+
+	// The ground and sky spheres, each drawn at the level of detail its size on screen calls for
+	int m_nLodBias;
+	CSphereLOD m_lodGround;
+	CSphereLOD m_lodSky;
+
+	// The ground as drawn, displaced by heights the thread pool fills in over the first frames.
+	// m_lodGround still picks its level of detail.
+	CTerrain m_terrain;
+
+	// Set whenever a scattering parameter changes, so the next frame uploads all of m_atmosphere
+	bool m_bAtmosphereDirty;
+	SAtmosphereParams m_atmosphere;
+	CUniformBuffer m_ubAtmosphere;
 
 	CPBuffer m_pBuffer;
 
+	void UpdateAtmosphereParams(const CVector &vCamera);
+	void BindInscatterTable(CShaderObject *pShader);
+	void BindOpticalDepthTable(CShaderObject *pShader);
+	void BenchmarkOpticalDepth();
+
+	// Lifts the camera back out if it has ended up inside the terrain
+	void KeepCameraAboveGround();
+
 public:
 	CGameEngine();
 	~CGameEngine();
@@ -85,6 +151,10 @@ public:
 	void Restore()	{}
 	void HandleInput(float fSeconds);
 	void OnChar(WPARAM c);
+
+	// Refreshed once a second: the frame rate, the level each sphere is drawn at, and how much terrain
+	// is in. The testbed shows it in the window title.
+	const char *GetFrameStats() const	{ return m_szFrameStats; }
 };
 
 #endif // __GameEngine_h__
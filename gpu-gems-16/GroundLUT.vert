@@ -0,0 +1,71 @@
+//
+// Atmospheric scattering vertex shader, precomputed inscatter table version.
+// Replaces the sample loop of GroundFromSpace.vert and GroundFromAtmosphere.vert
+// with two fetches from the table built by CScattering::MakeInscatterTable().
+//
+// Author:  Tim Finer
+// Email:   tfiner@csu.fullerton.edu
+//
+
+#include "Atmosphere.glsl"
+
+uniform sampler3D s3Inscatter;	// The inscatter table
+uniform vec4 v4InscatterSize;	// The table's altitude, view, light and view-light resolutions
+
+
+float scale(float fCos)
+{
+	float x = 1.0 - fCos;
+	return fScaleDepth * exp(-0.00287 + x*(0.459 + x*(3.83 + x*(-6.80 + x*5.25))));
+}
+
+// Looks up v3FrontColor (rgb) and the optical depth (a) for a ray leaving
+// v3Start. The mappings must match CScattering::MakeInscatterTable().
+vec4 texInscatter(vec3 v3Start, vec3 v3Ray)
+{
+	float fHeight = length(v3Start);
+	float fMu = dot(v3Ray, v3Start) / fHeight;
+	float fMuS = dot(v3LightPos, v3Start) / fHeight;
+	float fNu = dot(v3Ray, v3LightPos);
+
+	float uR = sqrt(clamp((fHeight - fInnerRadius) * fScale, 0.0, 1.0));
+	vec3 v3Coord;
+	v3Coord.y = (0.5 * (fMu + 1.0) * (v4InscatterSize.y - 1.0) + 0.5) / v4InscatterSize.y;
+	v3Coord.z = (uR * (v4InscatterSize.x - 1.0) + 0.5) / v4InscatterSize.x;
+	float fMuSCoord = (0.5 * (fMuS + 1.0) * (v4InscatterSize.z - 1.0) + 0.5) / v4InscatterSize.z;
+
+	// The view-light angle slices sit side by side along x, so blend the two nearest by hand
+	float fSlice = 0.5 * (fNu + 1.0) * (v4InscatterSize.w - 1.0);
+	float fSliceFloor = min(floor(fSlice), v4InscatterSize.w - 2.0);
+	v3Coord.x = (fSliceFloor + fMuSCoord) / v4InscatterSize.w;
+	vec4 v4Inscatter = texture3D(s3Inscatter, v3Coord);
+	v3Coord.x = (fSliceFloor + 1.0 + fMuSCoord) / v4InscatterSize.w;
+	return mix(v4Inscatter, texture3D(s3Inscatter, v3Coord), fSlice - fSliceFloor);
+}
+
+void main(void)
+{
+	// Get the ray from the camera to the vertex
+	vec3 v3Pos = gl_Vertex.xyz;
+	vec3 v3Ray = normalize(v3Pos - v3CameraPos);
+
+	// Start where the ray enters the atmosphere, or at the camera if it is already inside
+	float B = 2.0 * dot(v3CameraPos, v3Ray);
+	float C = fCameraHeight2 - fOuterRadius2;
+	float fDet = max(0.0, B*B - 4.0 * C);
+	float fNear = max(0.0, 0.5 * (-B - sqrt(fDet)));
+	vec3 v3Start = v3CameraPos + v3Ray * fNear;
+
+	// The table's rays end at the ground, which is where this vertex is
+	vec4 v4Inscatter = texInscatter(v3Start, v3Ray);
+	gl_FrontColor.rgb = v4Inscatter.rgb * (v3InvWavelength * fKrESun + fKmESun);
+
+	// Calculate the attenuation factor for the ground, along the view ray and from the light down to the vertex
+	float fLightAngle = dot(v3LightPos, v3Pos) / length(v3Pos);
+	float fScatter = v4Inscatter.a + scale(fLightAngle);
+	gl_FrontSecondaryColor.rgb = exp(-fScatter * (v3InvWavelength * fKr4PI + fKm4PI));
+
+	gl_Position = gl_ModelViewProjectionMatrix * gl_Vertex;
+	gl_TexCoord[0] = gl_TextureMatrix[0] * gl_MultiTexCoord0;
+	gl_TexCoord[1] = gl_TextureMatrix[1] * gl_MultiTexCoord1;
+}
@@ -28,14 +28,471 @@ ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
 POSSIBILITY OF SUCH DAMAGE.
 */
 
-#include "Master.h"
+// Noise.cpp only needs the C runtime, so it skips the precompiled Master.h
+// and can be built on its own (see bench/)
 #include "Noise.h"
+#include "Simd.h"
 
 #include <algorithm>
 
-void CNoise::Init(int nDimensions, unsigned int nSeed)
+
+// Calls the member template fn<D> that matches m_nDimensions
+#define NOISE_DISPATCH(fn, ...)									\
+	switch(m_nDimensions)										\
+	{															\
+		case 1:		return fn<1>(__VA_ARGS__);					\
+		case 2:		return fn<2>(__VA_ARGS__);					\
+		case 3:		return fn<3>(__VA_ARGS__);					\
+		default:	return fn<4>(__VA_ARGS__);					\
+	}
+
+
+namespace {
+
+	// The lattice offsets below step through m_nBuffer with a shift
+	static_assert(MAX_DIMENSIONS == 4, "The kernels assume 4 floats per m_nBuffer entry");
+
+	// Simplex noise constants for 1 to MAX_DIMENSIONS dimensions: the skew
+	// factor (sqrt(D+1) - 1) / D, the unskew factor (1 - 1/sqrt(D+1)) / D, and a
+	// scale that gives the result about the same spread as Perlin noise
+	const float g_fSimplexSkew[MAX_DIMENSIONS+1] = {0, 0.414213562f, 0.366025404f, 0.333333333f, 0.309016994f};
+	const float g_fSimplexUnskew[MAX_DIMENSIONS+1] = {0, 0.292893219f, 0.211324865f, 0.166666667f, 0.138196601f};
+	const float g_fSimplexScale[MAX_DIMENSIONS+1] = {0, 61.5f, 77.6f, 100.7f, 133.2f};
+
+	// Squared radius of each corner's falloff. At 0.5 it reaches zero before
+	// the nearest point of any simplex that doesn't share the corner.
+	const float g_fSimplexRadius = 0.5f;
+
+	// Cellular noise centers F1 on its mean and scales it to about the same
+	// spread as Perlin noise, for 1 to MAX_DIMENSIONS dimensions
+	const float g_fCellularMean[MAX_DIMENSIONS+1] = {0, 0.297f, 0.431f, 0.522f, 0.590f};
+	const float g_fCellularScale[MAX_DIMENSIONS+1] = {0, 2.34f, 2.21f, 2.13f, 2.02f};
+
+	// 3^D, the number of cells the cellular search visits
+	template <int D> struct Pow3		{ enum { Value = 3 * Pow3<D-1>::Value }; };
+	template <> struct Pow3<0>			{ enum { Value = 1 }; };
+
+	// Finds the simplex holding f: n is its first corner's skewed lattice
+	// point, x is f's offset from that corner, and nRank[i] counts the offsets
+	// x[i] is larger than. Corner k steps +1 along each i with nRank[i] >= D-k.
+	template <int D>
+	inline void SimplexCell(const float *f, int *n, float *x, int *nRank)
+	{
+		float fSkew = 0, fUnskew = 0;
+		for(int i=0; i<D; i++)
+			fSkew += f[i];
+		fSkew *= g_fSimplexSkew[D];
+		for(int i=0; i<D; i++)
+		{
+			n[i] = Floor(f[i] + fSkew);
+			fUnskew += (float)n[i];
+			nRank[i] = 0;
+		}
+		fUnskew *= g_fSimplexUnskew[D];
+		for(int i=0; i<D; i++)
+			x[i] = f[i] - ((float)n[i] - fUnskew);
+		for(int i=0; i<D; i++)
+		{
+			for(int j=i+1; j<D; j++)
+			{
+				int nGreater = x[i] > x[j];
+				nRank[i] += nGreater;
+				nRank[j] += 1 - nGreater;
+			}
+		}
+	}
+
+	// Simplex corners hash the first SIMPLEX_PREFIX dimensions of their lattice
+	// points through a PerlinT() style tree of every combination. The tree
+	// doesn't depend on which corners the simplex has, so it can be fetched
+	// while their order is still being worked out.
+	#define SIMPLEX_PREFIX(D)	((D) < 2 ? (D) : 2)
+
+	template <int L>
+	inline void LatticePrefix(const unsigned char *pMap, const int *n, int *nPrefix)
+	{
+		nPrefix[0] = 0;
+		for(int d=0; d<L; d++)
+		{
+			for(int c=0; c<(1 << d); c++)
+			{
+				int nBase = nPrefix[c] + n[d];
+				nPrefix[c | (1 << d)] = pMap[(nBase + 1) & 0xFF];
+				nPrefix[c] = pMap[nBase & 0xFF];
+			}
+		}
+	}
+
+	// Corner k of the simplex from SimplexCell(): c is f's offset from it,
+	// fDist is its squared falloff radius minus c . c, and the return value is
+	// its m_nBuffer index
+	template <int D>
+	inline int SimplexCorner(const unsigned char *pMap, const int *n, const float *x, const int *nRank, const int *nPrefix,
+		int k, float *c, float &fDist)
+	{
+		const int L = SIMPLEX_PREFIX(D);
+		int nOffset[D], nCorner = 0;
+		fDist = g_fSimplexRadius;
+		for(int i=0; i<D; i++)
+		{
+			nOffset[i] = nRank[i] >= D-k;
+			c[i] = x[i] - (float)nOffset[i] + k * g_fSimplexUnskew[D];
+			fDist -= c[i] * c[i];
+			if(i < L)
+				nCorner |= nOffset[i] << i;
+		}
+		int nIndex = nPrefix[nCorner];
+		for(int i=L; i<D; i++)
+			nIndex = pMap[(nIndex + n[i] + nOffset[i]) & 0xFF];
+		return nIndex;
+	}
+
+	// Squared distances from f to the nearest and second nearest feature points
+	// of the 3^D cells around it. If pNearest isn't NULL, it gets the offset
+	// from f to the nearest point. Cell c is on the -1, 0 or +1 side of
+	// dimension d by digit d of c in base 3, the first dimension the most
+	// significant, and cells are hashed a dimension at a time like PerlinT()
+	// hashes corners.
+	template <int D>
+	inline void CellularSearch(const unsigned char *pMap, const float (*pJitter)[MAX_DIMENSIONS], const float *f,
+		float &fF1, float &fF2, float *pNearest)
+	{
+		int n[D];
+		float fBase[D][3];		// Offset from f to the low corner of the cells on each side
+		for(int d=0; d<D; d++)
+		{
+			n[d] = Floor(f[d]);
+			float r = f[d] - n[d];
+			for(int o=0; o<3; o++)
+				fBase[d][o] = (float)(o - 1) - r;
+		}
+
+		// Each pass splits every cell so far into its -1, 0 and +1 neighbours
+		// along the next dimension. Going backwards leaves entries still to be
+		// read alone.
+		int nIndex[Pow3<D>::Value];
+		nIndex[0] = 0;
+		for(int d=0, nCount=1; d<D; d++, nCount*=3)
+		{
+			for(int c=nCount-1; c>=0; c--)
+			{
+				int nBase = nIndex[c] + n[d];
+				nIndex[3*c+2] = pMap[(nBase + 1) & 0xFF];
+				nIndex[3*c+1] = pMap[nBase & 0xFF];
+				nIndex[3*c] = pMap[(nBase - 1) & 0xFF];
+			}
+		}
+
+		fF1 = fF2 = FLT_MAX;
+		for(int c=0; c<Pow3<D>::Value; c++)
+		{
+			float fDelta[D], fDist = 0;
+			for(int d=0, nStride=Pow3<D-1>::Value; d<D; d++, nStride/=3)
+			{
+				fDelta[d] = pJitter[nIndex[c]][d] + fBase[d][c / nStride % 3];
+				fDist += fDelta[d] * fDelta[d];
+			}
+			if(pNearest && fDist < fF1)
+			{
+				for(int d=0; d<D; d++)
+					pNearest[d] = fDelta[d];
+			}
+			fF2 = Min(fF2, Max(fF1, fDist));
+			fF1 = Min(fF1, fDist);
+		}
+	}
+
+
+	// One SIMD_WIDTH wide batch of CNoise::Noise() in D dimensions. The 2^D
+	// corners of each point's cell go through the same Lattice() steps and
+	// Lerp()s in the same order as the scalar code, so the results match it.
+	template <int D>
+	CSimdFloat PerlinKernel(const int *pMap, const float *pBuffer, const CSimdFloat *f)
+	{
+		CSimdInt n[D];
+		CSimdFloat r[D], w[D];
+		for(int d=0; d<D; d++)
+		{
+			CSimdFloat fFloor = Floor(f[d]);
+			n[d] = ToInt(fFloor);
+			r[d] = f[d] - fFloor;
+			w[d] = r[d] * r[d] * (CSimdFloat(3.0f) - CSimdFloat(2.0f) * r[d]);
+		}
+
+		// Corner c is on the +1 side of dimension d when bit d of c is set. Corners
+		// that agree in their first d dimensions share the first d map lookups.
+		CSimdInt nIndex[1 << D];
+		nIndex[0] = CSimdInt(0);
+		for(int d=0; d<D; d++)
+		{
+			for(int c=0; c<(1 << d); c++)
+			{
+				CSimdInt nBase = nIndex[c] + n[d];
+				nIndex[c | (1 << d)] = Gather(pMap, (nBase + CSimdInt(1)) & CSimdInt(0xFF));
+				nIndex[c] = Gather(pMap, nBase & CSimdInt(0xFF));
+			}
+		}
+
+		CSimdFloat fValue[1 << D];
+		for(int c=0; c<(1 << D); c++)
+		{
+			CSimdInt nOffset = nIndex[c] << 2;
+			fValue[c] = CSimdFloat(0.0f);
+			for(int d=0; d<D; d++)
+				fValue[c] += Gather(pBuffer + d, nOffset) * ((c & (1 << d)) ? r[d] - CSimdFloat(1.0f) : r[d]);
+		}
+
+		// Collapse one dimension at a time, the first one innermost like Noise()
+		for(int d=0; d<D; d++)
+			for(int c=0; c<(1 << (D-1-d)); c++)
+				fValue[c] = fValue[2*c] + w[d] * (fValue[2*c+1] - fValue[2*c]);
+
+		return Min(Max(fValue[0] * CSimdFloat(2.0f), CSimdFloat(-0.99999f)), CSimdFloat(0.99999f));
+	}
+
+
+	// The simplex version of PerlinKernel(), following CNoise::SimplexT() step
+	// for step. The corner offsets come from lane masks instead of branches.
+	template <int D>
+	CSimdFloat SimplexKernel(const int *pMap, const float *pBuffer, const CSimdFloat *f)
+	{
+		CSimdFloat fSkew = f[0];
+		for(int i=1; i<D; i++)
+			fSkew += f[i];
+		fSkew *= CSimdFloat(g_fSimplexSkew[D]);
+
+		CSimdFloat n[D], x[D], fRank[D];
+		CSimdFloat fUnskew(0.0f);
+		for(int i=0; i<D; i++)
+		{
+			n[i] = Floor(f[i] + fSkew);
+			fUnskew += n[i];
+			fRank[i] = CSimdFloat(0.0f);
+		}
+		fUnskew *= CSimdFloat(g_fSimplexUnskew[D]);
+		for(int i=0; i<D; i++)
+			x[i] = f[i] - (n[i] - fUnskew);
+		for(int i=0; i<D; i++)
+		{
+			for(int j=i+1; j<D; j++)
+			{
+				CSimdFloat fGreater = x[i] > x[j];
+				fRank[i] += CSimdFloat(1.0f) & fGreater;
+				fRank[j] += Select(fGreater, CSimdFloat(0.0f), CSimdFloat(1.0f));
+			}
+		}
+
+		// The SIMPLEX_PREFIX tree, as in LatticePrefix()
+		const int L = SIMPLEX_PREFIX(D);
+		CSimdInt nPrefix[1 << L];
+		nPrefix[0] = CSimdInt(0);
+		for(int d=0; d<L; d++)
+		{
+			for(int c=0; c<(1 << d); c++)
+			{
+				CSimdInt nBase = nPrefix[c] + ToInt(n[d]);
+				nPrefix[c | (1 << d)] = Gather(pMap, (nBase + CSimdInt(1)) & CSimdInt(0xFF));
+				nPrefix[c] = Gather(pMap, nBase & CSimdInt(0xFF));
+			}
+		}
+
+		CSimdFloat fValue(0.0f);
+		for(int k=0; k<=D; k++)
+		{
+			CSimdFloat fDist(g_fSimplexRadius), c[D], fOffset[D];
+			for(int i=0; i<D; i++)
+			{
+				fOffset[i] = fRank[i] >= CSimdFloat((float)(D-k));
+				c[i] = x[i] - (CSimdFloat(1.0f) & fOffset[i]) + CSimdFloat(k * g_fSimplexUnskew[D]);
+				fDist -= c[i] * c[i];
+			}
+
+			// Each lane picks its corner's entry out of the tree a bit at a time, then hashes the rest
+			CSimdInt nChoice[1 << L];
+			for(int c=0; c<(1 << L); c++)
+				nChoice[c] = nPrefix[c];
+			for(int i=L-1; i>=0; i--)
+				for(int c=0; c<(1 << i); c++)
+					nChoice[c] = Select(fOffset[i], nChoice[c | (1 << i)], nChoice[c]);
+			CSimdInt nIndex = nChoice[0];
+			for(int i=L; i<D; i++)
+				nIndex = Gather(pMap, (nIndex + ToInt(n[i] + (CSimdFloat(1.0f) & fOffset[i]))) & CSimdInt(0xFF));
+
+			CSimdInt nOffset = nIndex << 2;
+			CSimdFloat fDot(0.0f);
+			for(int i=0; i<D; i++)
+				fDot += Gather(pBuffer + i, nOffset) * c[i];
+			fDist = Max(fDist, CSimdFloat(0.0f));
+			fDist *= fDist;
+			fValue += fDist * fDist * fDot;
+		}
+		fValue *= CSimdFloat(g_fSimplexScale[D]);
+		return Min(Max(fValue, CSimdFloat(-0.99999f)), CSimdFloat(0.99999f));
+	}
+
+
+	// CellularSearch() for a SIMD_WIDTH wide batch, with the same arithmetic in
+	// the same order, so F1 and F2 match it lane for lane. Returns their square
+	// roots. Every lane visits all 3^D cells, with no early outs to diverge on.
+	template <int D>
+	void CellularKernel(const int *pMap, const float *pJitter, const CSimdFloat *f, CSimdFloat &fF1, CSimdFloat &fF2)
+	{
+		CSimdInt n[D];
+		CSimdFloat fBase[D][3];
+		for(int d=0; d<D; d++)
+		{
+			CSimdFloat fFloor = Floor(f[d]);
+			n[d] = ToInt(fFloor);
+			CSimdFloat r = f[d] - fFloor;
+			for(int o=0; o<3; o++)
+				fBase[d][o] = CSimdFloat((float)(o - 1)) - r;
+		}
+
+		CSimdInt nIndex[Pow3<D>::Value];
+		nIndex[0] = CSimdInt(0);
+		for(int d=0, nCount=1; d<D; d++, nCount*=3)
+		{
+			for(int c=nCount-1; c>=0; c--)
+			{
+				CSimdInt nBase = nIndex[c] + n[d];
+				nIndex[3*c+2] = Gather(pMap, (nBase + CSimdInt(1)) & CSimdInt(0xFF));
+				nIndex[3*c+1] = Gather(pMap, nBase & CSimdInt(0xFF));
+				nIndex[3*c] = Gather(pMap, (nBase + CSimdInt(-1)) & CSimdInt(0xFF));
+			}
+		}
+
+		fF1 = fF2 = CSimdFloat(FLT_MAX);
+		for(int c=0; c<Pow3<D>::Value; c++)
+		{
+			CSimdInt nOffset = nIndex[c] << 2;
+			CSimdFloat fDist(0.0f);
+			for(int d=0, nStride=Pow3<D-1>::Value; d<D; d++, nStride/=3)
+			{
+				CSimdFloat fDelta = Gather(pJitter + d, nOffset) + fBase[d][c / nStride % 3];
+				fDist += fDelta * fDelta;
+			}
+			fF2 = Min(fF2, Max(fF1, fDist));
+			fF1 = Min(fF1, fDist);
+		}
+		fF1 = Sqrt(fF1);
+		fF2 = Sqrt(fF2);
+	}
+
+
+	template <int D>
+	CSimdFloat BasisKernel(NoiseBasis nBasis, const int *pMap, const float *pBuffer, const float *pJitter, const CSimdFloat *f)
+	{
+		if(nBasis == CellularBasis)
+		{
+			CSimdFloat fF1, fF2;
+			CellularKernel<D>(pMap, pJitter, f, fF1, fF2);
+			CSimdFloat fValue = (fF1 - CSimdFloat(g_fCellularMean[D])) * CSimdFloat(g_fCellularScale[D]);
+			return Min(Max(fValue, CSimdFloat(-0.99999f)), CSimdFloat(0.99999f));
+		}
+		return nBasis == SimplexBasis ? SimplexKernel<D>(pMap, pBuffer, f) : PerlinKernel<D>(pMap, pBuffer, f);
+	}
+
+
+	// Clamps fValue the way the scalar functions all do, and sets pGradient to
+	// fGradient * fScale, or to 0 where the clamp flattens the value out
+	template <int D>
+	float ClampGradient(float fValue, const float *fGradient, float fScale, float *pGradient)
+	{
+		if(fValue <= -0.99999f || fValue >= 0.99999f)
+			fScale = 0;
+		for(int d=0; d<D; d++)
+			pGradient[d] = fGradient[d] * fScale;
+		return CLAMP(-0.99999f, 0.99999f, fValue);
+	}
+
+
+	// Runs kernel over nCount points SIMD_WIDTH at a time, padding the last
+	// partial batch by repeating its final point. The kernel fills R results
+	// per batch, which go to pOut[0] through pOut[R-1].
+	template <int D, int R, class Kernel>
+	void BatchRange(const float *const *pCoord, float *const *pOut, int nCount, const Kernel &kernel)
+	{
+		CSimdFloat f[D], fResult[R];
+		int nFull = SIMD_ROUND_DOWN(nCount);
+		int n;
+		for(n=0; n<nFull; n+=SIMD_WIDTH)
+		{
+			for(int d=0; d<D; d++)
+				f[d] = CSimdFloat::Load(pCoord[d] + n);
+			kernel(f, fResult);
+			for(int i=0; i<R; i++)
+				fResult[i].Store(pOut[i] + n);
+		}
+		if(n == nCount)
+			return;
+
+		float fCoord[D][SIMD_WIDTH], fOut[R][SIMD_WIDTH];
+		for(int d=0; d<D; d++)
+		{
+			for(int i=0; i<SIMD_WIDTH; i++)
+				fCoord[d][i] = pCoord[d][Min(n + i, nCount - 1)];
+			f[d] = CSimdFloat::Load(fCoord[d]);
+		}
+		kernel(f, fResult);
+		for(int i=0; i<R; i++)
+		{
+			fResult[i].Store(fOut[i]);
+			for(int j=0; n+j<nCount; j++)
+				pOut[i][n+j] = fOut[i][j];
+		}
+	}
+
+
+	template <int D>
+	void NoiseRange(NoiseBasis nBasis, const int *pMap, const float *pBuffer, const float *pJitter,
+		const float *const *pCoord, float *pOut, int nCount)
+	{
+		BatchRange<D, 1>(pCoord, &pOut, nCount, [=](const CSimdFloat *f, CSimdFloat *pResult) {
+			pResult[0] = BasisKernel<D>(nBasis, pMap, pBuffer, pJitter, f);
+		});
+	}
+
+	template <int D>
+	void CellularRange(const int *pMap, const float *pJitter, const float *const *pCoord, float *pF1, float *pF2, int nCount)
+	{
+		float *pOut[2] = {pF1, pF2};
+		BatchRange<D, 2>(pCoord, pOut, nCount, [=](const CSimdFloat *f, CSimdFloat *pResult) {
+			CellularKernel<D>(pMap, pJitter, f, pResult[0], pResult[1]);
+		});
+	}
+
+	// Follows CFractal::fBm(), including its octave count and remainder handling
+	template <int D>
+	void fBmRange(NoiseBasis nBasis, const int *pMap, const float *pBuffer, const float *pJitter, const float *pExponent,
+		float fLacunarity, float fOctaves, const float *const *pCoord, float *pOut, int nCount)
+	{
+		BatchRange<D, 1>(pCoord, &pOut, nCount, [=](const CSimdFloat *f, CSimdFloat *pResult) {
+			CSimdFloat fTemp[D];
+			for(int d=0; d<D; d++)
+				fTemp[d] = f[d];
+
+			CSimdFloat fValue(0.0f);
+			for(int i=0; i<fOctaves; i++)
+			{
+				fValue += BasisKernel<D>(nBasis, pMap, pBuffer, pJitter, fTemp) * CSimdFloat(pExponent[i]);
+				for(int d=0; d<D; d++)
+					fTemp[d] *= CSimdFloat(fLacunarity);
+			}
+
+			float fRemainder = fOctaves - (int)fOctaves;
+			if(fRemainder > DELTA)
+				fValue += CSimdFloat(fRemainder) * BasisKernel<D>(nBasis, pMap, pBuffer, pJitter, fTemp) * CSimdFloat(pExponent[Min((int)fOctaves, MAX_OCTAVES-1)]);
+			pResult[0] = Min(Max(fValue, CSimdFloat(-0.99999f)), CSimdFloat(0.99999f));
+		});
+	}
+
+}
+
+
+void CNoise::Init(int nDimensions, unsigned int nSeed, NoiseBasis nBasis)
 {
 	m_nDimensions = MIN(nDimensions, MAX_DIMENSIONS);
+	m_nBasis = nBasis;
 	CRandom r(nSeed);
 
 	int i, j, k;
@@ -52,91 +509,309 @@ void CNoise::Init(int nDimensions, unsigned int nSeed)
 		j = r.RandomI(0, 255);
 		SWAP(m_nMap[i], m_nMap[j], k);
 	}
-	//_fpreset();	// Bug in CRandom! Causes messed up floating point operations!
+	for(i=0; i<256; i++)
+		m_nMapWide[i] = m_nMap[i];
+
+	// Drawn after the tables above so they come out the same as ever for a seed
+	for(i=0; i<256; i++)
+		for(j=0; j<m_nDimensions; j++)
+			m_fJitter[i][j] = (float)r.Random();
+}
+
+template <int D>
+float CNoise::NoiseT(const float *f) const
+{
+	switch(m_nBasis)
+	{
+		case SimplexBasis:	return SimplexT<D>(f);
+		case CellularBasis:	return CellularBasisT<D>(f);
+		default:			return PerlinT<D>(f);
+	}
+}
+
+template <int D>
+float CNoise::NoiseGradientT(const float *f, float *pGradient) const
+{
+	switch(m_nBasis)
+	{
+		case SimplexBasis:	return SimplexGradientT<D>(f, pGradient);
+		case CellularBasis:	return CellularGradientT<D>(f, pGradient);
+		default:			return PerlinGradientT<D>(f, pGradient);
+	}
+}
+
+template <int D>
+float CNoise::PerlinT(const float *f) const
+{
+	int n[D];			// Indexes to pass to lattice function
+	float r[D];			// Remainders to pass to lattice function
+	float w[D];			// Cubic values to pass to interpolation function
+
+	for(int i=0; i<D; i++)
+	{
+		n[i] = Floor(f[i]);
+		r[i] = f[i] - n[i];
+		w[i] = Cubic(r[i]);
+	}
+
+	// Corner c of the cell is on the +1 side of dimension d when bit d of c is
+	// set. Corners that agree in their first d dimensions share the first d map
+	// lookups, so there are 2^(D+1)-2 of them instead of D*2^D.
+	int nIndex[1 << D];
+	nIndex[0] = 0;
+	for(int d=0; d<D; d++)
+	{
+		for(int c=0; c<(1 << d); c++)
+		{
+			int nBase = nIndex[c] + n[d];
+			nIndex[c | (1 << d)] = m_nMap[(nBase + 1) & 0xFF];
+			nIndex[c] = m_nMap[nBase & 0xFF];
+		}
+	}
+
+	float fValue[1 << D];
+	for(int c=0; c<(1 << D); c++)
+	{
+		fValue[c] = 0;
+		for(int d=0; d<D; d++)
+			fValue[c] += m_nBuffer[nIndex[c]][d] * ((c & (1 << d)) ? r[d] - 1 : r[d]);
+	}
+
+	// Collapse one dimension at a time, the first one innermost
+	for(int d=0; d<D; d++)
+		for(int c=0; c<(1 << (D-1-d)); c++)
+			fValue[c] = Lerp(fValue[2*c], fValue[2*c+1], w[d]);
+
+	return CLAMP(-0.99999f, 0.99999f, fValue[0]*2.0f);
 }
 
-float CNoise::Noise(float *f)
+float CNoise::Noise(const float *f) const
 {
-	int n[MAX_DIMENSIONS];			// Indexes to pass to lattice function
-	float r[MAX_DIMENSIONS];		// Remainders to pass to lattice function
-	float w[MAX_DIMENSIONS];		// Cubic values to pass to interpolation function
+	NOISE_DISPATCH(NoiseT, f);
+}
+
+template <int D>
+float CNoise::PerlinGradientT(const float *f, float *pGradient) const
+{
+	int n[D];			// Indexes to pass to lattice function
+	float r[D];			// Remainders to pass to lattice function
+	float w[D];			// Cubic values to pass to interpolation function
+	float dw[D];		// Slopes of the cubics
 
-	for(int i=0; i<m_nDimensions; i++)
+	for(int i=0; i<D; i++)
 	{
 		n[i] = Floor(f[i]);
 		r[i] = f[i] - n[i];
 		w[i] = Cubic(r[i]);
+		dw[i] = 6 * r[i] * (1 - r[i]);
+	}
+
+	// The same lattice lookups as PerlinT()
+	int nIndex[1 << D];
+	nIndex[0] = 0;
+	for(int d=0; d<D; d++)
+	{
+		for(int c=0; c<(1 << d); c++)
+		{
+			int nBase = nIndex[c] + n[d];
+			nIndex[c | (1 << d)] = m_nMap[(nBase + 1) & 0xFF];
+			nIndex[c] = m_nMap[nBase & 0xFF];
+		}
+	}
+
+	// Each corner's value is a dot product with its lattice vector, so that vector is its gradient
+	const float *pCorner[1 << D];
+	float fValue[1 << D];
+	for(int c=0; c<(1 << D); c++)
+	{
+		pCorner[c] = m_nBuffer[nIndex[c]];
+		fValue[c] = 0;
+		for(int d=0; d<D; d++)
+			fValue[c] += pCorner[c][d] * ((c & (1 << d)) ? r[d] - 1 : r[d]);
+	}
+
+	// The derivative of Lerp(a, b, w) is Lerp(a', b', w), plus (b - a) * w'
+	// along the dimension being collapsed. Carrying whole gradients through the
+	// tree costs D lerps a node, so the two parts are summed separately. The
+	// first is the corners' lattice vectors, each weighted by its share of the
+	// value, which is a flat sum with no chain of lerps to wait on.
+	float fWeight[1 << D];
+	fWeight[0] = 1;
+	for(int d=0; d<D; d++)
+	{
+		for(int c=0; c<(1 << d); c++)
+		{
+			fWeight[c | (1 << d)] = fWeight[c] * w[d];
+			fWeight[c] *= 1 - w[d];
+		}
+	}
+	float fGradient[D];
+	for(int k=0; k<D; k++)
+		fGradient[k] = 0;
+	for(int c=0; c<(1 << D); c++)
+		for(int k=0; k<D; k++)
+			fGradient[k] += fWeight[c] * pCorner[c][k];
+
+	// The second is each dimension's (b - a), which only the dimensions
+	// collapsed after it still have to lerp. The values collapse as in PerlinT().
+	float fSlope[D][1 << (D-1)];
+	for(int d=0; d<D; d++)
+	{
+		for(int c=0; c<(1 << (D-1-d)); c++)
+		{
+			for(int e=0; e<d; e++)
+				fSlope[e][c] = Lerp(fSlope[e][2*c], fSlope[e][2*c+1], w[d]);
+			fSlope[d][c] = fValue[2*c+1] - fValue[2*c];
+			fValue[c] = Lerp(fValue[2*c], fValue[2*c+1], w[d]);
+		}
+	}
+	for(int k=0; k<D; k++)
+		fGradient[k] += fSlope[k][0] * dw[k];
+
+	return ClampGradient<D>(fValue[0]*2.0f, fGradient, 2.0f, pGradient);
+}
+
+float CNoise::NoiseGradient(const float *f, float *pGradient) const
+{
+	NOISE_DISPATCH(NoiseGradientT, f, pGradient);
+}
+
+template <int D>
+float CNoise::SimplexT(const float *f) const
+{
+	int n[D];			// Skewed lattice point of the simplex's first corner
+	float x[D];			// Offset from that corner
+	int nRank[D];		// Order of the offsets, which picks the other corners
+	SimplexCell<D>(f, n, x, nRank);
+	int nPrefix[1 << SIMPLEX_PREFIX(D)];
+	LatticePrefix<SIMPLEX_PREFIX(D)>(m_nMap, n, nPrefix);
+
+	// Each corner hashes its lattice point the same way PerlinT() does, so they
+	// share gradients. Whether a corner is in range is a coin flip, so corners
+	// out of range add zero rather than branch.
+	float fValue = 0;
+	for(int k=0; k<=D; k++)
+	{
+		float fDist, c[D];
+		int nIndex = SimplexCorner<D>(m_nMap, n, x, nRank, nPrefix, k, c, fDist);
+		float fDot = 0;
+		for(int i=0; i<D; i++)
+			fDot += m_nBuffer[nIndex][i] * c[i];
+		fDist = (fDist + Abs(fDist)) * 0.5f;		// Max(fDist, 0) without a branch
+		fDist *= fDist;
+		fValue += fDist * fDist * fDot;
+	}
+	return CLAMP(-0.99999f, 0.99999f, fValue * g_fSimplexScale[D]);
+}
+
+template <int D>
+float CNoise::SimplexGradientT(const float *f, float *pGradient) const
+{
+	int n[D];
+	float x[D];
+	int nRank[D];
+	SimplexCell<D>(f, n, x, nRank);
+	int nPrefix[1 << SIMPLEX_PREFIX(D)];
+	LatticePrefix<SIMPLEX_PREFIX(D)>(m_nMap, n, nPrefix);
+
+	// A corner adds t^4 * (g . c) with t = r^2 - c . c, so its gradient is t^4 * g - 8 * t^3 * (g . c) * c
+	float fValue = 0, fGradient[D];
+	for(int i=0; i<D; i++)
+		fGradient[i] = 0;
+	for(int k=0; k<=D; k++)
+	{
+		float fDist, c[D];
+		int nIndex = SimplexCorner<D>(m_nMap, n, x, nRank, nPrefix, k, c, fDist);
+		float fDot = 0;
+		for(int i=0; i<D; i++)
+			fDot += m_nBuffer[nIndex][i] * c[i];
+		fDist = (fDist + Abs(fDist)) * 0.5f;		// Max(fDist, 0) without a branch
+		float fDist2 = fDist * fDist;
+		float fDist4 = fDist2 * fDist2;
+		fValue += fDist4 * fDot;
+		for(int i=0; i<D; i++)
+			fGradient[i] += fDist4 * m_nBuffer[nIndex][i] - 8 * fDist2 * fDist * fDot * c[i];
+	}
+	return ClampGradient<D>(fValue * g_fSimplexScale[D], fGradient, g_fSimplexScale[D], pGradient);
+}
+
+void CNoise::NoiseN(const float *const *pCoord, float *pOut, int nCount) const
+{
+	const float *pBuffer = &m_nBuffer[0][0];
+	switch(m_nDimensions)
+	{
+		case 1:
+			NoiseRange<1>(m_nBasis, m_nMapWide, pBuffer, &m_fJitter[0][0], pCoord, pOut, nCount);
+			break;
+		case 2:
+			NoiseRange<2>(m_nBasis, m_nMapWide, pBuffer, &m_fJitter[0][0], pCoord, pOut, nCount);
+			break;
+		case 3:
+			NoiseRange<3>(m_nBasis, m_nMapWide, pBuffer, &m_fJitter[0][0], pCoord, pOut, nCount);
+			break;
+		case 4:
+			NoiseRange<4>(m_nBasis, m_nMapWide, pBuffer, &m_fJitter[0][0], pCoord, pOut, nCount);
+			break;
 	}
+}
 
-	float fValue;
+template <int D>
+void CNoise::CellularT(const float *f, float *pF1, float *pF2) const
+{
+	float fF1, fF2;
+	CellularSearch<D>(m_nMap, m_fJitter, f, fF1, fF2, NULL);
+	*pF1 = sqrtf(fF1);
+	*pF2 = sqrtf(fF2);
+}
+
+void CNoise::Cellular(const float *f, float *pF1, float *pF2) const
+{
+	NOISE_DISPATCH(CellularT, f, pF1, pF2);
+}
+
+template <int D>
+float CNoise::CellularBasisT(const float *f) const
+{
+	float fF1, fF2;
+	CellularSearch<D>(m_nMap, m_fJitter, f, fF1, fF2, NULL);
+	return CLAMP(-0.99999f, 0.99999f, (sqrtf(fF1) - g_fCellularMean[D]) * g_fCellularScale[D]);
+}
+
+template <int D>
+float CNoise::CellularGradientT(const float *f, float *pGradient) const
+{
+	// Nothing is nearer than FLT_MAX when f isn't a number, so start from a flat gradient
+	float fF1, fF2, fNearest[D] = {0};
+	CellularSearch<D>(m_nMap, m_fJitter, f, fF1, fF2, fNearest);
+	fF1 = sqrtf(fF1);
+
+	// F1 grows at a rate of 1 straight away from the nearest point, and its
+	// slope jumps where the nearest point changes
+	float fGradient[D];
+	float fInvDist = fF1 > 0 ? -1 / fF1 : 0;
+	for(int d=0; d<D; d++)
+		fGradient[d] = fNearest[d] * fInvDist;
+	return ClampGradient<D>((fF1 - g_fCellularMean[D]) * g_fCellularScale[D], fGradient, g_fCellularScale[D], pGradient);
+}
+
+void CNoise::CellularN(const float *const *pCoord, float *pF1, float *pF2, int nCount) const
+{
+	const float *pJitter = &m_fJitter[0][0];
 	switch(m_nDimensions)
 	{
 		case 1:
-			fValue = Lerp(Lattice(n[0], r[0]),
-						  Lattice(n[0]+1, r[0]-1),
-						  w[0]);
+			CellularRange<1>(m_nMapWide, pJitter, pCoord, pF1, pF2, nCount);
 			break;
 		case 2:
-			fValue = Lerp(Lerp(Lattice(n[0], r[0], n[1], r[1]),
-							   Lattice(n[0]+1, r[0]-1, n[1], r[1]),
-							   w[0]),
-						  Lerp(Lattice(n[0], r[0], n[1]+1, r[1]-1),
-							   Lattice(n[0]+1, r[0]-1, n[1]+1, r[1]-1),
-							   w[0]),
-						  w[1]);
+			CellularRange<2>(m_nMapWide, pJitter, pCoord, pF1, pF2, nCount);
 			break;
 		case 3:
-			fValue = Lerp(Lerp(Lerp(Lattice(n[0], r[0], n[1], r[1], n[2], r[2]),
-									Lattice(n[0]+1, r[0]-1, n[1], r[1], n[2], r[2]),
-									w[0]),
-							   Lerp(Lattice(n[0], r[0], n[1]+1, r[1]-1, n[2], r[2]),
-									Lattice(n[0]+1, r[0]-1, n[1]+1, r[1]-1, n[2], r[2]),
-									w[0]),
-							   w[1]),
-						  Lerp(Lerp(Lattice(n[0], r[0], n[1], r[1], n[2]+1, r[2]-1),
-									Lattice(n[0]+1, r[0]-1, n[1], r[1], n[2]+1, r[2]-1),
-									w[0]),
-							   Lerp(Lattice(n[0], r[0], n[1]+1, r[1]-1, n[2]+1, r[2]-1),
-									Lattice(n[0]+1, r[0]-1, n[1]+1, r[1]-1, n[2]+1, r[2]-1),
-									w[0]),
-							   w[1]),
-						  w[2]);
+			CellularRange<3>(m_nMapWide, pJitter, pCoord, pF1, pF2, nCount);
 			break;
 		case 4:
-			fValue = Lerp(Lerp(Lerp(Lerp(Lattice(n[0], r[0], n[1], r[1], n[2], r[2], n[3], r[3]),
-										 Lattice(n[0]+1, r[0]-1, n[1], r[1], n[2], r[2], n[3], r[3]),
-										 w[0]),
-									Lerp(Lattice(n[0], r[0], n[1]+1, r[1]-1, n[2], r[2], n[3], r[3]),
-										 Lattice(n[0]+1, r[0]-1, n[1]+1, r[1]-1, n[2], r[2], n[3], r[3]),
-										 w[0]),
-									w[1]),
-									Lerp(Lerp(Lattice(n[0], r[0], n[1], r[1], n[2]+1, r[2]-1, n[3], r[3]),
-										 Lattice(n[0]+1, r[0]-1, n[1], r[1], n[2]+1, r[2]-1, n[3], r[3]),
-										 w[0]),
-									Lerp(Lattice(n[0], r[0], n[1]+1, r[1]-1, n[2]+1, r[2]-1),
-										 Lattice(n[0]+1, r[0]-1, n[1]+1, r[1]-1, n[2]+1, r[2]-1, n[3], r[3]),
-										 w[0]),
-									w[1]),
-							   w[2]),
-						  Lerp(Lerp(Lerp(Lattice(n[0], r[0], n[1], r[1], n[2], r[2], n[3]+1, r[3]-1),
-										 Lattice(n[0]+1, r[0]-1, n[1], r[1], n[2], r[2], n[3]+1, r[3]-1),
-										 w[0]),
-									Lerp(Lattice(n[0], r[0], n[1]+1, r[1]-1, n[2], r[2], n[3]+1, r[3]-1),
-										 Lattice(n[0]+1, r[0]-1, n[1]+1, r[1]-1, n[2], r[2], n[3]+1, r[3]-1),
-										 w[0]),
-									w[1]),
-									Lerp(Lerp(Lattice(n[0], r[0], n[1], r[1], n[2]+1, r[2]-1, n[3]+1, r[3]-1),
-										 Lattice(n[0]+1, r[0]-1, n[1], r[1], n[2]+1, r[2]-1, n[3]+1, r[3]-1),
-										 w[0]),
-									Lerp(Lattice(n[0], r[0], n[1]+1, r[1]-1, n[2]+1, r[2]-1),
-										 Lattice(n[0]+1, r[0]-1, n[1]+1, r[1]-1, n[2]+1, r[2]-1, n[3]+1, r[3]-1),
-										 w[0]),
-									w[1]),
-							   w[2]),
-						  w[3]);
+			CellularRange<4>(m_nMapWide, pJitter, pCoord, pF1, pF2, nCount);
 			break;
 	}
-	return CLAMP(-0.99999f, 0.99999f, fValue*2.0f);
 }
 
 void CSeededNoise::Init(unsigned int nSeed)
@@ -156,7 +831,7 @@ void CSeededNoise::Init(unsigned int nSeed)
 	*/
 }
 
-float CSeededNoise::Noise(float *f)
+float CSeededNoise::Noise(const float *f) const
 {
 	int n[2];		// Indexes to pass to lattice function
 	float r[2];		// Remainders to pass to lattice function
@@ -178,19 +853,20 @@ float CSeededNoise::Noise(float *f)
 	return CLAMP(-0.99999f, 0.99999f, fValue);
 }
 
-float CFractal::fBm(float *f, float fOctaves)
+template <int D>
+float CFractal::fBmT(const float *f, float fOctaves) const
 {
 	// Initialize locals
 	float fValue = 0;
-	float fTemp[MAX_DIMENSIONS];
-	for(auto i=0; i<m_nDimensions; i++)
+	float fTemp[D];
+	for(auto i=0; i<D; i++)
 		fTemp[i] = f[i];
 
 	// Inner loop of spectral construction, where the fractal is built
 	for(auto i=0; i<fOctaves; i++)
 	{
-		fValue += Noise(fTemp) * m_fExponent[i];
-		for(int j=0; j<m_nDimensions; j++)
+		fValue += NoiseT<D>(fTemp) * m_fExponent[i];
+		for(int j=0; j<D; j++)
 			fTemp[j] *= m_fLacunarity;
 	}
 
@@ -199,26 +875,106 @@ float CFractal::fBm(float *f, float fOctaves)
 	// Take care of remainder in fOctaves
 	fOctaves -= (int)fOctaves;
 	if(fOctaves > DELTA)
-		fValue += fOctaves * Noise(fTemp) * m_fExponent[last];
+		fValue += fOctaves * NoiseT<D>(fTemp) * m_fExponent[last];
 	return CLAMP(-0.99999f, 0.99999f, fValue);
 }
 
-float CFractal::fBmTest(float *f, int nStart, int nEnd, float fInitial)
+float CFractal::fBm(const float *f, float fOctaves) const
+{
+	NOISE_DISPATCH(fBmT, f, fOctaves);
+}
+
+template <int D>
+float CFractal::fBmGradientT(const float *f, float fOctaves, float *pGradient) const
 {
-	float fTemp[MAX_DIMENSIONS];
+	// Initialize locals
+	float fValue = 0;
+	float fFrequency = 1;
+	float fTemp[D], fGradient[D];
+	for(auto i=0; i<D; i++)
+	{
+		fTemp[i] = f[i];
+		pGradient[i] = 0;
+	}
+
+	// Each octave's gradient is scaled by its frequency, the chain rule for fTemp = f * fFrequency
+	for(auto i=0; i<fOctaves; i++)
+	{
+		fValue += NoiseGradientT<D>(fTemp, fGradient) * m_fExponent[i];
+		for(int j=0; j<D; j++)
+		{
+			pGradient[j] += fGradient[j] * m_fExponent[i] * fFrequency;
+			fTemp[j] *= m_fLacunarity;
+		}
+		fFrequency *= m_fLacunarity;
+	}
+
+   const auto last = (std::min)(static_cast<int>(fOctaves), MAX_OCTAVES);
+
+	// Take care of remainder in fOctaves
+	fOctaves -= (int)fOctaves;
+	if(fOctaves > DELTA)
+	{
+		fValue += fOctaves * NoiseGradientT<D>(fTemp, fGradient) * m_fExponent[last];
+		for(int j=0; j<D; j++)
+			pGradient[j] += fOctaves * fGradient[j] * m_fExponent[last] * fFrequency;
+	}
+	return ClampGradient<D>(fValue, pGradient, 1.0f, pGradient);
+}
+
+float CFractal::fBmGradient(const float *f, float fOctaves, float *pGradient) const
+{
+	NOISE_DISPATCH(fBmGradientT, f, fOctaves, pGradient);
+}
+
+float CFractal::FootprintOctaves(float fFootprint, float fMaxOctaves) const
+{
+	// fBm() runs every octave below fOctaves, then adds what's left over of the
+	// next one, so 3.5 means 4.5 octaves. Count them properly in between.
+	float fLimit = (fMaxOctaves - (int)fMaxOctaves > DELTA) ? fMaxOctaves + 1 : fMaxOctaves;
+
+	// Octave i's cells are 1/lacunarity^i across, and it resolves while that is at least 2 * fFootprint
+	float fOctaves = Clamp(1, fLimit, 1 + log2f(0.5f / fFootprint) / m_fLog2Lacunarity);
+	return (fOctaves - (int)fOctaves > DELTA) ? fOctaves - 1 : fOctaves;
+}
+
+void CFractal::fBmN(const float *const *pCoord, float *pOut, int nCount, float fOctaves) const
+{
+	const float *pBuffer = &m_nBuffer[0][0];
+	switch(m_nDimensions)
+	{
+		case 1:
+			fBmRange<1>(m_nBasis, m_nMapWide, pBuffer, &m_fJitter[0][0], m_fExponent, m_fLacunarity, fOctaves, pCoord, pOut, nCount);
+			break;
+		case 2:
+			fBmRange<2>(m_nBasis, m_nMapWide, pBuffer, &m_fJitter[0][0], m_fExponent, m_fLacunarity, fOctaves, pCoord, pOut, nCount);
+			break;
+		case 3:
+			fBmRange<3>(m_nBasis, m_nMapWide, pBuffer, &m_fJitter[0][0], m_fExponent, m_fLacunarity, fOctaves, pCoord, pOut, nCount);
+			break;
+		case 4:
+			fBmRange<4>(m_nBasis, m_nMapWide, pBuffer, &m_fJitter[0][0], m_fExponent, m_fLacunarity, fOctaves, pCoord, pOut, nCount);
+			break;
+	}
+}
+
+template <int D>
+float CFractal::fBmTestT(const float *f, int nStart, int nEnd, float fInitial) const
+{
+	float fTemp[D];
 	float fValue = 0, fExp = 2;
 
 	// Initialize locals
 	for(auto i=0; i<nStart; i++)
 		fExp *= m_fLacunarity;
-	for(auto i=0; i<m_nDimensions; i++)
+	for(auto i=0; i<D; i++)
 		fTemp[i] = f[i] * fExp;
 
 	// Inner loop of spectral construction, where the fractal is built
    for(auto i = nStart; i < nEnd; i++)
 	{
-		fValue += Noise(fTemp) * m_fExponent[i];
-		for(auto j=0; j<m_nDimensions; j++)
+		fValue += NoiseT<D>(fTemp) * m_fExponent[i];
+		for(auto j=0; j<D; j++)
 			fTemp[j] *= m_fLacunarity;
 	}
 
@@ -227,24 +983,30 @@ float CFractal::fBmTest(float *f, int nStart, int nEnd, float fInitial)
 	if(fValue <= 0.0f)
 		fValue = (float)-pow(-fValue, 0.7f);
 	else
-		fValue = (float)pow(fValue, 1 + Noise(fTemp) * fValue);
+		fValue = (float)pow(fValue, 1 + NoiseT<D>(fTemp) * fValue);
 	return fValue * 1.33333f;
 }
 
-float CFractal::fBmTest(float *f, float fOctaves)
+float CFractal::fBmTest(const float *f, int nStart, int nEnd, float fInitial) const
+{
+	NOISE_DISPATCH(fBmTestT, f, nStart, nEnd, fInitial);
+}
+
+template <int D>
+float CFractal::fBmTestT(const float *f, float fOctaves) const
 {
-	float fTemp[MAX_DIMENSIONS];
+	float fTemp[D];
 	float fValue = 0;
 
 	// Initialize locals
-	for(auto i=0; i<m_nDimensions; i++)
+	for(auto i=0; i<D; i++)
 		fTemp[i] = f[i] * 2;
 
 	// Inner loop of spectral construction, where the fractal is built
 	for(auto i=0; i<fOctaves; i++)
 	{
-		fValue += Noise(fTemp) * m_fExponent[i];
-		for(auto j=0; j<m_nDimensions; j++)
+		fValue += NoiseT<D>(fTemp) * m_fExponent[i];
+		for(auto j=0; j<D; j++)
 			fTemp[j] *= m_fLacunarity;
 	}
 
@@ -253,28 +1015,34 @@ float CFractal::fBmTest(float *f, float fOctaves)
 	// Take care of remainder in fOctaves
 	fOctaves -= (int)fOctaves;
 	if(fOctaves > DELTA)
-		fValue += fOctaves * Noise(fTemp) * m_fExponent[last];
+		fValue += fOctaves * NoiseT<D>(fTemp) * m_fExponent[last];
 
 	if(fValue <= 0.0f)
 		fValue = (float)-pow(-fValue, 0.7f);
 	else
-		fValue = (float)pow(fValue, 1 + Noise(fTemp) * fValue);
+		fValue = (float)pow(fValue, 1 + NoiseT<D>(fTemp) * fValue);
 	return fValue * 1.33333f;
 }
 
-float CFractal::Turbulence(float *f, float fOctaves)
+float CFractal::fBmTest(const float *f, float fOctaves) const
+{
+	NOISE_DISPATCH(fBmTestT, f, fOctaves);
+}
+
+template <int D>
+float CFractal::TurbulenceT(const float *f, float fOctaves) const
 {
 	// Initialize locals
 	float fValue = 0;
-	float fTemp[MAX_DIMENSIONS];
-	for(auto i=0; i<m_nDimensions; i++)
+	float fTemp[D];
+	for(auto i=0; i<D; i++)
 		fTemp[i] = f[i];
 
 	// Inner loop of spectral construction, where the fractal is built
 	for(auto i=0; i<fOctaves; i++)
 	{
-		fValue += Abs(Noise(fTemp)) * m_fExponent[i];
-		for(int j=0; j<m_nDimensions; j++)
+		fValue += Abs(NoiseT<D>(fTemp)) * m_fExponent[i];
+		for(int j=0; j<D; j++)
 			fTemp[j] *= m_fLacunarity;
 	}
 
@@ -282,23 +1050,29 @@ float CFractal::Turbulence(float *f, float fOctaves)
    const auto last = (std::min)(static_cast<int>(fOctaves), MAX_OCTAVES);
 	fOctaves -= (int)fOctaves;
 	if(fOctaves > DELTA)
-		fValue += fOctaves * Abs(Noise(fTemp) * m_fExponent[last]);
+		fValue += fOctaves * Abs(NoiseT<D>(fTemp) * m_fExponent[last]);
 	return CLAMP(-0.99999f, 0.99999f, fValue);
 }
 
-float CFractal::Multifractal(float *f, float fOctaves, float fOffset)
+float CFractal::Turbulence(const float *f, float fOctaves) const
+{
+	NOISE_DISPATCH(TurbulenceT, f, fOctaves);
+}
+
+template <int D>
+float CFractal::MultifractalT(const float *f, float fOctaves, float fOffset) const
 {
 	// Initialize locals
 	float fValue = 1;
-	float fTemp[MAX_DIMENSIONS];
-	for(auto i=0; i<m_nDimensions; i++)
+	float fTemp[D];
+	for(auto i=0; i<D; i++)
 		fTemp[i] = f[i];
 
 	// Inner loop of spectral construction, where the fractal is built
 	for(auto i=0; i<fOctaves; i++)
 	{
-		fValue *= Noise(fTemp) * m_fExponent[i] + fOffset;
-		for(auto j=0; j<m_nDimensions; j++)
+		fValue *= NoiseT<D>(fTemp) * m_fExponent[i] + fOffset;
+		for(auto j=0; j<D; j++)
 			fTemp[j] *= m_fLacunarity;
 	}
 
@@ -306,23 +1080,29 @@ float CFractal::Multifractal(float *f, float fOctaves, float fOffset)
    const auto last = (std::min)(static_cast<int>(fOctaves), MAX_OCTAVES);
 	fOctaves -= (int)fOctaves;
 	if(fOctaves > DELTA)
-		fValue *= fOctaves * (Noise(fTemp) * m_fExponent[last] + fOffset);
+		fValue *= fOctaves * (NoiseT<D>(fTemp) * m_fExponent[last] + fOffset);
 	return CLAMP(-0.99999f, 0.99999f, fValue);
 }
 
-float CFractal::Heterofractal(float *f, float fOctaves, float fOffset)
+float CFractal::Multifractal(const float *f, float fOctaves, float fOffset) const
+{
+	NOISE_DISPATCH(MultifractalT, f, fOctaves, fOffset);
+}
+
+template <int D>
+float CFractal::HeterofractalT(const float *f, float fOctaves, float fOffset) const
 {
 	// Initialize locals
-	float fValue = Noise(f) + fOffset;
-	float fTemp[MAX_DIMENSIONS];
-	for(auto i=0; i<m_nDimensions; i++)
+	float fValue = NoiseT<D>(f) + fOffset;
+	float fTemp[D];
+	for(auto i=0; i<D; i++)
 		fTemp[i] = f[i] * m_fLacunarity;
 
 	// Inner loop of spectral construction, where the fractal is built
 	for(auto i=1; i<fOctaves; i++)
 	{
-		fValue += (Noise(fTemp) + fOffset) * m_fExponent[i] * fValue;
-		for(auto j=0; j<m_nDimensions; j++)
+		fValue += (NoiseT<D>(fTemp) + fOffset) * m_fExponent[i] * fValue;
+		for(auto j=0; j<D; j++)
 			fTemp[j] *= m_fLacunarity;
 	}
 
@@ -330,17 +1110,23 @@ float CFractal::Heterofractal(float *f, float fOctaves, float fOffset)
    const auto last = (std::min)(static_cast<int>(fOctaves), MAX_OCTAVES);
 	fOctaves -= (int)fOctaves;
 	if(fOctaves > DELTA)
-		fValue += fOctaves * (Noise(fTemp) + fOffset) * m_fExponent[last] * fValue;
+		fValue += fOctaves * (NoiseT<D>(fTemp) + fOffset) * m_fExponent[last] * fValue;
 	return CLAMP(-0.99999f, 0.99999f, fValue);
 }
 
-float CFractal::HybridMultifractal(float *f, float fOctaves, float fOffset, float fGain)
+float CFractal::Heterofractal(const float *f, float fOctaves, float fOffset) const
+{
+	NOISE_DISPATCH(HeterofractalT, f, fOctaves, fOffset);
+}
+
+template <int D>
+float CFractal::HybridMultifractalT(const float *f, float fOctaves, float fOffset, float fGain) const
 {
 	// Initialize locals
-	float fValue = (Noise(f) + fOffset) * m_fExponent[0];
+	float fValue = (NoiseT<D>(f) + fOffset) * m_fExponent[0];
 	float fWeight = fValue;
-	float fTemp[MAX_DIMENSIONS];
-	for(auto i=0; i<m_nDimensions; i++)
+	float fTemp[D];
+	for(auto i=0; i<D; i++)
 		fTemp[i] = f[i] * m_fLacunarity;
 
 	// Inner loop of spectral construction, where the fractal is built
@@ -348,10 +1134,10 @@ float CFractal::HybridMultifractal(float *f, float fOctaves, float fOffset, floa
 	{
 		if(fWeight > 1)
 			fWeight = 1;
-		float fSignal = (Noise(fTemp) + fOffset) * m_fExponent[i];
+		float fSignal = (NoiseT<D>(fTemp) + fOffset) * m_fExponent[i];
 		fValue += fWeight * fSignal;
 		fWeight *= fGain * fSignal;
-		for(auto j=0; j<m_nDimensions; j++)
+		for(auto j=0; j<D; j++)
 			fTemp[j] *= m_fLacunarity;
 	}
 
@@ -362,29 +1148,35 @@ float CFractal::HybridMultifractal(float *f, float fOctaves, float fOffset, floa
 	{
 		if(fWeight > 1)
 			fWeight = 1;
-		float fSignal = (Noise(fTemp) + fOffset) * m_fExponent[last];
+		float fSignal = (NoiseT<D>(fTemp) + fOffset) * m_fExponent[last];
 		fValue += fOctaves * fWeight * fSignal;
 	}
 	return CLAMP(-0.99999f, 0.99999f, fValue);
 }
 
-float CFractal::RidgedMultifractal(float *f, float fOctaves, float fOffset, float fGain)
+float CFractal::HybridMultifractal(const float *f, float fOctaves, float fOffset, float fGain) const
+{
+	NOISE_DISPATCH(HybridMultifractalT, f, fOctaves, fOffset, fGain);
+}
+
+template <int D>
+float CFractal::RidgedMultifractalT(const float *f, float fOctaves, float fOffset, float fGain) const
 {
 	// Initialize locals
-	float fSignal = fOffset - Abs(Noise(f));
+	float fSignal = fOffset - Abs(NoiseT<D>(f));
 	fSignal *= fSignal;
 	float fValue = fSignal;
-	float fTemp[MAX_DIMENSIONS];
-	for(auto i=0; i<m_nDimensions; i++)
+	float fTemp[D];
+	for(auto i=0; i<D; i++)
 		fTemp[i] = f[i];
 
 	// Inner loop of spectral construction, where the fractal is built
 	for(auto i=1; i<fOctaves; i++)
 	{
-		for(auto j=0; j<m_nDimensions; j++)
+		for(auto j=0; j<D; j++)
 			fTemp[j] *= m_fLacunarity;
 		float fWeight = Clamp(0, 1, fSignal * fGain);
-		fSignal = fOffset - Abs(Noise(fTemp));
+		fSignal = fOffset - Abs(NoiseT<D>(fTemp));
 		fSignal *= fSignal;
 		fSignal *= fWeight;
 		fValue += fSignal * m_fExponent[i];
@@ -392,3 +1184,80 @@ float CFractal::RidgedMultifractal(float *f, float fOctaves, float fOffset, floa
 	return CLAMP(-0.99999f, 0.99999f, fValue);
 }
 
+float CFractal::RidgedMultifractal(const float *f, float fOctaves, float fOffset, float fGain) const
+{
+	NOISE_DISPATCH(RidgedMultifractalT, f, fOctaves, fOffset, fGain);
+}
+
+template <int D>
+float CFractal::RidgedMultifractalGradientT(const float *f, float fOctaves, float fOffset, float fGain, float *pGradient) const
+{
+	// Initialize locals. fDSignal is fSignal's gradient, d(fOffset - |n|)^2 = -2 * (fOffset - |n|) * sign(n) * dn.
+	float fGradient[D], fDSignal[D];
+	float fNoise = NoiseGradientT<D>(f, fGradient);
+	float fRidge = fOffset - Abs(fNoise);
+	float fSlope = fNoise < 0 ? 2 * fRidge : -2 * fRidge;
+	float fSignal = fRidge * fRidge;
+	float fValue = fSignal;
+	float fFrequency = 1;
+	float fTemp[D];
+	for(auto i=0; i<D; i++)
+	{
+		fTemp[i] = f[i];
+		fDSignal[i] = fSlope * fGradient[i];
+		pGradient[i] = fDSignal[i];
+	}
+
+	// Inner loop of spectral construction, where the fractal is built
+	for(auto i=1; i<fOctaves; i++)
+	{
+		for(auto j=0; j<D; j++)
+			fTemp[j] *= m_fLacunarity;
+		fFrequency *= m_fLacunarity;
+
+		// The weight only varies with the previous signal where Clamp() isn't holding it at 0 or 1
+		float fWeight = fSignal * fGain;
+		float fDWeight = (fWeight > 0 && fWeight < 1) ? fGain : 0;
+		fWeight = Clamp(0, 1, fWeight);
+
+		fNoise = NoiseGradientT<D>(fTemp, fGradient);
+		fRidge = fOffset - Abs(fNoise);
+		fSlope = (fNoise < 0 ? 2 * fRidge : -2 * fRidge) * fFrequency;
+		fSignal = fRidge * fRidge;
+		for(auto j=0; j<D; j++)
+		{
+			fDSignal[j] = fSlope * fGradient[j] * fWeight + fSignal * fDWeight * fDSignal[j];
+			pGradient[j] += fDSignal[j] * m_fExponent[i];
+		}
+		fSignal *= fWeight;
+		fValue += fSignal * m_fExponent[i];
+	}
+	return ClampGradient<D>(fValue, pGradient, 1.0f, pGradient);
+}
+
+float CFractal::RidgedMultifractalGradient(const float *f, float fOctaves, float fOffset, float fGain, float *pGradient) const
+{
+	NOISE_DISPATCH(RidgedMultifractalGradientT, f, fOctaves, fOffset, fGain, pGradient);
+}
+
+
+// The templates are only defined here, so instantiate them for every dimension count
+#define INSTANTIATE_NOISE(D)	\
+	template float CNoise::NoiseT<D>(const float *f) const;	\
+	template float CNoise::NoiseGradientT<D>(const float *f, float *pGradient) const;	\
+	template void CNoise::CellularT<D>(const float *f, float *pF1, float *pF2) const;	\
+	template float CFractal::fBmT<D>(const float *f, float fOctaves) const;	\
+	template float CFractal::TurbulenceT<D>(const float *f, float fOctaves) const;	\
+	template float CFractal::MultifractalT<D>(const float *f, float fOctaves, float fOffset) const;	\
+	template float CFractal::HeterofractalT<D>(const float *f, float fOctaves, float fOffset) const;	\
+	template float CFractal::HybridMultifractalT<D>(const float *f, float fOctaves, float fOffset, float fGain) const;	\
+	template float CFractal::RidgedMultifractalT<D>(const float *f, float fOctaves, float fOffset, float fGain) const;	\
+	template float CFractal::fBmGradientT<D>(const float *f, float fOctaves, float *pGradient) const;	\
+	template float CFractal::RidgedMultifractalGradientT<D>(const float *f, float fOctaves, float fOffset, float fGain, float *pGradient) const;	\
+	template float CFractal::fBmTestT<D>(const float *f, int nStart, int nEnd, float fInitial) const;	\
+	template float CFractal::fBmTestT<D>(const float *f, float fOctaves) const;
+
+INSTANTIATE_NOISE(1)
+INSTANTIATE_NOISE(2)
+INSTANTIATE_NOISE(3)
+INSTANTIATE_NOISE(4)
@@ -0,0 +1,197 @@
+//
+// CNoise's Perlin Noise() and CFractal's fBm() for shaders, pulled into a
+// CShaderObject with an include line (see CShaderObject::ReadSource()) or
+// into a tfgl::Shader with a pragma include line. Bind s1NoiseTables to a
+// texture made from the CNoise you want to match:
+//
+//   CPixelBuffer pb;
+//   pb.MakeNoiseTables(fractal);
+//   tNoise.Init(&pb, true, false);		// No mipmaps, the tables must not be filtered
+//
+// and Noise(f) and fBm(f, fOctaves, fH, fLacunarity) follow the same lattice
+// and the same arithmetic as CNoise::PerlinT() and CFractal::fBmT(), so they
+// agree with the CPU to within float rounding (about 1e-6, more where the GPU's
+// pow() is loose). Use the overload with as many components as the CNoise has
+// dimensions. Only PerlinBasis is here, simplex and cellular noise are CPU only.
+//
+// Author:  Tim Finer
+// Email:   tfiner@csu.fullerton.edu
+//
+
+uniform sampler1D s1NoiseTables;	// CPixelBuffer::MakeNoiseTables()
+
+
+// m_nMap[n & 0xFF] for each component of n. Every coordinate lands on a texel
+// center, so even GL_LINEAR filtering returns the texel unchanged.
+float NoiseMap(float n)
+{
+	return texture1D(s1NoiseTables, (mod(n, 256.0) + 0.5) / 512.0).r;
+}
+vec2 NoiseMap(vec2 n)
+{
+	return vec2(NoiseMap(n.x), NoiseMap(n.y));
+}
+vec4 NoiseMap(vec4 n)
+{
+	return vec4(NoiseMap(n.x), NoiseMap(n.y), NoiseMap(n.z), NoiseMap(n.w));
+}
+
+// The gradient at lattice index nIndex dotted with r, summed in the same order
+// as PerlinT(). The unused components are 0, which leaves the sum as it was.
+float NoiseCorner(float nIndex, vec4 r)
+{
+	vec4 g = texture1D(s1NoiseTables, (nIndex + 256.5) / 512.0);
+	return g.x * r.x + g.y * r.y + g.z * r.z + g.w * r.w;
+}
+
+// Corners (-x,-y), (+x,-y), (-x,+y) and (+x,+y), which are PerlinT()'s corners
+// 4k to 4k+3, with r already offset for the other dimensions
+vec4 NoiseCorners(vec4 nIndex, vec4 r)
+{
+	return vec4(NoiseCorner(nIndex.x, r),
+				NoiseCorner(nIndex.y, r - vec4(1.0, 0.0, 0.0, 0.0)),
+				NoiseCorner(nIndex.z, r - vec4(0.0, 1.0, 0.0, 0.0)),
+				NoiseCorner(nIndex.w, r - vec4(1.0, 1.0, 0.0, 0.0)));
+}
+
+// Lerp() as Noise.h has it, which rounds differently from mix()
+float NoiseLerp(float a, float b, float x)
+{
+	return a + x * (b - a);
+}
+
+// Collapses NoiseCorners() along x, then y
+float NoiseLerpXY(vec4 v, vec4 w)
+{
+	vec2 v2 = v.xz + w.x * (v.yw - v.xz);
+	return NoiseLerp(v2.x, v2.y, w.y);
+}
+
+float NoiseClamp(float f)
+{
+	return clamp(f, -0.99999, 0.99999);
+}
+
+
+// The lattice steps of PerlinT(): the cell's lower corner n, the offset into
+// it r, and the Cubic() weights w
+void NoiseCell(vec4 f, out vec4 n, out vec4 r, out vec4 w)
+{
+	n = floor(f);
+	r = f - n;
+	w = r * r * (3.0 - 2.0 * r);
+}
+
+float Noise(float f)
+{
+	vec4 n, r, w;
+	NoiseCell(vec4(f, 0.0, 0.0, 0.0), n, r, w);
+	vec2 i1 = NoiseMap(n.xx + vec2(0.0, 1.0));
+	float fValue = NoiseLerp(NoiseCorner(i1.x, r), NoiseCorner(i1.y, r - vec4(1.0, 0.0, 0.0, 0.0)), w.x);
+	return NoiseClamp(fValue * 2.0);
+}
+
+float Noise(vec2 f)
+{
+	vec4 n, r, w;
+	NoiseCell(vec4(f, 0.0, 0.0), n, r, w);
+	vec2 i1 = NoiseMap(n.xx + vec2(0.0, 1.0));
+	vec4 i2 = NoiseMap(i1.xyxy + n.yyyy + vec4(0.0, 0.0, 1.0, 1.0));
+	return NoiseClamp(NoiseLerpXY(NoiseCorners(i2, r), w) * 2.0);
+}
+
+float Noise(vec3 f)
+{
+	vec4 n, r, w;
+	NoiseCell(vec4(f, 0.0), n, r, w);
+	vec2 i1 = NoiseMap(n.xx + vec2(0.0, 1.0));
+	vec4 i2 = NoiseMap(i1.xyxy + n.yyyy + vec4(0.0, 0.0, 1.0, 1.0));
+	vec4 z0 = NoiseMap(i2 + n.z);
+	vec4 z1 = NoiseMap(i2 + n.z + 1.0);
+	float fValue = NoiseLerp(NoiseLerpXY(NoiseCorners(z0, r), w),
+							 NoiseLerpXY(NoiseCorners(z1, r - vec4(0.0, 0.0, 1.0, 0.0)), w),
+							 w.z);
+	return NoiseClamp(fValue * 2.0);
+}
+
+float Noise(vec4 f)
+{
+	vec4 n, r, w;
+	NoiseCell(f, n, r, w);
+	vec2 i1 = NoiseMap(n.xx + vec2(0.0, 1.0));
+	vec4 i2 = NoiseMap(i1.xyxy + n.yyyy + vec4(0.0, 0.0, 1.0, 1.0));
+	vec4 z0 = NoiseMap(i2 + n.z);
+	vec4 z1 = NoiseMap(i2 + n.z + 1.0);
+	float fW0 = NoiseLerp(NoiseLerpXY(NoiseCorners(NoiseMap(z0 + n.w), r), w),
+						  NoiseLerpXY(NoiseCorners(NoiseMap(z1 + n.w), r - vec4(0.0, 0.0, 1.0, 0.0)), w),
+						  w.z);
+	float fW1 = NoiseLerp(NoiseLerpXY(NoiseCorners(NoiseMap(z0 + n.w + 1.0), r - vec4(0.0, 0.0, 0.0, 1.0)), w),
+						  NoiseLerpXY(NoiseCorners(NoiseMap(z1 + n.w + 1.0), r - vec4(0.0, 0.0, 1.0, 1.0)), w),
+						  w.z);
+	return NoiseClamp(NoiseLerp(fW0, fW1, w.w) * 2.0);
+}
+
+
+// CFractal::m_fExponent[i], the weight of octave i
+float fBmExponent(float i, float fH, float fLacunarity)
+{
+	return pow(pow(fLacunarity, i), -fH);
+}
+
+// fBmT()'s loops, including the way it runs the loop to the octave above
+// fOctaves and then adds that octave again, weighted by the fraction
+float fBm(float f, float fOctaves, float fH, float fLacunarity)
+{
+	float fValue = 0.0;
+	for(float i=0.0; i<fOctaves; i++)
+	{
+		fValue += Noise(f) * fBmExponent(i, fH, fLacunarity);
+		f *= fLacunarity;
+	}
+	float fRemainder = fOctaves - floor(fOctaves);
+	if(fRemainder > 1e-6)
+		fValue += fRemainder * Noise(f) * fBmExponent(floor(fOctaves), fH, fLacunarity);
+	return NoiseClamp(fValue);
+}
+
+float fBm(vec2 f, float fOctaves, float fH, float fLacunarity)
+{
+	float fValue = 0.0;
+	for(float i=0.0; i<fOctaves; i++)
+	{
+		fValue += Noise(f) * fBmExponent(i, fH, fLacunarity);
+		f *= fLacunarity;
+	}
+	float fRemainder = fOctaves - floor(fOctaves);
+	if(fRemainder > 1e-6)
+		fValue += fRemainder * Noise(f) * fBmExponent(floor(fOctaves), fH, fLacunarity);
+	return NoiseClamp(fValue);
+}
+
+float fBm(vec3 f, float fOctaves, float fH, float fLacunarity)
+{
+	float fValue = 0.0;
+	for(float i=0.0; i<fOctaves; i++)
+	{
+		fValue += Noise(f) * fBmExponent(i, fH, fLacunarity);
+		f *= fLacunarity;
+	}
+	float fRemainder = fOctaves - floor(fOctaves);
+	if(fRemainder > 1e-6)
+		fValue += fRemainder * Noise(f) * fBmExponent(floor(fOctaves), fH, fLacunarity);
+	return NoiseClamp(fValue);
+}
+
+float fBm(vec4 f, float fOctaves, float fH, float fLacunarity)
+{
+	float fValue = 0.0;
+	for(float i=0.0; i<fOctaves; i++)
+	{
+		fValue += Noise(f) * fBmExponent(i, fH, fLacunarity);
+		f *= fLacunarity;
+	}
+	float fRemainder = fOctaves - floor(fOctaves);
+	if(fRemainder > 1e-6)
+		fValue += fRemainder * Noise(f) * fBmExponent(floor(fOctaves), fH, fLacunarity);
+	return NoiseClamp(fValue);
+}
@@ -84,8 +84,8 @@ public:
 		{
 			if(bUseExposure)
 				m_shExposure.Enable();
-			m_shExposure.SetUniformParameter1i("s2Test", 0);
-			m_shExposure.SetUniformParameter1f("fExposure", fExposure);
+			m_shExposure.SetUniformParameter1i(UniformTest, 0);
+			m_shExposure.SetUniformParameter1f(UniformExposure, fExposure);
 			glBindTexture(m_nTarget, m_nTextureID);
 			wglBindTexImageARB(m_hBuffer, WGL_FRONT_LEFT_ARB);
 			glEnable(m_nTarget);
@@ -30,12 +30,464 @@ POSSIBILITY OF SUCH DAMAGE.
 
 #include "Master.h"
 #include "PixelBuffer.h"
+#include "Simd.h"
+#include "ThreadPool.h"
+#include <chrono>
+#include <mutex>
+#include <new>
+#ifndef _WIN32
+#include <sys/mman.h>
+#endif
+
+// Make3DNoise() works on cubes of this many voxels per side. One slice of a
+// cube's coordinates and fBm values is 16 KB, small enough to stay in L1.
+#define NOISE_BRICK_SIZE	32
+
+
+namespace {
+
+	// Make3DNoise()'s density curve, 1 - 0.9^x for x from 0 to 255, as a byte.
+	// 0.9^x is split into 0.9^n, looked up for the whole part, times 0.9^f for
+	// the fraction, which a cubic gets to well under a thousandth of a byte.
+	struct SCloudCurve
+	{
+		float fPower[256];		// 255 * 0.9^n
+
+		SCloudCurve()
+		{
+			for(int i=0; i<256; i++)
+				fPower[i] = 255 * powf(0.9f, (float)i);
+		}
+		unsigned char Lookup(float x) const
+		{
+			int n = Min((int)x, 255);
+			float t = (x - n) * -0.105360516f;		// ln(0.9)
+			float fFraction = 1 + t*(1 + t*(0.5f + t*(1.0f/6.0f)));
+			return (unsigned char)(255.5f - fPower[n] * fFraction);
+		}
+	};
+
+}
+
+size_t C3DBuffer::m_nLargePageSize = 0;
+
+bool C3DBuffer::EnableLargePages()
+{
+	if(m_nLargePageSize)
+		return true;
+#ifdef _WIN32
+	// Large pages can't be paged out, so Windows wants the process to hold
+	// SeLockMemoryPrivilege and to have switched it on in its token
+	size_t nPageSize = GetLargePageMinimum();
+	HANDLE hToken;
+	if(!nPageSize || !OpenProcessToken(GetCurrentProcess(), TOKEN_ADJUST_PRIVILEGES | TOKEN_QUERY, &hToken))
+		return false;
+	TOKEN_PRIVILEGES tp;
+	tp.PrivilegeCount = 1;
+	tp.Privileges[0].Attributes = SE_PRIVILEGE_ENABLED;
+	// AdjustTokenPrivileges() succeeds without the privilege, only GetLastError() says whether it was granted
+	bool bGranted = LookupPrivilegeValue(NULL, SE_LOCK_MEMORY_NAME, &tp.Privileges[0].Luid) &&
+		AdjustTokenPrivileges(hToken, FALSE, &tp, 0, NULL, NULL) && GetLastError() == ERROR_SUCCESS;
+	CloseHandle(hToken);
+	if(!bGranted)
+	{
+		LogInfo("C3DBuffer::EnableLargePages() - No \"Lock pages in memory\" right, buffers stay on the heap");
+		return false;
+	}
+	m_nLargePageSize = nPageSize;
+#else
+	m_nLargePageSize = 2 << 20;		// Transparent huge pages, which Allocate() asks for with madvise()
+#endif
+	LogInfo("C3DBuffer::EnableLargePages() - %u KB pages for buffers of %u KB or more", (unsigned int)(m_nLargePageSize >> 10), LARGE_PAGE_MIN >> 10);
+	return true;
+}
+
+void *C3DBuffer::Allocate(size_t &nBytes, bool &bPageAlloc)
+{
+	bPageAlloc = false;
+	if(m_nLargePageSize && nBytes >= LARGE_PAGE_MIN)
+	{
+		size_t nPages = (nBytes + m_nLargePageSize-1) & ~(m_nLargePageSize-1);
+#ifdef _WIN32
+		void *pAlloc = VirtualAlloc(NULL, nPages, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+#else
+		void *pAlloc = mmap(NULL, nPages, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if(pAlloc == MAP_FAILED)
+			pAlloc = NULL;
+#ifdef MADV_HUGEPAGE
+		else
+			madvise(pAlloc, nPages, MADV_HUGEPAGE);
+#endif
+#endif
+		// When physical memory is too fragmented for large pages, the heap will still do
+		if(pAlloc)
+		{
+			nBytes = nPages;
+			bPageAlloc = true;
+			return pAlloc;
+		}
+	}
+
+	// aligned_alloc() wants a multiple of the alignment
+	nBytes = ALIGN(nBytes);
+#ifdef _WIN32
+	void *pAlloc = _aligned_malloc(nBytes, ALIGN_SIZE);
+#else
+	void *pAlloc = aligned_alloc(ALIGN_SIZE, nBytes);
+#endif
+	if(!pAlloc && nBytes)
+		throw std::bad_alloc();
+	return pAlloc;
+}
+
+void C3DBuffer::Free(void *pAlloc, size_t nBytes, bool bPageAlloc)
+{
+	if(bPageAlloc)
+	{
+#ifdef _WIN32
+		VirtualFree(pAlloc, 0, MEM_RELEASE);
+#else
+		munmap(pAlloc, nBytes);
+#endif
+	}
+	else
+	{
+#ifdef _WIN32
+		_aligned_free(pAlloc);
+#else
+		free(pAlloc);
+#endif
+	}
+}
+
+namespace {
+
+	// What InterpolateKernel() needs to know about the table, worked out once
+	// for all the points instead of for every SIMD_WIDTH of them
+	struct SInterpolateTable
+	{
+		InterpolateMode nMode;
+		int nStep[3];				// Elements from one slice along an axis to the next, 0 along an axis of 1
+		CSimdFloat fSize[3];		// From a coordinate to a position in elements
+		CSimdFloat fLast[3];		// The last element a lerp can start from
+		CSimdFloat fStride[3];		// Elements from one slice to the next, as a float
+		CSimdFloat fScale;			// From the stored values to the ones returned
+
+		SInterpolateTable(const int *nSize, InterpolateMode mode, float fValueScale) : fScale(fValueScale)
+		{
+			nMode = mode;
+			int nStride = 1;
+			for(int d=0; d<3; d++)
+			{
+				nStep[d] = nSize[d] > 1 ? nStride : 0;
+				fSize[d] = CSimdFloat((float)(nMode == InterpolateWrap ? nSize[d] : nSize[d]-1));
+				fLast[d] = CSimdFloat((float)(nMode == InterpolateWrap ? nSize[d]-1 : Max(nSize[d]-2, 0)));
+				fStride[d] = CSimdFloat((float)nStride);
+				nStride *= nSize[d];
+			}
+		}
+	};
+
+	template <class V>
+	inline V Lerp(const V &a, const V &b, const V &x)	{ return a + x * (b - a); }
+
+	// The C channels of element nElement for each lane, as stored. The general
+	// case gathers each channel on its own. RGBA floats come in with one load
+	// per texel and RGBA bytes with one dword per texel.
+	template <class T, int C>
+	struct SGatherElement
+	{
+		static void Gather(const T *pBuffer, const CSimdInt &nElement, CSimdFloat *pValue)
+		{
+			CSimdInt nOffset = nElement;
+			for(int i=1; i<C; i++)
+				nOffset = nOffset + nElement;
+			for(int i=0; i<C; i++)
+				pValue[i] = ToFloat(::Gather(pBuffer + i, nOffset));
+		}
+	};
+	template <int C>
+	struct SGatherElement<float, C>
+	{
+		static void Gather(const float *pBuffer, const CSimdInt &nElement, CSimdFloat *pValue)
+		{
+			CSimdInt nOffset = nElement;
+			for(int i=1; i<C; i++)
+				nOffset = nOffset + nElement;
+			for(int i=0; i<C; i++)
+				pValue[i] = ::Gather(pBuffer + i, nOffset);
+		}
+	};
+	template <>
+	struct SGatherElement<float, 4>
+	{
+		static void Gather(const float *pBuffer, const CSimdInt &nElement, CSimdFloat *pValue)
+		{
+			Gather4(pBuffer, nElement << 2, pValue);
+		}
+	};
+	template <>
+	struct SGatherElement<unsigned char, 4>
+	{
+		static void Gather(const unsigned char *pBuffer, const CSimdInt &nElement, CSimdFloat *pValue)
+		{
+			CSimdInt nTexel = ::Gather((const int *)pBuffer, nElement);
+			const CSimdInt nMask(0xFF);
+			for(int i=0; i<4; i++)
+				pValue[i] = ToFloat((nTexel >> (8*i)) & nMask);
+		}
+	};
+
+	// Elements nElement and nElement+1 for each lane, the low and high x
+	// corners of a row. In general that's two gathers, but where the two
+	// texels fit in one wider fetch, they come in together.
+	template <class T, int C>
+	struct SGatherRow
+	{
+		static void Gather(const T *pBuffer, const CSimdInt &nElement, CSimdFloat *pLow, CSimdFloat *pHigh)
+		{
+			SGatherElement<T, C>::Gather(pBuffer, nElement, pLow);
+			SGatherElement<T, C>::Gather(pBuffer + C, nElement, pHigh);
+		}
+	};
+	template <>
+	struct SGatherRow<float, 1>
+	{
+		static void Gather(const float *pBuffer, const CSimdInt &nElement, CSimdFloat *pLow, CSimdFloat *pHigh)
+		{
+			CSimdFloat v[2];
+			GatherPair(pBuffer, nElement, v);
+			pLow[0] = v[0];
+			pHigh[0] = v[1];
+		}
+	};
+	template <>
+	struct SGatherRow<float, 2>
+	{
+		static void Gather(const float *pBuffer, const CSimdInt &nElement, CSimdFloat *pLow, CSimdFloat *pHigh)
+		{
+			CSimdFloat v[4];
+			Gather4(pBuffer, nElement << 1, v);
+			pLow[0] = v[0];
+			pLow[1] = v[1];
+			pHigh[0] = v[2];
+			pHigh[1] = v[3];
+		}
+	};
+	template <>
+	struct SGatherRow<float, 3>
+	{
+		static void Gather(const float *pBuffer, const CSimdInt &nElement, CSimdFloat *pLow, CSimdFloat *pHigh)
+		{
+			CSimdFloat v[4];
+			CSimdInt nOffset = nElement + nElement + nElement;
+			Gather4(pBuffer, nOffset, v);
+			GatherPair(pBuffer + 4, nOffset, pHigh + 1);
+			pLow[0] = v[0];
+			pLow[1] = v[1];
+			pLow[2] = v[2];
+			pHigh[0] = v[3];
+		}
+	};
+
+	// The eight corners of each lane lerped together along x, then y, then z
+	template <int C>
+	inline void LerpCorners(CSimdFloat (*fValue)[C], const CSimdFloat *fRatio, const CSimdFloat &fScale, CSimdFloat *pResult)
+	{
+		for(int i=0; i<C; i++)
+		{
+			for(int c=0; c<4; c++)
+				fValue[c][i] = Lerp(fValue[2*c][i], fValue[2*c+1][i], fRatio[0]);
+			for(int c=0; c<2; c++)
+				fValue[c][i] = Lerp(fValue[2*c][i], fValue[2*c+1][i], fRatio[1]);
+			pResult[i] = Lerp(fValue[0][i], fValue[1][i], fRatio[2]) * fScale;
+		}
+	}
+
+	// Clamped lookups, where every corner is at a fixed distance from the low
+	// one. The x corners of a row are next to each other, so a row comes in at
+	// a time (along an axis of 1 both are the same element).
+	template <class T, int C>
+	struct SClampCorners
+	{
+		static void Interpolate(const T *pBuffer, const SInterpolateTable &table, const CSimdInt &nLow, const CSimdFloat *fRatio, CSimdFloat *pResult)
+		{
+			CSimdFloat fValue[8][C];
+			for(int r=0; r<4; r++)
+			{
+				const T *pRow = pBuffer + C * (((r & 1) ? table.nStep[1] : 0) + ((r & 2) ? table.nStep[2] : 0));
+				if(table.nStep[0])
+					SGatherRow<T, C>::Gather(pRow, nLow, fValue[2*r], fValue[2*r+1]);
+				else
+				{
+					SGatherElement<T, C>::Gather(pRow, nLow, fValue[2*r]);
+					for(int i=0; i<C; i++)
+						fValue[2*r+1][i] = fValue[2*r][i];
+				}
+			}
+			LerpCorners<C>(fValue, fRatio, table.fScale, pResult);
+		}
+	};
+
+	// A whole RGBA texel fits in an SSE register, so the lerps are done a lane
+	// at a time on all four channels at once (two lanes with AVX2), and only
+	// the results are transposed instead of every corner
+	template <class T>
+	struct SClampCorners<T, 4>
+	{
+		static void Interpolate(const T *pBuffer, const SInterpolateTable &table, const CSimdInt &nLow, const CSimdFloat *fRatio, CSimdFloat *pResult)
+		{
+			int nElement[SIMD_WIDTH], nCorner[8];
+			const T *pLow[SIMD_WIDTH];
+			nLow.Store(nElement);
+			for(int k=0; k<SIMD_WIDTH; k++)
+				pLow[k] = pBuffer + 4 * nElement[k];
+			for(int c=0; c<8; c++)
+				nCorner[c] = 4 * (((c & 1) ? table.nStep[0] : 0) + ((c & 2) ? table.nStep[1] : 0) + ((c & 4) ? table.nStep[2] : 0));
+			CSimdTexel fTexel[4];
+			for(int k=0; k<4; k++)
+			{
+				CSimdTexel x = CSimdTexel::Broadcast(fRatio[0], k), y = CSimdTexel::Broadcast(fRatio[1], k), z = CSimdTexel::Broadcast(fRatio[2], k);
+				CSimdTexel fValue[4];
+				for(int c=0; c<4; c++)
+					fValue[c] = Lerp(CSimdTexel::Load(pLow, k, nCorner[2*c]), CSimdTexel::Load(pLow, k, nCorner[2*c+1]), x);
+				fTexel[k] = Lerp(Lerp(fValue[0], fValue[1], y), Lerp(fValue[2], fValue[3], y), z);
+			}
+			Transpose4(fTexel, pResult);
+			for(int i=0; i<4; i++)
+				pResult[i] *= table.fScale;
+		}
+	};
+
+	// Trilinear interpolation of SIMD_WIDTH points with C channels each
+	template <class T, int C>
+	inline void InterpolateKernel(const T *pBuffer, const SInterpolateTable &table, const CSimdFloat *f, CSimdFloat *pResult)
+	{
+		// Corner c is on the high side of axis d when bit d of c is set
+		const CSimdFloat vZero(0.0f), vOne(1.0f);
+		CSimdFloat fRatio[3];
+		if(table.nMode == InterpolateClamp)
+		{
+			// The high side is always the next element (or the same one along
+			// an axis of 1), so only the low corner's offset is needed. It's
+			// summed in float, exact for the 2^24 elements InterpolateN()
+			// allows, and converted once.
+			CSimdFloat fElement = vZero;
+			for(int d=0; d<3; d++)
+			{
+				// Never negative here, so truncating is the floor
+				CSimdFloat fPos = Min(Max(f[d], vZero), vOne) * table.fSize[d];
+				CSimdFloat fLow = Min(ToFloat(ToInt(fPos)), table.fLast[d]);
+				fRatio[d] = fPos - fLow;
+				fElement = fElement + fLow * table.fStride[d];
+			}
+			SClampCorners<T, C>::Interpolate(pBuffer, table, ToInt(fElement), fRatio, pResult);
+		}
+		else
+		{
+			CSimdFloat fValue[8][C];
+			CSimdInt n0[3], n1[3];
+			for(int d=0; d<3; d++)
+			{
+				CSimdFloat fPos = f[d] * table.fSize[d];
+				CSimdFloat fLow = Floor(fPos);
+				fRatio[d] = fPos - fLow;
+				// Rounding in the division can leave a huge coordinate a period out, so clamp as well
+				fLow = Min(Max(fLow - table.fSize[d] * Floor(fLow / table.fSize[d]), vZero), table.fLast[d]);
+				CSimdFloat fHigh = fLow + vOne;
+				fHigh = Select(fHigh < table.fSize[d], fHigh, vZero);
+				n0[d] = ToInt(fLow * table.fStride[d]);
+				n1[d] = ToInt(fHigh * table.fStride[d]);
+			}
+			for(int c=0; c<8; c++)
+			{
+				CSimdInt nElement = ((c & 1) ? n1[0] : n0[0]) + ((c & 2) ? n1[1] : n0[1]) + ((c & 4) ? n1[2] : n0[2]);
+				SGatherElement<T, C>::Gather(pBuffer, nElement, fValue[c]);
+			}
+			LerpCorners<C>(fValue, fRatio, table.fScale, pResult);
+		}
+	}
+
+	template <class T, int C>
+	void InterpolateRange(const T *pBuffer, const SInterpolateTable &table, const float *const *pCoord, float *const *pOut, int nCount)
+	{
+		// The last few points go through a padded copy, which keeps this to one
+		// call of the kernel so it's inlined into the loop
+		CSimdFloat f[3], fResult[C];
+		int nFull = SIMD_ROUND_DOWN(nCount);
+		for(int n=0; n<nCount; n+=SIMD_WIDTH)
+		{
+			if(n < nFull)
+			{
+				for(int d=0; d<3; d++)
+					f[d] = pCoord[d] ? CSimdFloat::Load(pCoord[d] + n) : CSimdFloat(0.0f);
+			}
+			else
+			{
+				float fCoord[SIMD_WIDTH];
+				for(int d=0; d<3; d++)
+				{
+					for(int i=0; i<SIMD_WIDTH; i++)
+						fCoord[i] = pCoord[d] ? pCoord[d][Min(n + i, nCount - 1)] : 0.0f;
+					f[d] = CSimdFloat::Load(fCoord);
+				}
+			}
+			InterpolateKernel<T, C>(pBuffer, table, f, fResult);
+			if(n < nFull)
+			{
+				for(int i=0; i<C; i++)
+					fResult[i].Store(pOut[i] + n);
+			}
+			else
+			{
+				float fOut[SIMD_WIDTH];
+				for(int i=0; i<C; i++)
+				{
+					fResult[i].Store(fOut);
+					for(int j=0; n+j<nCount; j++)
+						pOut[i][n+j] = fOut[j];
+				}
+			}
+		}
+	}
+
+	template <class T>
+	void InterpolateChannels(int nChannels, const T *pBuffer, const SInterpolateTable &table, const float *const *pCoord, float *const *pOut, int nCount)
+	{
+		switch(nChannels)
+		{
+			case 1: InterpolateRange<T, 1>(pBuffer, table, pCoord, pOut, nCount); break;
+			case 2: InterpolateRange<T, 2>(pBuffer, table, pCoord, pOut, nCount); break;
+			case 3: InterpolateRange<T, 3>(pBuffer, table, pCoord, pOut, nCount); break;
+			case 4: InterpolateRange<T, 4>(pBuffer, table, pCoord, pOut, nCount); break;
+		}
+	}
+
+}
+
+bool C3DBuffer::InterpolateN(const float *const *pCoord, float *const *pOut, int nCount, InterpolateMode nMode) const
+{
+	if(m_nChannels < 1 || m_nChannels > 4 || (m_nDataType != GL_FLOAT && m_nDataType != GL_UNSIGNED_BYTE))
+	{
+		LogError("C3DBuffer::InterpolateN() - Only 1 to 4 channels of floats or unsigned bytes");
+		return false;
+	}
+	assert(m_nWidth * m_nHeight * m_nDepth <= (1 << 24));
+	const int nSize[3] = {m_nWidth, m_nHeight, m_nDepth};
+	if(m_nDataType == GL_FLOAT)
+		InterpolateChannels(m_nChannels, GetData<const float>(), SInterpolateTable(nSize, nMode, 1.0f), pCoord, pOut, nCount);
+	else
+		InterpolateChannels(m_nChannels, GetData<const unsigned char>(), SInterpolateTable(nSize, nMode, 1.0f / 255.0f), pCoord, pOut, nCount);
+	return true;
+}
 
 void CPixelBuffer::MakeCloudCell(float fExpose, float fSizeDisc)
 {
 	int i;
 	int n = 0;
 	unsigned char nIntensity;
+	unsigned char *__restrict pByte = GetData<unsigned char>();
+	float *__restrict pFloat = GetData<float>();
 	for(int y=0; y<m_nHeight; y++)
 	{
 		float fDy = (y+0.5f)/m_nHeight - 0.5f;
@@ -49,11 +501,11 @@ void CPixelBuffer::MakeCloudCell(float fExpose, float fSizeDisc)
 				case GL_UNSIGNED_BYTE:
 					nIntensity = (unsigned char)(fIntensity*255 + 0.5f);
 					for(i=0; i<m_nChannels; i++)
-						((unsigned char *)m_pBuffer)[n++] = nIntensity;
+						pByte[n++] = nIntensity;
 					break;
 				case GL_FLOAT:
 					for(i=0; i<m_nChannels; i++)
-						((float *)m_pBuffer)[n++] = fIntensity;
+						pFloat[n++] = fIntensity;
 					break;
 			}
 		}
@@ -62,45 +514,97 @@ void CPixelBuffer::MakeCloudCell(float fExpose, float fSizeDisc)
 
 void CPixelBuffer::Make3DNoise(int nSeed)
 {
-	CFractal noise(3, nSeed, 0.5f, 2.0f);
-	int n = 0;
-	float fValues[3];
-	for(int z=0; z<m_nDepth; z++)
-	{
-		fValues[2] = (float)z * 0.0625f;
-		for(int y=0; y<m_nHeight; y++)
+	auto tStart = std::chrono::high_resolution_clock::now();
+	static const SCloudCurve curve;
+	const CFractal noise(3, nSeed, 0.5f, 2.0f);
+	const float fScale = 0.0625f;		// Noise units per voxel
+	const float fOctaves = noise.FootprintOctaves(fScale, 4.0f);
+	unsigned char *pBuffer = GetData<unsigned char>();
+	const int nWidth = m_nWidth, nHeight = m_nHeight, nDepth = m_nDepth;
+
+	// The bricks don't depend on each other, and the noise object is read-only, so they can all be built at once
+	const int nBricksX = (nWidth + NOISE_BRICK_SIZE-1) / NOISE_BRICK_SIZE;
+	const int nBricksY = (nHeight + NOISE_BRICK_SIZE-1) / NOISE_BRICK_SIZE;
+	const int nBricksZ = (nDepth + NOISE_BRICK_SIZE-1) / NOISE_BRICK_SIZE;
+	ThreadPool()->ParallelFor(0, nBricksX * nBricksY * nBricksZ, 1, [&](int nBegin, int nEnd) {
+		float fX[NOISE_BRICK_SIZE*NOISE_BRICK_SIZE], fY[NOISE_BRICK_SIZE*NOISE_BRICK_SIZE], fZ[NOISE_BRICK_SIZE*NOISE_BRICK_SIZE];
+		float fValue[NOISE_BRICK_SIZE*NOISE_BRICK_SIZE];
+		for(int nBrick=nBegin; nBrick<nEnd; nBrick++)
 		{
-			fValues[1] = (float)y * 0.0625f;
-			for(int x=0; x<m_nWidth; x++)
+			int x0 = (nBrick % nBricksX) * NOISE_BRICK_SIZE;
+			int y0 = (nBrick / nBricksX % nBricksY) * NOISE_BRICK_SIZE;
+			int z0 = (nBrick / (nBricksX * nBricksY)) * NOISE_BRICK_SIZE;
+			int x1 = Min(x0 + NOISE_BRICK_SIZE, nWidth);
+			int y1 = Min(y0 + NOISE_BRICK_SIZE, nHeight);
+			int z1 = Min(z0 + NOISE_BRICK_SIZE, nDepth);
+			for(int z=z0; z<z1; z++)
 			{
-				fValues[0] = (float)x * 0.0625f;
-				float fIntensity = Abs(noise.fBm(fValues, 4.0f)) - 0.5f;
-				if(fIntensity < 0.0)
-					fIntensity = 0.0f;
-				fIntensity = 1.0f - powf(0.9f, fIntensity*255);
-				unsigned char nIntensity = (unsigned char)(fIntensity*255 + 0.5f);
-				((unsigned char *)m_pBuffer)[n++] = 255;
-				((unsigned char *)m_pBuffer)[n++] = nIntensity;
+				int n = 0;
+				for(int y=y0; y<y1; y++)
+				{
+					for(int x=x0; x<x1; x++, n++)
+					{
+						fX[n] = (float)x * fScale;
+						fY[n] = (float)y * fScale;
+						fZ[n] = (float)z * fScale;
+					}
+				}
+				noise.fBmN(fX, fY, fZ, fValue, n, fOctaves);
+
+				n = 0;
+				for(int y=y0; y<y1; y++)
+				{
+					unsigned char *__restrict pVoxel = pBuffer + 2 * ((size_t)nWidth * (nHeight * z + y) + x0);
+					for(int x=x0; x<x1; x++, n++)
+					{
+						float fIntensity = Max(Abs(fValue[n]) - 0.5f, 0.0f);
+						*pVoxel++ = 255;
+						*pVoxel++ = curve.Lookup(fIntensity*255);
+					}
+				}
 			}
 		}
+	});
+
+	double fMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - tStart).count();
+	LogInfo("CPixelBuffer::Make3DNoise() - %d x %d x %d in %.1f ms (%.2f Mvoxels/s)", nWidth, nHeight, nDepth,
+		fMilliseconds, nWidth * nHeight * nDepth * 0.001 / fMilliseconds);
+}
+
+// A 512 x 1 RGBA float buffer for Noise.glsl. Texel i is m_nMap[i] in every
+// channel and texel 256+i is gradient i, with 0 past noise's dimensions. Floats
+// hold every entry exactly, so the shader hashes to the same gradients.
+void CPixelBuffer::MakeNoiseTables(const CNoise &noise)
+{
+	Init(512, 1, 1, 4, GL_RGBA, GL_FLOAT);
+	float *__restrict pBuffer = GetData<float>();
+	for(int i=0; i<256; i++)
+	{
+		for(int j=0; j<4; j++)
+			pBuffer[i*4 + j] = noise.GetMap(i);
+		const float *pGradient = noise.GetLattice(i);
+		for(int j=0; j<4; j++)
+			pBuffer[(256+i)*4 + j] = j < noise.GetDimensions() ? pGradient[j] : 0.0f;
 	}
 }
 
 void CPixelBuffer::MakeGlow1D()
 {
 	int nIndex=0;
+	unsigned char *__restrict pBuffer = GetData<unsigned char>();
 	for(int x=0; x<m_nWidth; x++)
 	{
 		float fIntensity = powf((float)x / m_nWidth, 0.75f);
 		for(int i=0; i<m_nChannels-1; i++)
-			((unsigned char *)m_pBuffer)[nIndex++] = (unsigned char)255;
-		((unsigned char *)m_pBuffer)[nIndex++] = (unsigned char)(fIntensity*255 + 0.5f);
+			pBuffer[nIndex++] = (unsigned char)255;
+		pBuffer[nIndex++] = (unsigned char)(fIntensity*255 + 0.5f);
 	}
 }
 
 void CPixelBuffer::MakeGlow2D(float fExposure, float fRadius)
 {
 	int nIndex=0;
+	unsigned char *__restrict pBuffer = GetData<unsigned char>();
 	for(int y=0; y<m_nHeight; y++)
 	{
 		for(int x=0; x<m_nWidth; x++)
@@ -112,121 +616,135 @@ void CPixelBuffer::MakeGlow2D(float fExposure, float fRadius)
 			float fIntensity = exp(-fExposure * fDist);
 			unsigned char c = (unsigned char)(fIntensity*192 + 0.5f);
 			for(int i=0; i<m_nChannels; i++)
-				((unsigned char *)m_pBuffer)[nIndex++] = c;
+				pBuffer[nIndex++] = c;
 		}
 	}
 }
 
-void CPixelBuffer::MakeOpticalDepthBuffer(float fInnerRadius, float fOuterRadius, float fRayleighScaleHeight, float fMieScaleHeight)
-{
-	const int nSize = 64;
-	const int nSamples = 50;
-	const float fScale = 1.0f / (fOuterRadius - fInnerRadius);
-	//std::ofstream ofScale1("scale1.txt");
-	//std::ofstream ofScale2("scale2.txt");
+namespace {
 
-	Init(nSize, nSize, 1, 4, GL_RGBA, GL_FLOAT);
-	int nIndex = 0;
-	float fPrev = 0;
-	for(int nAngle=0; nAngle<nSize; nAngle++)
+	// Fills one angle row of the optical depth table. The ray marches for
+	// SIMD_WIDTH neighboring heights run side by side, so the inner loop
+	// is one vector exp per sample instead of SIMD_WIDTH scalar ones.
+	void MakeOpticalDepthRow(float *pRow, int nAngle, int nSize, int nSamples, float fInnerRadius, float fOuterRadius, float fRayleighScaleHeight, float fMieScaleHeight)
 	{
+		const float fScale = 1.0f / (fOuterRadius - fInnerRadius);
+
 		// As the y tex coord goes from 0 to 1, the angle goes from 0 to 180 degrees
 		float fCos = 1.0f - (nAngle+nAngle) / (float)nSize;
 		float fAngle = acosf(fCos);
 		CVector vRay(sinf(fAngle), cosf(fAngle), 0);	// Ray pointing to the viewpoint
 
-		/*char szName[256];
-		sprintf(szName, "graph%-2.2d.txt", nAngle);
-		std::ofstream ofGraph;
-		if(fCos >= 0.0f)
-			ofGraph.open(szName);
-		ofGraph << "# fCos = " << fCos << std::endl;*/
-
-		float fFirst = 0;
-		for(int nHeight=0; nHeight<nSize; nHeight++)
-		{
-			// As the x tex coord goes from 0 to 1, the height goes from the bottom of the atmosphere to the top
-			float fHeight = DELTA + fInnerRadius + ((fOuterRadius - fInnerRadius) * nHeight) / nSize;
-			CVector vPos(0, fHeight, 0);				// The position of the camera
-
-			// If the ray from vPos heading in the vRay direction intersects the inner radius (i.e. the planet), then this spot is not visible from the viewpoint
-			float B = 2.0f * (vPos | vRay);
-			float Bsq = B * B;
-			float Cpart = (vPos | vPos);
-			float C = Cpart - fInnerRadius*fInnerRadius;
-			float fDet = Bsq - 4.0f * C;
-			bool bVisible = (fDet < 0 || (0.5f * (-B - sqrtf(fDet)) <= 0) && (0.5f * (-B + sqrtf(fDet)) <= 0));
-			float fRayleighDensityRatio;
-			float fMieDensityRatio;
-			if(bVisible)
-			{
-				fRayleighDensityRatio = expf(-(fHeight - fInnerRadius) * fScale / fRayleighScaleHeight);
-				fMieDensityRatio = expf(-(fHeight - fInnerRadius) * fScale / fMieScaleHeight);
-			}
-			else
+		const CSimdFloat vRayX(vRay.x), vRayY(vRay.y);
+		const CSimdFloat vInnerRadius(fInnerRadius);
+		const CSimdFloat vScale(fScale);
+		const CSimdFloat vRayleighFactor(-1.0f / fRayleighScaleHeight);
+		const CSimdFloat vMieFactor(-1.0f / fMieScaleHeight);
+
+		for(int nBase=0; nBase<nSize; nBase+=SIMD_WIDTH)
+		{
+			float fHeights[SIMD_WIDTH], fFars[SIMD_WIDTH];
+			for(int i=0; i<SIMD_WIDTH; i++)
 			{
-				// Smooth the transition from light to shadow (it is a soft shadow after all)
-				fRayleighDensityRatio = ((float *)m_pBuffer)[nIndex - nSize*m_nChannels] * 0.5f;
-				fMieDensityRatio = ((float *)m_pBuffer)[nIndex+2 - nSize*m_nChannels] * 0.5f;
-			}
+				// As the x tex coord goes from 0 to 1, the height goes from the bottom of the atmosphere to the top
+				int nHeight = Min(nBase + i, nSize - 1);
+				float fHeight = DELTA + fInnerRadius + ((fOuterRadius - fInnerRadius) * nHeight) / nSize;
+				CVector vPos(0, fHeight, 0);				// The position of the camera
+				float *pTexel = pRow + nHeight * 4;
+
+				// If the ray from vPos heading in the vRay direction intersects the inner radius (i.e. the planet), then this spot is not visible from the viewpoint
+				float B = 2.0f * (vPos | vRay);
+				float Bsq = B * B;
+				float Cpart = (vPos | vPos);
+				float C = Cpart - fInnerRadius*fInnerRadius;
+				float fDet = Bsq - 4.0f * C;
+				bool bVisible = (fDet < 0 || (0.5f * (-B - sqrtf(fDet)) <= 0) && (0.5f * (-B + sqrtf(fDet)) <= 0));
+				if(bVisible)
+				{
+					pTexel[0] = expf(-(fHeight - fInnerRadius) * fScale / fRayleighScaleHeight);
+					pTexel[2] = expf(-(fHeight - fInnerRadius) * fScale / fMieScaleHeight);
+				}
+				else
+				{
+					// Flag it for the soft shadow pass, which needs the previous row
+					pTexel[0] = pTexel[2] = -1.0f;
+				}
 
-			// Determine where the ray intersects the outer radius (the top of the atmosphere)
-			// This is the end of our ray for determining the optical depth (vPos is the start)
-			C = Cpart - fOuterRadius*fOuterRadius;
-			fDet = Bsq - 4.0f * C;
-			float fFar = 0.5f * (-B + sqrtf(fDet));
+				// Determine where the ray intersects the outer radius (the top of the atmosphere)
+				// This is the end of our ray for determining the optical depth (vPos is the start)
+				C = Cpart - fOuterRadius*fOuterRadius;
+				fDet = Bsq - 4.0f * C;
+				fHeights[i] = fHeight;
+				fFars[i] = 0.5f * (-B + sqrtf(fDet));
+			}
 
 			// Next determine the length of each sample, scale the sample ray, and make sure position checks are at the center of a sample ray
-			float fSampleLength = fFar / nSamples;
-			float fScaledLength = fSampleLength * fScale;
-			CVector vSampleRay = vRay * fSampleLength;
-			vPos += vSampleRay * 0.5f;
+			CSimdFloat vSampleLength = CSimdFloat::Load(fFars) / CSimdFloat((float)nSamples);
+			CSimdFloat vScaledLength = vSampleLength * vScale;
+			CSimdFloat vSampleRayX = vRayX * vSampleLength;
+			CSimdFloat vSampleRayY = vRayY * vSampleLength;
+			CSimdFloat vPosX = vSampleRayX * CSimdFloat(0.5f);
+			CSimdFloat vPosY = CSimdFloat::Load(fHeights) + vSampleRayY * CSimdFloat(0.5f);
 
 			// Iterate through the samples to sum up the optical depth for the distance the ray travels through the atmosphere
-			float fRayleighDepth = 0;
-			float fMieDepth = 0;
+			CSimdFloat vRayleighDepth(0.0f);
+			CSimdFloat vMieDepth(0.0f);
 			for(int i=0; i<nSamples; i++)
 			{
-				float fHeight = vPos.Magnitude();
-				float fAltitude = (fHeight - fInnerRadius) * fScale;
-				//fAltitude = Max(fAltitude, 0.0f);
-				fRayleighDepth += expf(-fAltitude / fRayleighScaleHeight);
-				fMieDepth += expf(-fAltitude / fMieScaleHeight);
-				vPos += vSampleRay;
+				CSimdFloat vHeight = Sqrt(vPosX*vPosX + vPosY*vPosY);
+				CSimdFloat vAltitude = (vHeight - vInnerRadius) * vScale;
+				vRayleighDepth += Exp(vAltitude * vRayleighFactor);
+				vMieDepth += Exp(vAltitude * vMieFactor);
+				vPosX += vSampleRayX;
+				vPosY += vSampleRayY;
 			}
 
 			// Multiply the sums by the length the ray traveled
-			fRayleighDepth *= fScaledLength;
-			fMieDepth *= fScaledLength;
-
-			if(!_finite(fRayleighDepth) || fRayleighDepth > 1.0e25f)
-				fRayleighDepth = 0;
-			if(!_finite(fMieDepth) || fMieDepth > 1.0e25f)
-				fMieDepth = 0;
+			float fRayleighDepths[SIMD_WIDTH], fMieDepths[SIMD_WIDTH];
+			(vRayleighDepth * vScaledLength).Store(fRayleighDepths);
+			(vMieDepth * vScaledLength).Store(fMieDepths);
 
 			// Store the results for Rayleigh to the light source, Rayleigh to the camera, Mie to the light source, and Mie to the camera
-			((float *)m_pBuffer)[nIndex++] = fRayleighDensityRatio;
-			((float *)m_pBuffer)[nIndex++] = fRayleighDepth;
-			((float *)m_pBuffer)[nIndex++] = fMieDensityRatio;
-			((float *)m_pBuffer)[nIndex++] = fMieDepth;
+			for(int i=0; i<SIMD_WIDTH && nBase+i<nSize; i++)
+			{
+				float fRayleighDepth = fRayleighDepths[i];
+				float fMieDepth = fMieDepths[i];
+				if(!_finite(fRayleighDepth) || fRayleighDepth > 1.0e25f)
+					fRayleighDepth = 0;
+				if(!_finite(fMieDepth) || fMieDepth > 1.0e25f)
+					fMieDepth = 0;
+				pRow[(nBase+i)*4 + 1] = fRayleighDepth;
+				pRow[(nBase+i)*4 + 3] = fMieDepth;
+			}
+		}
+	}
+
+}
+
+void CPixelBuffer::MakeOpticalDepthBuffer(float fInnerRadius, float fOuterRadius, float fRayleighScaleHeight, float fMieScaleHeight, int nSize, int nSamples)
+{
+	Init(nSize, nSize, 1, 4, GL_RGBA, GL_FLOAT);
+	float *pBuffer = GetData<float>();
+
+	// The rows don't depend on each other, so they can all be built at once
+	ThreadPool()->ParallelFor(0, nSize, 1, [=](int nBegin, int nEnd) {
+		for(int nAngle=nBegin; nAngle<nEnd; nAngle++)
+			MakeOpticalDepthRow(pBuffer + nAngle*nSize*4, nAngle, nSize, nSamples, fInnerRadius, fOuterRadius, fRayleighScaleHeight, fMieScaleHeight);
+	});
 
-			/*
-			if(nHeight == 0)
+	// Smooth the transition from light to shadow (it is a soft shadow after all)
+	// Each shadowed texel takes half the density ratio of the texel one angle row up
+	for(int nAngle=1; nAngle<nSize; nAngle++)
+	{
+		float *pRow = pBuffer + nAngle*nSize*4;
+		for(int nIndex=0; nIndex<nSize*4; nIndex+=4)
+		{
+			if(pRow[nIndex] < 0)
 			{
-				fFirst = fRayleighDepth;
-				if(fCos >= 0.0f)
-				{
-					ofScale1 << 1-fCos << "\t" << logf(fRayleighDepth / fRayleighScaleHeight) << std::endl;
-					ofScale2 << 1-fCos << "\t" << logf(fMieDepth) << std::endl;
-					fPrev = fRayleighDepth;
-				}
+				pRow[nIndex] = pRow[nIndex - nSize*4] * 0.5f;
+				pRow[nIndex+2] = pRow[nIndex+2 - nSize*4] * 0.5f;
 			}
-			float x = (fHeight-fInnerRadius) / (fOuterRadius-fInnerRadius);
-			float y = fRayleighDepth / fFirst;
-			ofGraph << x << "\t" << y << std::endl;
-			*/
 		}
-		//ofGraph << std::endl;
 	}
 }
 
@@ -238,14 +756,186 @@ void CPixelBuffer::MakePhaseBuffer(float ESun, float Kr, float Km, float g)
 	float fMiePart = 1.5f * (1.0f - g2) / (2.0f + g2);
 
 	int nIndex = 0;
+	float *__restrict pBuffer = GetData<float>();
 	for(int nAngle=0; nAngle<m_nWidth; nAngle++)
 	{
 		float fCos = 1.0f - (nAngle+nAngle) / (float)m_nWidth;
 		float fCos2 = fCos*fCos;
 		float fRayleighPhase = 0.75f * (1.0f + fCos2);
 		float fMiePhase = fMiePart * (1.0f + fCos2) / powf(1.0f + g2 - 2.0f*g*fCos, 1.5f);
-		((float *)m_pBuffer)[nIndex++] = fRayleighPhase * Kr;
-		((float *)m_pBuffer)[nIndex++] = fMiePhase * Km;
+		pBuffer[nIndex++] = fRayleighPhase * Kr;
+		pBuffer[nIndex++] = fMiePhase * Km;
+	}
+}
+
+
+void CPixelBuffer::MakeInscatterBuffer(const CScattering &scattering, int nR, int nMu, int nMuS, int nNu, int nSamples)
+{
+	Init(nMuS * nNu, nMu, nR, 4, GL_RGBA, GL_FLOAT);
+	scattering.MakeInscatterTable(GetData<float>(), nR, nMu, nMuS, nNu, nSamples);
+}
+
+namespace {
+
+	struct SQuantizeError
+	{
+		double dSquared;		// Sum of the squared errors
+		float fMax;				// The largest error
+		float fRange;			// The largest magnitude converted, for scale
+		int nClamped;			// Values outside the format's range, left out of the rest
+	};
+
+	float HalfToFloat(unsigned short n)
+	{
+		unsigned int nExponent = (n >> 10) & 0x1F, nMantissa = n & 0x3FF;
+		float f;
+		if(nExponent == 0)
+			f = nMantissa * (1.0f / (1 << 24));		// Denormal
+		else
+		{
+			unsigned int nBits = (nExponent == 31 ? 0xFF << 23 : (nExponent + 112) << 23) | (nMantissa << 13);
+			memcpy(&f, &nBits, sizeof(f));
+		}
+		return (n & 0x8000) ? -f : f;
+	}
+
+	// Half floats saturate at the largest finite half rather than turning into infinity
+	const float fHalfMax = 65504.0f;
+
+	void QuantizeBlock(const float *pSrc, unsigned short *pDst, int nDataType, const CSimdFloat &fInvScale)
+	{
+		CSimdFloat f = CSimdFloat::Load(pSrc) * fInvScale;
+		if(nDataType == GL_HALF_FLOAT)
+			StoreHalf(pDst, Min(Max(f, CSimdFloat(-fHalfMax)), CSimdFloat(fHalfMax)));
+		else
+			StoreShort(pDst, ToInt(Min(Max(f, CSimdFloat(0.0f)), CSimdFloat(1.0f)) * CSimdFloat(65535.0f) + CSimdFloat(0.5f)));
+	}
+
+	// Converts nCount floats, then converts them back to see what was lost
+	void QuantizeRange(const float *pSrc, unsigned short *pDst, int nCount, int nDataType, float fScale, SQuantizeError &error)
+	{
+		CSimdFloat fInvScale(1.0f / fScale);
+		int nFull = SIMD_ROUND_DOWN(nCount);
+		for(int n=0; n<nFull; n+=SIMD_WIDTH)
+			QuantizeBlock(pSrc + n, pDst + n, nDataType, fInvScale);
+		if(nFull < nCount)
+		{
+			float fTail[SIMD_WIDTH] = {0};
+			unsigned short nTail[SIMD_WIDTH];
+			memcpy(fTail, pSrc + nFull, (nCount - nFull) * sizeof(float));
+			QuantizeBlock(fTail, nTail, nDataType, fInvScale);
+			memcpy(pDst + nFull, nTail, (nCount - nFull) * sizeof(unsigned short));
+		}
+
+		float fLow = nDataType == GL_HALF_FLOAT ? -fHalfMax * fScale : 0.0f;
+		float fHigh = nDataType == GL_HALF_FLOAT ? fHalfMax * fScale : fScale;
+		for(int n=0; n<nCount; n++)
+		{
+			if(!(pSrc[n] >= fLow && pSrc[n] <= fHigh))
+			{
+				error.nClamped++;
+				continue;
+			}
+			float fValue = nDataType == GL_HALF_FLOAT ? HalfToFloat(pDst[n]) * fScale : pDst[n] * (fScale / 65535.0f);
+			float fError = fabsf(fValue - pSrc[n]);
+			error.dSquared += (double)fError * fError;
+			error.fMax = Max(error.fMax, fError);
+			error.fRange = Max(error.fRange, fabsf(pSrc[n]));
+		}
+	}
+
+}
+
+bool CPixelBuffer::Quantize(int nDataType, const char *pszName, float fScale)
+{
+	if(m_nDataType != GL_FLOAT || !m_pBuffer || (nDataType != GL_HALF_FLOAT && nDataType != GL_UNSIGNED_SHORT))
+	{
+		LogError("CPixelBuffer::Quantize() - %s: Only float buffers convert, to GL_HALF_FLOAT or GL_UNSIGNED_SHORT", pszName);
+		return false;
+	}
+
+	CPixelBuffer pb(m_nWidth, m_nHeight, m_nDepth, m_nChannels, m_nFormat, nDataType);
+	const float *pSrc = GetData<const float>();
+	unsigned short *pDst = pb.GetData<unsigned short>();
+	int nCount = m_nWidth * m_nHeight * m_nDepth * m_nChannels;
+	SQuantizeError error = {0.0, 0.0f, 0.0f, 0};
+	std::mutex mutexError;
+	ThreadPool()->ParallelFor(0, nCount, 1 << 16, [&](int nBegin, int nEnd) {
+		SQuantizeError range = {0.0, 0.0f, 0.0f, 0};
+		QuantizeRange(pSrc + nBegin, pDst + nBegin, nEnd - nBegin, nDataType, fScale, range);
+		std::lock_guard<std::mutex> lock(mutexError);
+		error.dSquared += range.dSquared;
+		error.fMax = Max(error.fMax, range.fMax);
+		error.fRange = Max(error.fRange, range.fRange);
+		error.nClamped += range.nClamped;
+	});
+
+	LogInfo("CPixelBuffer::Quantize() - %s as %s: %.2f MB -> %.2f MB, max error %g (%.4f%% of the largest value, %g), RMS error %g, %d of %d values clamped",
+		pszName, nDataType == GL_HALF_FLOAT ? "half float" : "unorm16", GetBufferSize() / 1048576.0, pb.GetBufferSize() / 1048576.0,
+		error.fMax, error.fRange > 0 ? 100.0f * error.fMax / error.fRange : 0.0f, error.fRange,
+		sqrt(error.dSquared / Max(nCount - error.nClamped, 1)), error.nClamped, nCount);
+	*this = std::move(pb);
+	return true;
+}
+
+bool CPixelBuffer::MapFile(const char *pszFile, unsigned long long nKey)
+{
+	CMappedFile *pMapping = new CMappedFile;
+	if(!pMapping->Open(pszFile) || pMapping->GetSize() < ASSET_DATA_OFFSET)
+	{
+		delete pMapping;
+		return false;
 	}
+
+	// Reject anything written by another version or for different parameters
+	const SAssetHeader *pHeader = (const SAssetHeader *)pMapping->GetData();
+	int nElementSize = pHeader->nChannels * GetDataTypeSize(pHeader->nDataType);
+	if(memcmp(pHeader->szMagic, ASSET_MAGIC, 4) != 0 || pHeader->nVersion != ASSET_VERSION || pHeader->nKey != nKey ||
+		nElementSize <= 0 || pHeader->nDataSize != (unsigned int)(pHeader->nWidth * pHeader->nHeight * pHeader->nDepth * nElementSize) ||
+		pMapping->GetSize() < ASSET_DATA_OFFSET + (size_t)pHeader->nDataSize)
+	{
+		delete pMapping;
+		return false;
+	}
+
+	// Drop any buffer we own first, otherwise Init() would keep it when the dimensions match
+	Cleanup();
+	Init(pHeader->nWidth, pHeader->nHeight, pHeader->nDepth, pHeader->nChannels, pHeader->nFormat, pHeader->nDataType, (unsigned char *)pMapping->GetData() + ASSET_DATA_OFFSET);
+	m_pMapping = pMapping;
+	return true;
+}
+
+bool CPixelBuffer::SaveFile(const char *pszFile, unsigned long long nKey) const
+{
+	SAssetHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.szMagic, ASSET_MAGIC, 4);
+	header.nVersion = ASSET_VERSION;
+	header.nKey = nKey;
+	header.nWidth = m_nWidth;
+	header.nHeight = m_nHeight;
+	header.nDepth = m_nDepth;
+	header.nChannels = m_nChannels;
+	header.nFormat = m_nFormat;
+	header.nDataType = m_nDataType;
+	header.nDataSize = GetBufferSize();
+
+	FILE *pFile = fopen(pszFile, "wb");
+	if(!pFile)
+		return false;
+	char szPad[ASSET_DATA_OFFSET] = {0};
+	bool bSuccess = fwrite(&header, sizeof(header), 1, pFile) == 1 &&
+		fwrite(szPad, ASSET_DATA_OFFSET - sizeof(header), 1, pFile) == 1 &&
+		fwrite(m_pBuffer, header.nDataSize, 1, pFile) == 1;
+	return (fclose(pFile) == 0) && bSuccess;
 }
 
+void CPixelBuffer::Unmap()
+{
+	if(m_pMapping)
+	{
+		delete m_pMapping;
+		m_pMapping = NULL;
+		m_pBuffer = NULL;
+	}
+}
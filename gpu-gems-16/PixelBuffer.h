@@ -30,12 +30,16 @@ POSSIBILITY OF SUCH DAMAGE.
 
 #pragma once
 #include "Matrix.h"
+#include "AssetCache.h"
+#include "Scattering.h"
 
 #include <cassert>
+#include <utility>
 
 #define ALIGN_SIZE		64
 #define ALIGN_MASK		(ALIGN_SIZE-1)
-#define ALIGN(x)		(((unsigned int)x+ALIGN_MASK) & ~ALIGN_MASK)
+#define ALIGN(x)		(((size_t)(x)+ALIGN_MASK) & ~(size_t)ALIGN_MASK)
+#define LARGE_PAGE_MIN	(4 << 20)			// Buffers this big get large pages when EnableLargePages() is on
 
 typedef enum
 {
@@ -46,9 +50,17 @@ typedef enum
 	UnsignedIntType = GL_UNSIGNED_INT,
 	SignedIntType = GL_INT,
 	FloatType = GL_FLOAT,
+	HalfFloatType = GL_HALF_FLOAT,
 	DoubleType = GL_DOUBLE
 } BufferDataType;
 
+// How C3DBuffer::InterpolateN() treats coordinates outside 0 to 1
+enum InterpolateMode
+{
+	InterpolateClamp,		// Clamped to 0 to 1, which are the centers of the edge elements, as Interpolate() has them
+	InterpolateWrap			// Tiled, with element i at i/size and the last element blending into the first
+};
+
 inline const int GetDataTypeSize(const int nDataType)
 {
 	int nSize;
@@ -60,6 +72,7 @@ inline const int GetDataTypeSize(const int nDataType)
 			break;
 		case UnsignedShortType:
 		case SignedShortType:
+		case HalfFloatType:
 			nSize = 2;
 			break;
 		case UnsignedIntType:
@@ -78,6 +91,16 @@ inline const int GetDataTypeSize(const int nDataType)
 }
 
 
+/*******************************************************************************
+* Class: C3DBuffer
+********************************************************************************
+* A width x height x depth array of elements, each m_nChannels values of
+* m_nDataType. The memory it allocates itself is ALIGN_SIZE aligned, so rows
+* can be read with aligned SIMD loads. With EnableLargePages(), buffers of
+* LARGE_PAGE_MIN bytes or more come straight from the OS backed by large
+* pages, which a 64 MB volume walked slice by slice needs far fewer TLB
+* entries for. Moving a buffer hands its memory over without copying it.
+*******************************************************************************/
 class C3DBuffer
 {
 protected:
@@ -87,23 +110,73 @@ protected:
 	int m_nDataType;			// The data type stored in the buffer (i.e. GL_UNSIGNED_BYTE, GL_FLOAT)
 	int m_nChannels;			// The number of channels of data stored in the buffer
 	int m_nElementSize;			// The size of one element in the buffer
-	void *m_pAlloc;				// The pointer to the pixel buffer
-	void *m_pBuffer;			// A byte-aligned pointer (for faster memory access)
+	void *m_pAlloc;				// The memory this object owns, NULL when m_pBuffer belongs to someone else
+	void *m_pBuffer;			// The pixels, ALIGN_SIZE aligned when this object allocated them
+	size_t m_nAllocSize;		// The size of m_pAlloc, rounded up to a page when it came from the OS
+	bool m_bPageAlloc;			// m_pAlloc came from the OS's page allocator instead of the heap
+
+	static size_t m_nLargePageSize;		// 0 until EnableLargePages() succeeds
+
+	// Allocate() sets bPageAlloc and rounds nBytes up to what it really allocated
+	static void *Allocate(size_t &nBytes, bool &bPageAlloc);
+	static void Free(void *pAlloc, size_t nBytes, bool bPageAlloc);
+
+	void Empty()
+	{
+		m_nWidth = m_nHeight = m_nDepth = 0;
+		m_nDataType = m_nChannels = m_nElementSize = 0;
+		m_pAlloc = m_pBuffer = NULL;
+		m_nAllocSize = 0;
+		m_bPageAlloc = false;
+	}
 
 public:
-	C3DBuffer()						{ m_pAlloc = m_pBuffer = NULL; }
-	C3DBuffer(const C3DBuffer &buf)	{ *this = buf; }
+	C3DBuffer()						{ Empty(); }
+	C3DBuffer(const C3DBuffer &buf)	{ Empty(); *this = buf; }
+	C3DBuffer(C3DBuffer &&buf)		{ Empty(); *this = std::move(buf); }
 	C3DBuffer(const int nWidth, const int nHeight, const int nDepth, const int nDataType, const int nChannels=1, void *pBuffer=NULL)
 	{
-		m_pAlloc = m_pBuffer = NULL;
+		Empty();
 		Init(nWidth, nHeight, nDepth, nDataType, nChannels, pBuffer);
 	}
 	~C3DBuffer()					{ Cleanup(); }
 
-	void operator=(const C3DBuffer &buf)
+	// Asks for large pages for the big buffers allocated from now on, which
+	// needs the "Lock pages in memory" right on Windows. Returns false, and
+	// the buffers stay on the heap, when they aren't available.
+	static bool EnableLargePages();
+
+	C3DBuffer &operator=(const C3DBuffer &buf)
 	{
+		if(this == &buf)
+			return *this;
+		if(!buf.m_pBuffer)
+		{
+			Cleanup();
+			Empty();
+			return *this;
+		}
 		Init(buf.m_nWidth, buf.m_nHeight, buf.m_nDepth, buf.m_nDataType, buf.m_nChannels);
 		memcpy(m_pBuffer, buf.m_pBuffer, GetBufferSize());
+		return *this;
+	}
+	C3DBuffer &operator=(C3DBuffer &&buf)
+	{
+		if(this == &buf)
+			return *this;
+		Cleanup();
+		m_nWidth = buf.m_nWidth;
+		m_nHeight = buf.m_nHeight;
+		m_nDepth = buf.m_nDepth;
+		m_nDataType = buf.m_nDataType;
+		m_nChannels = buf.m_nChannels;
+		m_nElementSize = buf.m_nElementSize;
+		m_pAlloc = buf.m_pAlloc;
+		m_pBuffer = buf.m_pBuffer;
+		m_nAllocSize = buf.m_nAllocSize;
+		m_bPageAlloc = buf.m_bPageAlloc;
+		buf.Empty();
+		return *this;
 	}
 	bool operator==(const C3DBuffer &buf)
 	{
@@ -112,30 +185,30 @@ public:
 
 	void *operator[](const int n)
 	{
-		return (void *)((unsigned int)m_pBuffer + n * m_nElementSize);
+		return (unsigned char *)m_pBuffer + (size_t)n * m_nElementSize;
 	}
 	void *operator()(const int x, const int y, const int z)
 	{
-		return (void *)((unsigned int)m_pBuffer + m_nElementSize * (m_nWidth * (m_nHeight * z + y) + x));
+		return (unsigned char *)m_pBuffer + (size_t)m_nElementSize * (m_nWidth * (m_nHeight * z + y) + x);
 	}
 
 	void *operator()(const float x)
 	{
 		int nX = Min(m_nWidth-1, Max(0, (int)(x*(m_nWidth-1)+0.5f)));
-		return (void *)((unsigned long)m_pBuffer + m_nElementSize * nX);
+		return (unsigned char *)m_pBuffer + m_nElementSize * nX;
 	}
 	void *operator()(const float x, const float y)
 	{
 		int nX = Min(m_nWidth-1, Max(0, (int)(x*(m_nWidth-1)+0.5f)));
 		int nY = Min(m_nHeight-1, Max(0, (int)(y*(m_nHeight-1)+0.5f)));
-		return (void *)((unsigned long)m_pBuffer + m_nElementSize * (m_nWidth * nY + nX));
+		return (unsigned char *)m_pBuffer + m_nElementSize * (m_nWidth * nY + nX);
 	}
 	void *operator()(const float x, const float y, const float z)
 	{
 		int nX = Min(m_nWidth-1, Max(0, (int)(x*(m_nWidth-1)+0.5f)));
 		int nY = Min(m_nHeight-1, Max(0, (int)(y*(m_nHeight-1)+0.5f)));
 		int nZ = Min(m_nDepth-1, Max(0, (int)(z*(m_nDepth-1)+0.5f)));
-		return (void *)((unsigned long)m_pBuffer + m_nElementSize * (m_nWidth * (m_nHeight * nZ + nY) + nX));
+		return (unsigned char *)m_pBuffer + (size_t)m_nElementSize * (m_nWidth * (m_nHeight * nZ + nY) + nX);
 	}
 
 	void Interpolate(float *p, const float x)
@@ -143,7 +216,7 @@ public:
 		float fX = x*(m_nWidth-1);
 		int nX = Min(m_nWidth-2, Max(0, (int)fX));
 		float fRatioX = fX - nX;
-		float *pValue = (float *)((unsigned long)m_pBuffer + m_nElementSize * nX);
+		float *pValue = (float *)((unsigned char *)m_pBuffer + m_nElementSize * nX);
 		for(int i=0; i<m_nChannels; i++)
 		{
 			p[i] =	pValue[0] * (1-fRatioX) + pValue[m_nChannels] * (fRatioX);
@@ -158,7 +231,7 @@ public:
 		int nY = Min(m_nHeight-2, Max(0, (int)fY));
 		float fRatioX = fX - nX;
 		float fRatioY = fY - nY;
-		float *pValue = (float *)((unsigned long)m_pBuffer + m_nElementSize * (m_nWidth * nY + nX));
+		float *pValue = (float *)((unsigned char *)m_pBuffer + m_nElementSize * (m_nWidth * nY + nX));
 		for(int i=0; i<m_nChannels; i++)
 		{
 			p[i] =	pValue[0] * (1-fRatioX) * (1-fRatioY) +
@@ -179,8 +252,8 @@ public:
 		float fRatioX = fX - nX;
 		float fRatioY = fY - nY;
 		float fRatioZ = fZ - nZ;
-		float *pValue = (float *)((unsigned long)m_pBuffer + m_nElementSize * (m_nWidth * (m_nHeight * nZ + nY) + nX));
-		float *pValue2 = (float *)((unsigned long)m_pBuffer + m_nElementSize * (m_nWidth * (m_nHeight * (nZ+1) + nY) + nX));
+		float *pValue = (float *)((unsigned char *)m_pBuffer + (size_t)m_nElementSize * (m_nWidth * (m_nHeight * nZ + nY) + nX));
+		float *pValue2 = (float *)((unsigned char *)m_pBuffer + (size_t)m_nElementSize * (m_nWidth * (m_nHeight * (nZ+1) + nY) + nX));
 		for(int i=0; i<m_nChannels; i++)
 		{
 			p[i] =	pValue[0] * (1-fRatioX) * (1-fRatioY) * (1-fRatioZ) +
@@ -196,10 +269,24 @@ public:
 		}
 	}
 
+	// Interpolate() for nCount points at once, SIMD_WIDTH at a time. pCoord[0]
+	// to pCoord[2] are the x, y and z arrays, and a NULL array reads as all 0s,
+	// which is how a 1D or 2D buffer is sampled. Channel c of point i goes to
+	// pOut[c][i]. Float buffers give their values and unsigned byte buffers
+	// give 0 to 1, as a texture would. Other types return false. The element
+	// offsets are worked out in floats, so the buffer can hold up to 2^24
+	// elements (a 256^3 volume).
+	bool InterpolateN(const float *const *pCoord, float *const *pOut, int nCount, InterpolateMode nMode=InterpolateClamp) const;
+	bool InterpolateN(const float *pX, const float *pY, const float *pZ, float *const *pOut, int nCount, InterpolateMode nMode=InterpolateClamp) const
+	{
+		const float *pCoord[3] = {pX, pY, pZ};
+		return InterpolateN(pCoord, pOut, nCount, nMode);
+	}
+
 	void Init(const int nWidth, const int nHeight, const int nDepth, const int nDataType, const int nChannels=1, void *pBuffer=NULL)
 	{
 		// If the buffer is already initialized to the specified settings, then nothing needs to be done
-		if(m_pAlloc && m_nWidth == nWidth && m_nHeight == nHeight && m_nDataType == nDataType && m_nChannels == nChannels)
+		if(m_pAlloc && !pBuffer && m_nWidth == nWidth && m_nHeight == nHeight && m_nDepth == nDepth && m_nDataType == nDataType && m_nChannels == nChannels)
 			return;
 
 		Cleanup();
@@ -213,8 +300,8 @@ public:
 			m_pBuffer = pBuffer;
 		else
 		{
-			m_pAlloc = new unsigned char[GetBufferSize() + ALIGN_MASK];
-			m_pBuffer = (void *)ALIGN(m_pAlloc);
+			m_nAllocSize = GetBufferSize();
+			m_pAlloc = m_pBuffer = Allocate(m_nAllocSize, m_bPageAlloc);
 		}
 	}
 
@@ -222,8 +309,10 @@ public:
 	{
 		if(m_pAlloc)
 		{
-			delete m_pAlloc;
+			Free(m_pAlloc, m_nAllocSize, m_bPageAlloc);
 			m_pAlloc = m_pBuffer = NULL;
+			m_nAllocSize = 0;
+			m_bPageAlloc = false;
 		}
 	}
 
@@ -235,13 +324,20 @@ public:
 	int GetBufferSize() const	{ return m_nWidth * m_nHeight * m_nDepth * m_nElementSize; }
 	void *GetBuffer() const		{ return m_pBuffer; }
 
+	// The buffer as an array of T. A loop filling the buffer should keep this
+	// in a T *__restrict local, because stores through an unsigned char * or
+	// to m_pBuffer's own type could otherwise alias m_pBuffer itself, and the
+	// compiler has to reload it after every one.
+	template <class T> T *GetData() const	{ return (T *)m_pBuffer; }
+
 	void ClearBuffer()			{ memset(m_pBuffer, 0, GetBufferSize()); }
 	void SwapBuffers(C3DBuffer &buf)
 	{
-		void *pTemp;
 		assert(*this == buf);
-		SWAP(m_pAlloc, buf.m_pAlloc, pTemp);
-		SWAP(m_pBuffer, buf.m_pBuffer, pTemp);
+		std::swap(m_pAlloc, buf.m_pAlloc);
+		std::swap(m_pBuffer, buf.m_pBuffer);
+		std::swap(m_nAllocSize, buf.m_nAllocSize);
+		std::swap(m_bPageAlloc, buf.m_bPageAlloc);
 	}
 
 	float LinearSample2D(int nChannel, float x, float y)
@@ -252,7 +348,7 @@ public:
 		y *= m_nHeight;
 		int n[2] = {(int)x, (int)y};
 		float fRatio[2] = {x - n[0], y - n[1]};
-		float *pBase = (float *)((unsigned int)m_pBuffer + (m_nWidth * n[1] + n[0]) * m_nChannels * sizeof(float));
+		float *pBase = (float *)m_pBuffer + (m_nWidth * n[1] + n[0]) * m_nChannels;
 		//if(n[0] == m_nWidth-1 || n[1] == m_nHeight-1)
 			return pBase[nChannel];
 		float *p[4] = {
@@ -281,28 +377,82 @@ class CPixelBuffer : public C3DBuffer
 {
 protected:
 	int m_nFormat;				// The format of the pixel data (i.e. GL_LUMINANCE, GL_RGBA)
+	CMappedFile *m_pMapping;	// The asset file backing m_pBuffer when it was loaded with MapFile()
 
 public:
-	CPixelBuffer() : C3DBuffer() {}
+	CPixelBuffer() : C3DBuffer() { m_pMapping = NULL; }
+	CPixelBuffer(const CPixelBuffer &pb) : C3DBuffer(pb)
+	{
+		m_nFormat = pb.m_nFormat;
+		m_pMapping = NULL;
+	}
+	CPixelBuffer(CPixelBuffer &&pb) : C3DBuffer(std::move(pb))
+	{
+		m_nFormat = pb.m_nFormat;
+		m_pMapping = pb.m_pMapping;
+		pb.m_pMapping = NULL;
+	}
 	CPixelBuffer(int nWidth, int nHeight, int nDepth, int nChannels=3, int nFormat=GL_RGB, int nDataType=UnsignedByteType) : C3DBuffer(nWidth, nHeight, nDepth, nDataType, nChannels)
 	{
 		m_nFormat = nFormat;
+		m_pMapping = NULL;
+	}
+	~CPixelBuffer()				{ Unmap(); }
+
+	CPixelBuffer &operator=(const CPixelBuffer &pb)
+	{
+		if(this == &pb)
+			return *this;
+		Unmap();
+		C3DBuffer::operator=(pb);
+		m_nFormat = pb.m_nFormat;
+		return *this;
+	}
+
+	// Takes over pb's memory, or its mapped asset file, without a copy
+	CPixelBuffer &operator=(CPixelBuffer &&pb)
+	{
+		if(this == &pb)
+			return *this;
+		Unmap();
+		C3DBuffer::operator=(std::move(pb));
+		m_nFormat = pb.m_nFormat;
+		m_pMapping = pb.m_pMapping;
+		pb.m_pMapping = NULL;
+		return *this;
 	}
 
 	int GetFormat()				{ return m_nFormat; }
 
 	void Init(int nWidth, int nHeight, int nDepth, int nChannels=3, int nFormat=GL_RGB, int nDataType=GL_UNSIGNED_BYTE, void *pBuffer=NULL)
 	{
+		Unmap();
 		C3DBuffer::Init(nWidth, nHeight, nDepth, nDataType, nChannels, pBuffer);
 		m_nFormat = nFormat;
 	}
 
+	// Asset cache files (see AssetCache.h). MapFile() uses the file's pixels in
+	// place as the buffer, copy-on-write, until the next Init() or Unmap().
+	bool MapFile(const char *pszFile, unsigned long long nKey);
+	bool SaveFile(const char *pszFile, unsigned long long nKey) const;
+	bool IsMapped() const		{ return m_pMapping != NULL; }
+	void Unmap();
+
 	// Miscellaneous initalization routines
 	void MakeCloudCell(float fExpose, float fSizeDisc);
 	void Make3DNoise(int nSeed);
+	void MakeNoiseTables(const CNoise &noise);
 	void MakeGlow1D();
 	void MakeGlow2D(float fExposure, float fRadius);
-	void MakeOpticalDepthBuffer(float fInnerRadius, float fOuterRadius, float fRayleighScaleHeight, float fMieScaleHeight);
+	void MakeOpticalDepthBuffer(float fInnerRadius, float fOuterRadius, float fRayleighScaleHeight, float fMieScaleHeight, int nSize=64, int nSamples=50);
 	void MakePhaseBuffer(float ESun, float Kr, float Km, float g);
+	void MakeInscatterBuffer(const CScattering &scattering, int nR=32, int nMu=128, int nMuS=32, int nNu=8, int nSamples=32);
+
+	// Converts a float buffer to 16 bits a channel, half the memory and upload
+	// bandwidth of floats, and logs how far the result is from them under
+	// pszName. Both store value/fScale for the shader to multiply back by
+	// fScale: GL_HALF_FLOAT saturating at +/-65504, GL_UNSIGNED_SHORT as a
+	// normalized 0 to 1. The report counts the values clamped separately.
+	bool Quantize(int nDataType, const char *pszName, float fScale=1.0f);
 };
 
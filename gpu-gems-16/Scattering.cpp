@@ -0,0 +1,416 @@
+// CPU implementation of the per-vertex atmospheric scattering shaders.
+//
+// Author:  Tim Finer
+// Email:   tfiner@csu.fullerton.edu
+//
+// CPSC-597 Fall 2015 Master's Project
+//
+
+#include "Scattering.h"
+#include "Simd.h"
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <vector>
+
+
+namespace {
+
+	// Vertices handed to one worker at a time
+	const int BATCH_GRAIN = 2048;
+
+	// Stands in for the optical depth of a light ray that hits the planet
+	const float SHADOW_DEPTH = 1.0e6f;
+
+
+	// Everything the shaders get as uniforms, splatted across the SIMD lanes
+	struct SUniforms
+	{
+		CSimdFloat v3CameraPos[3];
+		CSimdFloat v3LightPos[3];
+		CSimdFloat v3InvWavelength[3];
+		CSimdFloat v3Extinction[3];	// v3InvWavelength * fKr4PI + fKm4PI
+		CSimdFloat fCameraHeight;
+		CSimdFloat fCameraHeight2;
+		CSimdFloat fOuterRadius;
+		CSimdFloat fOuterRadius2;
+		CSimdFloat fInnerRadius;
+		CSimdFloat fKrESun;
+		CSimdFloat fKmESun;
+		CSimdFloat fScale;
+		CSimdFloat fScaleDepth;
+		CSimdFloat fScaleOverScaleDepth;
+		CSimdFloat fSamples;
+		int nSamples;
+
+		void Init(const CScatteringParams &p, const float *pCamera, const float *pLight, int nSamples)
+		{
+			float fHeight2 = pCamera[0]*pCamera[0] + pCamera[1]*pCamera[1] + pCamera[2]*pCamera[2];
+			for(int i=0; i<3; i++)
+			{
+				v3CameraPos[i] = CSimdFloat(pCamera[i]);
+				v3LightPos[i] = CSimdFloat(pLight[i]);
+				v3InvWavelength[i] = CSimdFloat(p.GetInvWavelength(i));
+				v3Extinction[i] = CSimdFloat(p.GetInvWavelength(i) * p.GetKr4PI() + p.GetKm4PI());
+			}
+			fCameraHeight = CSimdFloat(sqrtf(fHeight2));
+			fCameraHeight2 = CSimdFloat(fHeight2);
+			fOuterRadius = CSimdFloat(p.m_fOuterRadius);
+			fOuterRadius2 = CSimdFloat(p.m_fOuterRadius * p.m_fOuterRadius);
+			fInnerRadius = CSimdFloat(p.m_fInnerRadius);
+			fKrESun = CSimdFloat(p.m_Kr * p.m_ESun);
+			fKmESun = CSimdFloat(p.m_Km * p.m_ESun);
+			fScale = CSimdFloat(p.GetScale());
+			fScaleDepth = CSimdFloat(p.m_fScaleDepth);
+			fScaleOverScaleDepth = CSimdFloat(p.GetScaleOverScaleDepth());
+			fSamples = CSimdFloat((float)nSamples);
+			this->nSamples = nSamples;
+		}
+	};
+
+
+	inline CSimdFloat Dot(const CSimdFloat *a, const CSimdFloat *b)
+	{
+		return a[0]*b[0] + a[1]*b[1] + a[2]*b[2];
+	}
+
+	inline CSimdFloat Scale(const CSimdFloat &fCos, const SUniforms &u)
+	{
+		CSimdFloat x = CSimdFloat(1.0f) - fCos;
+		CSimdFloat y = x * CSimdFloat(5.25f) + CSimdFloat(-6.80f);
+		y = y * x + CSimdFloat(3.83f);
+		y = y * x + CSimdFloat(0.459f);
+		y = y * x + CSimdFloat(-0.00287f);
+		return u.fScaleDepth * Exp(y);
+	}
+
+
+	// One SIMD_WIDTH wide batch of vertices through the shader selected by MODE.
+	// The code follows the GLSL line for line so the two are easy to compare.
+	template <int MODE>
+	void ScatterKernel(const SUniforms &u, const float *pX, const float *pY, const float *pZ, float *pColor[3], float *pSecondary[3], int n)
+	{
+		const bool bFromSpace = (MODE == CScattering::SkyFromSpace || MODE == CScattering::GroundFromSpace);
+		const bool bSky = (MODE == CScattering::SkyFromSpace || MODE == CScattering::SkyFromAtmosphere);
+
+		// Get the ray from the camera to the vertex and its length (which is the far point of the ray passing through the atmosphere)
+		CSimdFloat v3Pos[3] = { CSimdFloat::Load(pX + n), CSimdFloat::Load(pY + n), CSimdFloat::Load(pZ + n) };
+		CSimdFloat v3Ray[3] = { v3Pos[0] - u.v3CameraPos[0], v3Pos[1] - u.v3CameraPos[1], v3Pos[2] - u.v3CameraPos[2] };
+		CSimdFloat fFar = Sqrt(Dot(v3Ray, v3Ray));
+		CSimdFloat fInvFar = CSimdFloat(1.0f) / fFar;
+		for(int i=0; i<3; i++)
+			v3Ray[i] *= fInvFar;
+
+		// Calculate the ray's starting position
+		CSimdFloat v3Start[3] = { u.v3CameraPos[0], u.v3CameraPos[1], u.v3CameraPos[2] };
+		if(bFromSpace)
+		{
+			// Calculate the closest intersection of the ray with the outer atmosphere (which is the near point of the ray passing through the atmosphere)
+			CSimdFloat B = CSimdFloat(2.0f) * Dot(u.v3CameraPos, v3Ray);
+			CSimdFloat C = u.fCameraHeight2 - u.fOuterRadius2;
+			CSimdFloat fDet = Max(CSimdFloat(0.0f), B*B - CSimdFloat(4.0f) * C);
+			CSimdFloat fNear = CSimdFloat(0.5f) * (-B - Sqrt(fDet));
+			for(int i=0; i<3; i++)
+				v3Start[i] = u.v3CameraPos[i] + v3Ray[i] * fNear;
+			fFar -= fNear;
+		}
+
+		// Calculate the scattering offset
+		CSimdFloat fStartOffset, fCameraOffset, fTemp;
+		if(bSky)
+		{
+			if(bFromSpace)
+			{
+				CSimdFloat fStartAngle = Dot(v3Ray, v3Start) / u.fOuterRadius;
+				CSimdFloat fStartDepth = Exp(CSimdFloat(-1.0f) / u.fScaleDepth);
+				fStartOffset = fStartDepth * Scale(fStartAngle, u);
+			}
+			else
+			{
+				CSimdFloat fDepth = Exp(u.fScaleOverScaleDepth * (u.fInnerRadius - u.fCameraHeight));
+				CSimdFloat fStartAngle = Dot(v3Ray, v3Start) / u.fCameraHeight;
+				fStartOffset = fDepth * Scale(fStartAngle, u);
+			}
+		}
+		else
+		{
+			CSimdFloat fDepth = bFromSpace ? Exp((u.fInnerRadius - u.fOuterRadius) / u.fScaleDepth) : Exp((u.fInnerRadius - u.fCameraHeight) / u.fScaleDepth);
+			CSimdFloat fInvLength = CSimdFloat(1.0f) / Sqrt(Dot(v3Pos, v3Pos));
+			CSimdFloat fCameraAngle = -Dot(v3Ray, v3Pos) * fInvLength;
+			CSimdFloat fLightAngle = Dot(u.v3LightPos, v3Pos) * fInvLength;
+			CSimdFloat fCameraScale = Scale(fCameraAngle, u);
+			CSimdFloat fLightScale = Scale(fLightAngle, u);
+			fCameraOffset = fDepth * fCameraScale;
+			fTemp = fLightScale + fCameraScale;
+		}
+
+		// Initialize the scattering loop variables
+		CSimdFloat fSampleLength = fFar / u.fSamples;
+		CSimdFloat fScaledLength = fSampleLength * u.fScale;
+		CSimdFloat v3SampleRay[3], v3SamplePoint[3];
+		for(int i=0; i<3; i++)
+		{
+			v3SampleRay[i] = v3Ray[i] * fSampleLength;
+			v3SamplePoint[i] = v3Start[i] + v3SampleRay[i] * CSimdFloat(0.5f);
+		}
+
+		// Now loop through the sample rays
+		CSimdFloat v3FrontColor[3] = { CSimdFloat(0.0f), CSimdFloat(0.0f), CSimdFloat(0.0f) };
+		CSimdFloat v3Attenuate[3];
+		for(int s=0; s<u.nSamples; s++)
+		{
+			CSimdFloat fHeight = Sqrt(Dot(v3SamplePoint, v3SamplePoint));
+			CSimdFloat fDepth = Exp(u.fScaleOverScaleDepth * (u.fInnerRadius - fHeight));
+			CSimdFloat fScatter;
+			if(bSky)
+			{
+				CSimdFloat fInvHeight = CSimdFloat(1.0f) / fHeight;
+				CSimdFloat fLightAngle = Dot(u.v3LightPos, v3SamplePoint) * fInvHeight;
+				CSimdFloat fCameraAngle = Dot(v3Ray, v3SamplePoint) * fInvHeight;
+				fScatter = fStartOffset + fDepth * (Scale(fLightAngle, u) - Scale(fCameraAngle, u));
+			}
+			else
+				fScatter = fDepth * fTemp - fCameraOffset;
+			CSimdFloat fWeight = fDepth * fScaledLength;
+			for(int i=0; i<3; i++)
+			{
+				v3Attenuate[i] = Exp(-fScatter * u.v3Extinction[i]);
+				v3FrontColor[i] += v3Attenuate[i] * fWeight;
+				v3SamplePoint[i] += v3SampleRay[i];
+			}
+		}
+
+		// Finally, scale the Mie and Rayleigh colors
+		for(int i=0; i<3; i++)
+		{
+			if(bSky)
+			{
+				(v3FrontColor[i] * (u.v3InvWavelength[i] * u.fKrESun)).Store(pColor[i] + n);
+				(v3FrontColor[i] * u.fKmESun).Store(pSecondary[i] + n);
+			}
+			else
+			{
+				(v3FrontColor[i] * (u.v3InvWavelength[i] * u.fKrESun + u.fKmESun)).Store(pColor[i] + n);
+				(u.nSamples > 0 ? v3Attenuate[i] : CSimdFloat(1.0f)).Store(pSecondary[i] + n);
+			}
+		}
+	}
+
+
+	// The optical depth from a point to the top of the atmosphere, tabulated by
+	// height and the cosine of the ray's zenith angle. The light ray half of the
+	// inscatter integral needs it for every sample, so it is computed once.
+	class COpticalDepthTable
+	{
+	protected:
+		std::vector<float> m_vDepth;
+		int m_nSize;
+		float m_fInnerRadius;
+		float m_fHeightScale;
+
+	public:
+		COpticalDepthTable(const CScatteringParams &p, int nSize, int nSamples)
+		{
+			m_nSize = nSize;
+			m_fInnerRadius = p.m_fInnerRadius;
+			m_fHeightScale = (nSize - 1) / (p.m_fOuterRadius - p.m_fInnerRadius);
+			m_vDepth.resize(nSize * nSize);
+
+			float fScale = p.GetScale();
+			float fScaleOverScaleDepth = p.GetScaleOverScaleDepth();
+			for(int nCos=0; nCos<nSize; nCos++)
+			{
+				float fCos = 2.0f * nCos / (nSize - 1) - 1.0f;
+				float fSin = sqrtf((std::max)(0.0f, 1.0f - fCos*fCos));
+				for(int nHeight=0; nHeight<nSize; nHeight++)
+				{
+					float fHeight = p.m_fInnerRadius + nHeight / m_fHeightScale;
+					float fGround = fHeight*fHeight*(fCos*fCos - 1.0f) + p.m_fInnerRadius*p.m_fInnerRadius;
+					float fDepth = SHADOW_DEPTH;
+					if(fCos >= 0.0f || fGround < 0.0f)
+					{
+						float fFar = -fHeight*fCos + sqrtf(fHeight*fHeight*(fCos*fCos - 1.0f) + p.m_fOuterRadius*p.m_fOuterRadius);
+						float fSampleLength = fFar / nSamples;
+						fDepth = 0.0f;
+						for(int i=0; i<nSamples; i++)
+						{
+							float t = (i + 0.5f) * fSampleLength;
+							float x = fSin * t, y = fHeight + fCos * t;
+							fDepth += expf(fScaleOverScaleDepth * (p.m_fInnerRadius - sqrtf(x*x + y*y)));
+						}
+						fDepth *= fSampleLength * fScale;
+					}
+					m_vDepth[nCos*nSize + nHeight] = fDepth;
+				}
+			}
+		}
+
+		float Lookup(float fHeight, float fCos) const
+		{
+			float fX = (std::min)((std::max)((fHeight - m_fInnerRadius) * m_fHeightScale, 0.0f), m_nSize - 1.001f);
+			float fY = (std::min)((std::max)((fCos + 1.0f) * 0.5f * (m_nSize - 1), 0.0f), m_nSize - 1.001f);
+			int nX = (int)fX, nY = (int)fY;
+			fX -= nX;
+			fY -= nY;
+			const float *p = &m_vDepth[nY*m_nSize + nX];
+			return (p[0] * (1-fX) + p[1] * fX) * (1-fY) + (p[m_nSize] * (1-fX) + p[m_nSize+1] * fX) * fY;
+		}
+	};
+
+
+	template <int MODE>
+	void ScatterRange(const SUniforms &u, int nBegin, int nEnd, const float *pX, const float *pY, const float *pZ, float *pColor[3], float *pSecondary[3])
+	{
+		int nFull = nBegin + SIMD_ROUND_DOWN(nEnd - nBegin);
+		int n;
+		for(n=nBegin; n<nFull; n+=SIMD_WIDTH)
+			ScatterKernel<MODE>(u, pX, pY, pZ, pColor, pSecondary, n);
+		if(n == nEnd)
+			return;
+
+		// Pad the last partial batch by repeating its final vertex
+		float fX[SIMD_WIDTH], fY[SIMD_WIDTH], fZ[SIMD_WIDTH];
+		float fColor[3][SIMD_WIDTH], fSecondary[3][SIMD_WIDTH];
+		float *pTempColor[3] = { fColor[0], fColor[1], fColor[2] };
+		float *pTempSecondary[3] = { fSecondary[0], fSecondary[1], fSecondary[2] };
+		for(int i=0; i<SIMD_WIDTH; i++)
+		{
+			int nSrc = n + i < nEnd ? n + i : nEnd - 1;
+			fX[i] = pX[nSrc];
+			fY[i] = pY[nSrc];
+			fZ[i] = pZ[nSrc];
+		}
+		ScatterKernel<MODE>(u, fX, fY, fZ, pTempColor, pTempSecondary, 0);
+		for(int i=0; n+i<nEnd; i++)
+		{
+			for(int c=0; c<3; c++)
+			{
+				pColor[c][n+i] = fColor[c][i];
+				pSecondary[c][n+i] = fSecondary[c][i];
+			}
+		}
+	}
+
+}
+
+
+CScattering::Mode CScattering::GetSkyMode(const float *pCamera) const
+{
+	float fHeight = sqrtf(pCamera[0]*pCamera[0] + pCamera[1]*pCamera[1] + pCamera[2]*pCamera[2]);
+	return fHeight >= m_params.m_fOuterRadius ? SkyFromSpace : SkyFromAtmosphere;
+}
+
+CScattering::Mode CScattering::GetGroundMode(const float *pCamera) const
+{
+	float fHeight = sqrtf(pCamera[0]*pCamera[0] + pCamera[1]*pCamera[1] + pCamera[2]*pCamera[2]);
+	return fHeight >= m_params.m_fOuterRadius ? GroundFromSpace : GroundFromAtmosphere;
+}
+
+void CScattering::EvaluateRange(Mode nMode, const float *pCamera, const float *pLight, int nBegin, int nEnd,
+	const float *pX, const float *pY, const float *pZ, float *pColor[3], float *pSecondary[3]) const
+{
+	if(nEnd <= nBegin)
+		return;
+
+	SUniforms u;
+	u.Init(m_params, pCamera, pLight, m_nSamples);
+	switch(nMode)
+	{
+		case SkyFromSpace:
+			ScatterRange<SkyFromSpace>(u, nBegin, nEnd, pX, pY, pZ, pColor, pSecondary);
+			break;
+		case SkyFromAtmosphere:
+			ScatterRange<SkyFromAtmosphere>(u, nBegin, nEnd, pX, pY, pZ, pColor, pSecondary);
+			break;
+		case GroundFromSpace:
+			ScatterRange<GroundFromSpace>(u, nBegin, nEnd, pX, pY, pZ, pColor, pSecondary);
+			break;
+		case GroundFromAtmosphere:
+			ScatterRange<GroundFromAtmosphere>(u, nBegin, nEnd, pX, pY, pZ, pColor, pSecondary);
+			break;
+	}
+}
+
+void CScattering::Evaluate(Mode nMode, const float *pCamera, const float *pLight, int nCount,
+	const float *pX, const float *pY, const float *pZ, float *pColor[3], float *pSecondary[3]) const
+{
+	ThreadPool()->ParallelFor(0, nCount, BATCH_GRAIN, [&](int nBegin, int nEnd) {
+		EvaluateRange(nMode, pCamera, pLight, nBegin, nEnd, pX, pY, pZ, pColor, pSecondary);
+	});
+}
+
+void CScattering::MakeInscatterTable(float *pTable, int nR, int nMu, int nMuS, int nNu, int nSamples) const
+{
+	const CScatteringParams &p = m_params;
+	COpticalDepthTable tLight(p, 256, 64);
+	float fScale = p.GetScale();
+	float fScaleOverScaleDepth = p.GetScaleOverScaleDepth();
+	float fExtinction[3];
+	for(int c=0; c<3; c++)
+		fExtinction[c] = p.GetInvWavelength(c) * p.GetKr4PI() + p.GetKm4PI();
+
+	// Each row of constant altitude and view angle shares its sample points, only the light direction changes along it
+	int nRowSize = nMuS * nNu * 4;
+	ThreadPool()->ParallelFor(0, nR * nMu, 1, [&](int nBegin, int nEnd) {
+		std::vector<float> vX(nSamples), vY(nSamples), vHeight(nSamples), vWeight(nSamples), vCameraDepth(nSamples);
+		for(int nRow=nBegin; nRow<nEnd; nRow++)
+		{
+			// These mappings must match the texInscatter() functions in the LUT shaders.
+			// Altitude is stored as sqrt() of the height fraction, which puts more rows near the ground.
+			int nAltitude = nRow / nMu, nView = nRow % nMu;
+			float u = nAltitude / (float)(nR - 1);
+			float fHeight = (std::max)(p.m_fInnerRadius + u*u * (p.m_fOuterRadius - p.m_fInnerRadius), p.m_fInnerRadius + 1.0e-4f);
+			float fMu = 2.0f * nView / (nMu - 1) - 1.0f;
+			float fSinMu = sqrtf((std::max)(0.0f, 1.0f - fMu*fMu));
+
+			// The ray ends where it hits the ground or leaves the atmosphere
+			float fGround = fHeight*fHeight*(fMu*fMu - 1.0f) + p.m_fInnerRadius*p.m_fInnerRadius;
+			float fFar;
+			if(fMu < 0.0f && fGround >= 0.0f)
+				fFar = -fHeight*fMu - sqrtf(fGround);
+			else
+				fFar = -fHeight*fMu + sqrtf(fHeight*fHeight*(fMu*fMu - 1.0f) + p.m_fOuterRadius*p.m_fOuterRadius);
+
+			float fSampleLength = fFar / nSamples;
+			float fScaledLength = fSampleLength * fScale;
+			float fCameraDepth = 0.0f;
+			for(int i=0; i<nSamples; i++)
+			{
+				float t = (i + 0.5f) * fSampleLength;
+				vX[i] = fSinMu * t;
+				vY[i] = fHeight + fMu * t;
+				vHeight[i] = sqrtf(vX[i]*vX[i] + vY[i]*vY[i]);
+				vWeight[i] = expf(fScaleOverScaleDepth * (p.m_fInnerRadius - vHeight[i])) * fScaledLength;
+				vCameraDepth[i] = fCameraDepth + 0.5f * vWeight[i];
+				fCameraDepth += vWeight[i];
+			}
+
+			float *pTexel = pTable + nRow * nRowSize;
+			for(int nSlice=0; nSlice<nNu; nSlice++)
+			{
+				float fNu = 2.0f * nSlice / (nNu - 1) - 1.0f;
+				for(int nLight=0; nLight<nMuS; nLight++)
+				{
+					// Find a light direction with the requested zenith cosine and angle to the view ray
+					float fMuS = 2.0f * nLight / (nMuS - 1) - 1.0f;
+					float fSinMuS = sqrtf((std::max)(0.0f, 1.0f - fMuS*fMuS));
+					float fLightX = fSinMu > 1.0e-4f ? (fNu - fMu*fMuS) / fSinMu : 0.0f;
+					fLightX = (std::min)((std::max)(fLightX, -fSinMuS), fSinMuS);
+
+					float fColor[3] = { 0.0f, 0.0f, 0.0f };
+					for(int i=0; i<nSamples; i++)
+					{
+						float fLightAngle = (vX[i]*fLightX + vY[i]*fMuS) / vHeight[i];
+						float fScatter = vCameraDepth[i] + tLight.Lookup(vHeight[i], fLightAngle);
+						for(int c=0; c<3; c++)
+							fColor[c] += expf(-fScatter * fExtinction[c]) * vWeight[i];
+					}
+					*pTexel++ = fColor[0];
+					*pTexel++ = fColor[1];
+					*pTexel++ = fColor[2];
+					*pTexel++ = fCameraDepth;
+				}
+			}
+		}
+	});
+}
@@ -0,0 +1,123 @@
+// CPU implementation of the per-vertex atmospheric scattering shaders.
+//
+// Author:  Tim Finer
+// Email:   tfiner@csu.fullerton.edu
+//
+// CPSC-597 Fall 2015 Master's Project
+//
+
+#ifndef __Scattering_h__
+#define __Scattering_h__
+
+#include <math.h>
+
+
+// The scale() function from the shaders. It is O'Neil's polynomial fit of the
+// optical depth from a point at sea level along a ray with the given cosine.
+inline float ScatteringScale(float fCos, float fScaleDepth)
+{
+	float x = 1.0f - fCos;
+	return fScaleDepth * expf(-0.00287f + x*(0.459f + x*(3.83f + x*(-6.80f + x*5.25f))));
+}
+
+
+/*******************************************************************************
+* Class: CScatteringParams
+********************************************************************************
+* The atmosphere constants shared by all of the scattering shaders. These are
+* the same values CGameEngine keeps in its m_Kr, m_Km, m_ESun, etc. members.
+* The derived values the shaders take as uniforms are computed on demand.
+*******************************************************************************/
+class CScatteringParams
+{
+public:
+	float m_fInnerRadius;		// The planet's radius
+	float m_fOuterRadius;		// The radius of the top of the atmosphere
+	float m_fScaleDepth;		// The Rayleigh scale depth, as a fraction of the atmosphere's thickness
+	float m_Kr;					// Rayleigh scattering constant
+	float m_Km;					// Mie scattering constant
+	float m_ESun;				// Sun brightness constant
+	float m_g;					// The Mie phase asymmetry factor
+	float m_fWavelength4[3];	// pow(wavelength, 4) for the red, green, and blue channels
+
+	CScatteringParams()
+	{
+		m_fInnerRadius = 10.0f;
+		m_fOuterRadius = 10.25f;
+		m_fScaleDepth = 0.25f;
+		m_Kr = 0.0025f;
+		m_Km = 0.0010f;
+		m_ESun = 20.0f;
+		m_g = -0.990f;
+		m_fWavelength4[0] = powf(0.650f, 4.0f);
+		m_fWavelength4[1] = powf(0.570f, 4.0f);
+		m_fWavelength4[2] = powf(0.475f, 4.0f);
+	}
+
+	float GetScale() const					{ return 1.0f / (m_fOuterRadius - m_fInnerRadius); }
+	float GetScaleOverScaleDepth() const	{ return GetScale() / m_fScaleDepth; }
+	float GetKr4PI() const					{ return m_Kr * 4.0f * 3.14159f; }
+	float GetKm4PI() const					{ return m_Km * 4.0f * 3.14159f; }
+	float GetInvWavelength(int i) const		{ return 1.0f / m_fWavelength4[i]; }
+};
+
+
+/*******************************************************************************
+* Class: CScattering
+********************************************************************************
+* Evaluates the Sky/Ground From Space/Atmosphere vertex shaders on the CPU for
+* a batch of vertices, so the sky can be computed and profiled without a GL
+* context. Positions come in as structure-of-arrays, and results go out the
+* same way: pColor[0..2] receives what the shader writes to gl_FrontColor and
+* pSecondary[0..2] what it writes to gl_FrontSecondaryColor. For the sky that
+* is the Rayleigh and (pre-phase) Mie colors, for the ground the in-scattered
+* color and the attenuation of the ground's own color.
+*
+* Vertices are processed SIMD_WIDTH at a time, and Evaluate() splits large
+* batches across the worker threads in CThreadPool::GetMain().
+*******************************************************************************/
+class CScattering
+{
+public:
+	enum Mode { SkyFromSpace, SkyFromAtmosphere, GroundFromSpace, GroundFromAtmosphere };
+
+protected:
+	CScatteringParams m_params;
+	int m_nSamples;
+
+public:
+	CScattering(const CScatteringParams &params, int nSamples=2)
+	{
+		m_params = params;
+		m_nSamples = nSamples;
+	}
+
+	const CScatteringParams &GetParams() const		{ return m_params; }
+	void SetParams(const CScatteringParams &params)	{ m_params = params; }
+	int GetSamples() const							{ return m_nSamples; }
+	void SetSamples(int nSamples)					{ m_nSamples = nSamples; }
+
+	// The shaders pick a mode from the camera height, this does the same
+	Mode GetSkyMode(const float *pCamera) const;
+	Mode GetGroundMode(const float *pCamera) const;
+
+	// pCamera is the camera position, pLight the unit direction to the light
+	void Evaluate(Mode nMode, const float *pCamera, const float *pLight, int nCount,
+		const float *pX, const float *pY, const float *pZ, float *pColor[3], float *pSecondary[3]) const;
+
+	// Same as Evaluate(), but only for vertices [nBegin, nEnd) on the calling thread
+	void EvaluateRange(Mode nMode, const float *pCamera, const float *pLight, int nBegin, int nEnd,
+		const float *pX, const float *pY, const float *pZ, float *pColor[3], float *pSecondary[3]) const;
+
+	// Builds the single scattering table sampled by SkyLUT.vert and GroundLUT.vert
+	// in place of their ray march. pTable receives nMuS*nNu x nMu x nR RGBA texels
+	// (x, y, z order, as a 3D texture). Along x are nNu slices of the cosine of
+	// the angle between the view ray and the light, each holding nMuS light zenith
+	// cosines. y is the view zenith cosine and z the altitude. RGB holds
+	// v3FrontColor for a ray from that point to the ground or the top of the
+	// atmosphere, and A the optical depth along the ray. nSamples is the ray
+	// march's sample count, so it only affects build time, never render time.
+	void MakeInscatterTable(float *pTable, int nR, int nMu, int nMuS, int nNu, int nSamples) const;
+};
+
+#endif // __Scattering_h__
@@ -0,0 +1,394 @@
+// Thin SIMD wrapper for the CPU-side batch kernels.
+//
+// Author:  Tim Finer
+// Email:   tfiner@csu.fullerton.edu
+//
+// CPSC-597 Fall 2015 Master's Project
+//
+
+#ifndef __Simd_h__
+#define __Simd_h__
+
+// The kernels are written once against CSimdFloat. It is 8 lanes wide when the
+// compiler targets AVX2 (/arch:AVX2 or -mavx2) and 4 lanes of SSE2 otherwise.
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define SIMD_WIDTH			8
+#else
+#include <emmintrin.h>
+#define SIMD_WIDTH			4
+#endif
+
+#define SIMD_ROUND_DOWN(n)	((n) & ~(SIMD_WIDTH-1))
+
+
+/*******************************************************************************
+* Class: CSimdFloat
+********************************************************************************
+* SIMD_WIDTH floats processed together. Comparisons return an all-ones/all-zeros
+* lane mask that can be fed to Select(). Arguments are passed by reference
+* because 32-bit MSVC cannot pass more than three aligned vectors by value.
+*******************************************************************************/
+class CSimdFloat
+{
+public:
+#if defined(__AVX2__)
+	__m256 m;
+	CSimdFloat()								{}
+	CSimdFloat(const __m256 &v) : m(v)			{}
+	explicit CSimdFloat(float f)				{ m = _mm256_set1_ps(f); }
+
+	static CSimdFloat Load(const float *p)		{ return _mm256_loadu_ps(p); }
+	void Store(float *p) const					{ _mm256_storeu_ps(p, m); }
+
+	CSimdFloat operator+(const CSimdFloat &v) const	{ return _mm256_add_ps(m, v.m); }
+	CSimdFloat operator-(const CSimdFloat &v) const	{ return _mm256_sub_ps(m, v.m); }
+	CSimdFloat operator*(const CSimdFloat &v) const	{ return _mm256_mul_ps(m, v.m); }
+	CSimdFloat operator/(const CSimdFloat &v) const	{ return _mm256_div_ps(m, v.m); }
+	CSimdFloat operator-() const					{ return _mm256_xor_ps(m, _mm256_set1_ps(-0.0f)); }
+	CSimdFloat operator&(const CSimdFloat &v) const	{ return _mm256_and_ps(m, v.m); }
+	CSimdFloat operator|(const CSimdFloat &v) const	{ return _mm256_or_ps(m, v.m); }
+	CSimdFloat operator<(const CSimdFloat &v) const	{ return _mm256_cmp_ps(m, v.m, _CMP_LT_OQ); }
+	CSimdFloat operator<=(const CSimdFloat &v) const	{ return _mm256_cmp_ps(m, v.m, _CMP_LE_OQ); }
+	CSimdFloat operator>(const CSimdFloat &v) const	{ return _mm256_cmp_ps(m, v.m, _CMP_GT_OQ); }
+	CSimdFloat operator>=(const CSimdFloat &v) const	{ return _mm256_cmp_ps(m, v.m, _CMP_GE_OQ); }
+	int Mask() const							{ return _mm256_movemask_ps(m); }
+#else
+	__m128 m;
+	CSimdFloat()								{}
+	CSimdFloat(const __m128 &v) : m(v)			{}
+	explicit CSimdFloat(float f)				{ m = _mm_set1_ps(f); }
+
+	static CSimdFloat Load(const float *p)		{ return _mm_loadu_ps(p); }
+	void Store(float *p) const					{ _mm_storeu_ps(p, m); }
+
+	CSimdFloat operator+(const CSimdFloat &v) const	{ return _mm_add_ps(m, v.m); }
+	CSimdFloat operator-(const CSimdFloat &v) const	{ return _mm_sub_ps(m, v.m); }
+	CSimdFloat operator*(const CSimdFloat &v) const	{ return _mm_mul_ps(m, v.m); }
+	CSimdFloat operator/(const CSimdFloat &v) const	{ return _mm_div_ps(m, v.m); }
+	CSimdFloat operator-() const					{ return _mm_xor_ps(m, _mm_set1_ps(-0.0f)); }
+	CSimdFloat operator&(const CSimdFloat &v) const	{ return _mm_and_ps(m, v.m); }
+	CSimdFloat operator|(const CSimdFloat &v) const	{ return _mm_or_ps(m, v.m); }
+	CSimdFloat operator<(const CSimdFloat &v) const	{ return _mm_cmplt_ps(m, v.m); }
+	CSimdFloat operator<=(const CSimdFloat &v) const	{ return _mm_cmple_ps(m, v.m); }
+	CSimdFloat operator>(const CSimdFloat &v) const	{ return _mm_cmpgt_ps(m, v.m); }
+	CSimdFloat operator>=(const CSimdFloat &v) const	{ return _mm_cmpge_ps(m, v.m); }
+	int Mask() const							{ return _mm_movemask_ps(m); }
+#endif
+
+	CSimdFloat &operator+=(const CSimdFloat &v)	{ *this = *this + v; return *this; }
+	CSimdFloat &operator-=(const CSimdFloat &v)	{ *this = *this - v; return *this; }
+	CSimdFloat &operator*=(const CSimdFloat &v)	{ *this = *this * v; return *this; }
+};
+
+#if defined(__AVX2__)
+inline CSimdFloat Sqrt(const CSimdFloat &v)								{ return _mm256_sqrt_ps(v.m); }
+inline CSimdFloat Min(const CSimdFloat &a, const CSimdFloat &b)			{ return _mm256_min_ps(a.m, b.m); }
+inline CSimdFloat Max(const CSimdFloat &a, const CSimdFloat &b)			{ return _mm256_max_ps(a.m, b.m); }
+inline CSimdFloat Floor(const CSimdFloat &v)							{ return _mm256_floor_ps(v.m); }
+inline CSimdFloat Select(const CSimdFloat &mask, const CSimdFloat &a, const CSimdFloat &b)	{ return _mm256_blendv_ps(b.m, a.m, mask.m); }
+
+// 2^n for integral n stored in a float, by building the exponent bits directly
+inline CSimdFloat Pow2i(const CSimdFloat &n)
+{
+	__m256i i = _mm256_add_epi32(_mm256_cvttps_epi32(n.m), _mm256_set1_epi32(127));
+	return _mm256_castsi256_ps(_mm256_slli_epi32(i, 23));
+}
+#else
+inline CSimdFloat Sqrt(const CSimdFloat &v)								{ return _mm_sqrt_ps(v.m); }
+inline CSimdFloat Min(const CSimdFloat &a, const CSimdFloat &b)			{ return _mm_min_ps(a.m, b.m); }
+inline CSimdFloat Max(const CSimdFloat &a, const CSimdFloat &b)			{ return _mm_max_ps(a.m, b.m); }
+inline CSimdFloat Select(const CSimdFloat &mask, const CSimdFloat &a, const CSimdFloat &b)	{ return _mm_or_ps(_mm_and_ps(mask.m, a.m), _mm_andnot_ps(mask.m, b.m)); }
+
+// SSE2 has no floor instruction: truncate, then step down where that rounded up
+inline CSimdFloat Floor(const CSimdFloat &v)
+{
+	CSimdFloat t = _mm_cvtepi32_ps(_mm_cvttps_epi32(v.m));
+	return t - (CSimdFloat(1.0f) & (v < t));
+}
+
+inline CSimdFloat Pow2i(const CSimdFloat &n)
+{
+	__m128i i = _mm_add_epi32(_mm_cvttps_epi32(n.m), _mm_set1_epi32(127));
+	return _mm_castsi128_ps(_mm_slli_epi32(i, 23));
+}
+#endif
+
+inline CSimdFloat Abs(const CSimdFloat &v)		{ return Max(v, -v); }
+
+
+/*******************************************************************************
+* Class: CSimdInt
+********************************************************************************
+* SIMD_WIDTH 32-bit integers, just enough of them to build table indices and
+* fetch through them with Gather(). AVX2 has real gather instructions; SSE2
+* fetches each lane on its own.
+*******************************************************************************/
+class CSimdInt
+{
+public:
+#if defined(__AVX2__)
+	__m256i m;
+	CSimdInt()									{}
+	CSimdInt(const __m256i &v) : m(v)			{}
+	explicit CSimdInt(int n)					{ m = _mm256_set1_epi32(n); }
+
+	void Store(int *p) const					{ _mm256_storeu_si256((__m256i *)p, m); }
+
+	CSimdInt operator+(const CSimdInt &v) const	{ return _mm256_add_epi32(m, v.m); }
+	CSimdInt operator-(const CSimdInt &v) const	{ return _mm256_sub_epi32(m, v.m); }
+	CSimdInt operator&(const CSimdInt &v) const	{ return _mm256_and_si256(m, v.m); }
+	CSimdInt operator|(const CSimdInt &v) const	{ return _mm256_or_si256(m, v.m); }
+	CSimdInt operator<<(int n) const			{ return _mm256_slli_epi32(m, n); }
+	CSimdInt operator>>(int n) const			{ return _mm256_srli_epi32(m, n); }
+#else
+	__m128i m;
+	CSimdInt()									{}
+	CSimdInt(const __m128i &v) : m(v)			{}
+	explicit CSimdInt(int n)					{ m = _mm_set1_epi32(n); }
+
+	void Store(int *p) const					{ _mm_storeu_si128((__m128i *)p, m); }
+
+	CSimdInt operator+(const CSimdInt &v) const	{ return _mm_add_epi32(m, v.m); }
+	CSimdInt operator-(const CSimdInt &v) const	{ return _mm_sub_epi32(m, v.m); }
+	CSimdInt operator&(const CSimdInt &v) const	{ return _mm_and_si128(m, v.m); }
+	CSimdInt operator|(const CSimdInt &v) const	{ return _mm_or_si128(m, v.m); }
+	CSimdInt operator<<(int n) const			{ return _mm_slli_epi32(m, n); }
+	CSimdInt operator>>(int n) const			{ return _mm_srli_epi32(m, n); }
+#endif
+};
+
+
+/*******************************************************************************
+* Class: CSimdTexel
+********************************************************************************
+* RGBA texels with their four channels side by side, for kernels that work
+* through the lanes a texel at a time and only transpose their results into
+* CSimdFloats at the end. SSE2 holds lane k's texel; AVX2 holds lane k's and
+* lane k+4's in its two halves, so four of them always cover every lane.
+*******************************************************************************/
+class CSimdTexel
+{
+public:
+#if defined(__AVX2__)
+	__m256 m;
+	CSimdTexel()								{}
+	CSimdTexel(const __m256 &v) : m(v)			{}
+
+	// The texels at p[k] + n (and p[k+4] + n), with bytes widened to floats
+	static CSimdTexel Load(const float *const *p, int k, int n=0)	{ return _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(p[k] + n)), _mm_loadu_ps(p[k+4] + n), 1); }
+	static CSimdTexel Load(const unsigned char *const *p, int k, int n=0)
+	{
+		__m128i i = _mm_unpacklo_epi32(_mm_cvtsi32_si128(*(const int *)(p[k] + n)), _mm_cvtsi32_si128(*(const int *)(p[k+4] + n)));
+		return _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(i));
+	}
+	// Lane k's value (and lane k+4's) in every channel
+	static CSimdTexel Broadcast(const CSimdFloat &v, int k)	{ return _mm256_permutevar_ps(v.m, _mm256_set1_epi32(k)); }
+
+	CSimdTexel operator+(const CSimdTexel &v) const	{ return _mm256_add_ps(m, v.m); }
+	CSimdTexel operator-(const CSimdTexel &v) const	{ return _mm256_sub_ps(m, v.m); }
+	CSimdTexel operator*(const CSimdTexel &v) const	{ return _mm256_mul_ps(m, v.m); }
+#else
+	__m128 m;
+	CSimdTexel()								{}
+	CSimdTexel(const __m128 &v) : m(v)			{}
+
+	static CSimdTexel Load(const float *const *p, int k, int n=0)	{ return _mm_loadu_ps(p[k] + n); }
+	static CSimdTexel Load(const unsigned char *const *p, int k, int n=0)
+	{
+		const __m128i nZero = _mm_setzero_si128();
+		__m128i i = _mm_unpacklo_epi8(_mm_cvtsi32_si128(*(const int *)(p[k] + n)), nZero);
+		return _mm_cvtepi32_ps(_mm_unpacklo_epi16(i, nZero));
+	}
+	static CSimdTexel Broadcast(const CSimdFloat &v, int k)
+	{
+		float f[4];
+		v.Store(f);
+		return _mm_set1_ps(f[k]);
+	}
+
+	CSimdTexel operator+(const CSimdTexel &v) const	{ return _mm_add_ps(m, v.m); }
+	CSimdTexel operator-(const CSimdTexel &v) const	{ return _mm_sub_ps(m, v.m); }
+	CSimdTexel operator*(const CSimdTexel &v) const	{ return _mm_mul_ps(m, v.m); }
+#endif
+};
+
+#if defined(__AVX2__)
+// Truncates toward zero, so Floor() first for the integer part
+inline CSimdInt ToInt(const CSimdFloat &v)							{ return _mm256_cvttps_epi32(v.m); }
+inline CSimdFloat ToFloat(const CSimdInt &v)						{ return _mm256_cvtepi32_ps(v.m); }
+inline CSimdInt Select(const CSimdFloat &mask, const CSimdInt &a, const CSimdInt &b)	{ return _mm256_blendv_epi8(b.m, a.m, _mm256_castps_si256(mask.m)); }
+inline CSimdInt AsInt(const CSimdFloat &v)							{ return _mm256_castps_si256(v.m); }
+inline CSimdFloat AsFloat(const CSimdInt &v)						{ return _mm256_castsi256_ps(v.m); }
+inline CSimdFloat Gather(const float *p, const CSimdInt &i)			{ return _mm256_i32gather_ps(p, i.m, 4); }
+inline CSimdInt Gather(const int *p, const CSimdInt &i)				{ return _mm256_i32gather_epi32(p, i.m, 4); }
+
+// The low 16 bits of each lane. Sign extending them first lets the saturating pack keep them as they are.
+inline void StoreShort(unsigned short *p, const CSimdInt &v)
+{
+	__m256i n = _mm256_srai_epi32(_mm256_slli_epi32(v.m, 16), 16);
+	n = _mm256_permute4x64_epi64(_mm256_packs_epi32(n, n), _MM_SHUFFLE(3, 1, 2, 0));
+	_mm_storeu_si128((__m128i *)p, _mm256_castsi256_si128(n));
+}
+
+// Bytes widened to ints. Each lane gathers the aligned dword holding its byte
+// and shifts the byte down, so nothing past the dword with the last byte is read.
+inline CSimdInt Gather(const unsigned char *p, const CSimdInt &i)
+{
+	int nMisalign = (int)((size_t)p & 3);
+	__m256i nByte = _mm256_add_epi32(i.m, _mm256_set1_epi32(nMisalign));
+	__m256i nWord = _mm256_i32gather_epi32((const int *)(p - nMisalign), _mm256_srli_epi32(nByte, 2), 4);
+	__m256i nShift = _mm256_slli_epi32(_mm256_and_si256(nByte, _mm256_set1_epi32(3)), 3);
+	return _mm256_and_si256(_mm256_srlv_epi32(nWord, nShift), _mm256_set1_epi32(0xFF));
+}
+
+// Four CSimdTexels transposed so v[j] holds channel j of every lane
+inline void Transpose4(const CSimdTexel *t, CSimdFloat *v)
+{
+	__m256 a = t[0].m, b = t[1].m, c = t[2].m, d = t[3].m;
+	__m256 ab0 = _mm256_unpacklo_ps(a, b), cd0 = _mm256_unpacklo_ps(c, d);
+	__m256 ab1 = _mm256_unpackhi_ps(a, b), cd1 = _mm256_unpackhi_ps(c, d);
+	v[0] = _mm256_shuffle_ps(ab0, cd0, _MM_SHUFFLE(1, 0, 1, 0));
+	v[1] = _mm256_shuffle_ps(ab0, cd0, _MM_SHUFFLE(3, 2, 3, 2));
+	v[2] = _mm256_shuffle_ps(ab1, cd1, _MM_SHUFFLE(1, 0, 1, 0));
+	v[3] = _mm256_shuffle_ps(ab1, cd1, _MM_SHUFFLE(3, 2, 3, 2));
+}
+
+// p[i[k]] in v[0] and p[i[k]+1] in v[1] for each lane k. The two ints next to
+// each other come in with one 64-bit gather, so a row of two texels costs one fetch.
+inline void GatherPair(const int *p, const CSimdInt &i, CSimdInt *v)
+{
+	__m256 a = _mm256_castsi256_ps(_mm256_i32gather_epi64((const long long *)p, _mm256_castsi256_si128(i.m), 4));
+	__m256 b = _mm256_castsi256_ps(_mm256_i32gather_epi64((const long long *)p, _mm256_extracti128_si256(i.m, 1), 4));
+	__m256 lo = _mm256_permute2f128_ps(a, b, 0x20), hi = _mm256_permute2f128_ps(a, b, 0x31);
+	v[0] = _mm256_castps_si256(_mm256_shuffle_ps(lo, hi, _MM_SHUFFLE(2, 0, 2, 0)));
+	v[1] = _mm256_castps_si256(_mm256_shuffle_ps(lo, hi, _MM_SHUFFLE(3, 1, 3, 1)));
+}
+#else
+inline CSimdInt ToInt(const CSimdFloat &v)							{ return _mm_cvttps_epi32(v.m); }
+inline CSimdFloat ToFloat(const CSimdInt &v)						{ return _mm_cvtepi32_ps(v.m); }
+inline CSimdInt AsInt(const CSimdFloat &v)							{ return _mm_castps_si128(v.m); }
+inline CSimdFloat AsFloat(const CSimdInt &v)						{ return _mm_castsi128_ps(v.m); }
+
+inline CSimdInt Select(const CSimdFloat &mask, const CSimdInt &a, const CSimdInt &b)
+{
+	__m128i i = _mm_castps_si128(mask.m);
+	return _mm_or_si128(_mm_and_si128(i, a.m), _mm_andnot_si128(i, b.m));
+}
+
+inline CSimdFloat Gather(const float *p, const CSimdInt &i)
+{
+	int n[4];
+	_mm_storeu_si128((__m128i *)n, i.m);
+	return _mm_setr_ps(p[n[0]], p[n[1]], p[n[2]], p[n[3]]);
+}
+
+inline CSimdInt Gather(const int *p, const CSimdInt &i)
+{
+	int n[4];
+	_mm_storeu_si128((__m128i *)n, i.m);
+	return _mm_setr_epi32(p[n[0]], p[n[1]], p[n[2]], p[n[3]]);
+}
+
+inline void StoreShort(unsigned short *p, const CSimdInt &v)
+{
+	__m128i n = _mm_srai_epi32(_mm_slli_epi32(v.m, 16), 16);
+	_mm_storel_epi64((__m128i *)p, _mm_packs_epi32(n, n));
+}
+
+inline CSimdInt Gather(const unsigned char *p, const CSimdInt &i)
+{
+	int n[4];
+	_mm_storeu_si128((__m128i *)n, i.m);
+	return _mm_setr_epi32(p[n[0]], p[n[1]], p[n[2]], p[n[3]]);
+}
+
+inline void Transpose4(const CSimdTexel *t, CSimdFloat *v)
+{
+	__m128 a = t[0].m, b = t[1].m, c = t[2].m, d = t[3].m;
+	_MM_TRANSPOSE4_PS(a, b, c, d);
+	v[0] = a;
+	v[1] = b;
+	v[2] = c;
+	v[3] = d;
+}
+
+inline void GatherPair(const int *p, const CSimdInt &i, CSimdInt *v)
+{
+	int n[4];
+	_mm_storeu_si128((__m128i *)n, i.m);
+	__m128 a = _mm_castsi128_ps(_mm_unpacklo_epi64(_mm_loadl_epi64((const __m128i *)(p + n[0])), _mm_loadl_epi64((const __m128i *)(p + n[1]))));
+	__m128 b = _mm_castsi128_ps(_mm_unpacklo_epi64(_mm_loadl_epi64((const __m128i *)(p + n[2])), _mm_loadl_epi64((const __m128i *)(p + n[3]))));
+	v[0] = _mm_castps_si128(_mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0)));
+	v[1] = _mm_castps_si128(_mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1)));
+}
+#endif
+
+// The 4 floats at p + i[k] for each lane k, transposed so v[j] holds float j
+// of every lane. An RGBA texel costs one load instead of four gathered lanes.
+inline void Gather4(const float *p, const CSimdInt &i, CSimdFloat *v)
+{
+	int n[SIMD_WIDTH];
+	i.Store(n);
+	const float *pTexel[SIMD_WIDTH];
+	for(int k=0; k<SIMD_WIDTH; k++)
+		pTexel[k] = p + n[k];
+	CSimdTexel t[4];
+	for(int k=0; k<4; k++)
+		t[k] = CSimdTexel::Load(pTexel, k);
+	Transpose4(t, v);
+}
+
+inline void GatherPair(const float *p, const CSimdInt &i, CSimdFloat *v)
+{
+	CSimdInt n[2];
+	GatherPair((const int *)p, i, n);
+	v[0] = AsFloat(n[0]);
+	v[1] = AsFloat(n[1]);
+}
+
+// IEEE half floats, rounded to nearest even like F16C's _mm_cvtps_ph(). The
+// exponent is rebiased and the 13 dropped mantissa bits rounded with integer
+// adds; values too small for a normal half are shifted into a denormal by
+// adding them to 0.5f and letting the float add do the rounding.
+inline CSimdInt ToHalf(const CSimdFloat &v)
+{
+	CSimdInt nAbs = AsInt(v) & CSimdInt(0x7FFFFFFF);
+	CSimdFloat fAbs = AsFloat(nAbs);
+	CSimdInt nNormal = (nAbs + CSimdInt(-(112 << 23) + 0xFFF) + ((nAbs >> 13) & CSimdInt(1))) >> 13;
+	CSimdInt nDenormal = AsInt(fAbs + CSimdFloat(0.5f)) - AsInt(CSimdFloat(0.5f));
+	CSimdInt nHalf = Select(fAbs < CSimdFloat(6.103515625e-5f), nDenormal, nNormal);
+	nHalf = Select(fAbs < CSimdFloat(65536.0f), nHalf, Select(fAbs >= CSimdFloat(65536.0f), CSimdInt(0x7C00), CSimdInt(0x7E00)));
+	return nHalf | ((AsInt(v) >> 16) & CSimdInt(0x8000));
+}
+
+// F16C comes with every AVX2 CPU, but GCC and Clang only use it with -mf16c
+inline void StoreHalf(unsigned short *p, const CSimdFloat &v)
+{
+#if defined(__AVX2__) && (defined(__F16C__) || defined(_MSC_VER))
+	_mm_storeu_si128((__m128i *)p, _mm256_cvtps_ph(v.m, _MM_FROUND_TO_NEAREST_INT));
+#else
+	StoreShort(p, ToHalf(v));
+#endif
+}
+
+// Cephes-style expf: range reduction to [-ln2/2, ln2/2] and a degree 5
+// polynomial. Relative error is within a couple of ulps of expf() over the
+// whole float range, which is plenty for optical depth and scattering sums.
+inline CSimdFloat Exp(const CSimdFloat &x)
+{
+	CSimdFloat v = Min(Max(x, CSimdFloat(-87.3f)), CSimdFloat(88.3f));
+	CSimdFloat n = Floor(v * CSimdFloat(1.44269504088896341f) + CSimdFloat(0.5f));
+	v = v - n * CSimdFloat(0.693359375f) - n * CSimdFloat(-2.12194440e-4f);
+
+	CSimdFloat y = CSimdFloat(1.9875691500e-4f);
+	y = y * v + CSimdFloat(1.3981999507e-3f);
+	y = y * v + CSimdFloat(8.3334519073e-3f);
+	y = y * v + CSimdFloat(4.1665795894e-2f);
+	y = y * v + CSimdFloat(1.6666665459e-1f);
+	y = y * v + CSimdFloat(5.0000001201e-1f);
+	y = y * v * v + v + CSimdFloat(1.0f);
+	return y * Pow2i(n);
+}
+
+#endif // __Simd_h__
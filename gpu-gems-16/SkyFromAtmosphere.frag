@@ -6,9 +6,7 @@
 // Copyright (c) 2004 Sean O'Neil
 //
 
-uniform vec3 v3LightPos;
-uniform float g;
-uniform float g2;
+#include "Atmosphere.glsl"
 
 varying vec3 v3Direction;
 
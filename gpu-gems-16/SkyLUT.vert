@@ -0,0 +1,62 @@
+//
+// Atmospheric scattering vertex shader, precomputed inscatter table version.
+// Replaces the sample loop of SkyFromSpace.vert and SkyFromAtmosphere.vert
+// with two fetches from the table built by CScattering::MakeInscatterTable().
+//
+// Author:  Tim Finer
+// Email:   tfiner@csu.fullerton.edu
+//
+
+#include "Atmosphere.glsl"
+
+uniform sampler3D s3Inscatter;	// The inscatter table
+uniform vec4 v4InscatterSize;	// The table's altitude, view, light and view-light resolutions
+
+varying vec3 v3Direction;
+
+
+// Looks up v3FrontColor (rgb) and the optical depth (a) for a ray leaving
+// v3Start. The mappings must match CScattering::MakeInscatterTable().
+vec4 texInscatter(vec3 v3Start, vec3 v3Ray)
+{
+	float fHeight = length(v3Start);
+	float fMu = dot(v3Ray, v3Start) / fHeight;
+	float fMuS = dot(v3LightPos, v3Start) / fHeight;
+	float fNu = dot(v3Ray, v3LightPos);
+
+	float uR = sqrt(clamp((fHeight - fInnerRadius) * fScale, 0.0, 1.0));
+	vec3 v3Coord;
+	v3Coord.y = (0.5 * (fMu + 1.0) * (v4InscatterSize.y - 1.0) + 0.5) / v4InscatterSize.y;
+	v3Coord.z = (uR * (v4InscatterSize.x - 1.0) + 0.5) / v4InscatterSize.x;
+	float fMuSCoord = (0.5 * (fMuS + 1.0) * (v4InscatterSize.z - 1.0) + 0.5) / v4InscatterSize.z;
+
+	// The view-light angle slices sit side by side along x, so blend the two nearest by hand
+	float fSlice = 0.5 * (fNu + 1.0) * (v4InscatterSize.w - 1.0);
+	float fSliceFloor = min(floor(fSlice), v4InscatterSize.w - 2.0);
+	v3Coord.x = (fSliceFloor + fMuSCoord) / v4InscatterSize.w;
+	vec4 v4Inscatter = texture3D(s3Inscatter, v3Coord);
+	v3Coord.x = (fSliceFloor + 1.0 + fMuSCoord) / v4InscatterSize.w;
+	return mix(v4Inscatter, texture3D(s3Inscatter, v3Coord), fSlice - fSliceFloor);
+}
+
+void main(void)
+{
+	// Get the ray from the camera to the vertex
+	vec3 v3Pos = gl_Vertex.xyz;
+	vec3 v3Ray = normalize(v3Pos - v3CameraPos);
+
+	// Start where the ray enters the atmosphere, or at the camera if it is already inside
+	float B = 2.0 * dot(v3CameraPos, v3Ray);
+	float C = fCameraHeight2 - fOuterRadius2;
+	float fDet = max(0.0, B*B - 4.0 * C);
+	float fNear = max(0.0, 0.5 * (-B - sqrt(fDet)));
+	vec3 v3Start = v3CameraPos + v3Ray * fNear;
+
+	vec3 v3FrontColor = texInscatter(v3Start, v3Ray).rgb;
+
+	// Finally, scale the Mie and Rayleigh colors and set up the varying variables for the pixel shader
+	gl_FrontSecondaryColor.rgb = v3FrontColor * fKmESun;
+	gl_FrontColor.rgb = v3FrontColor * (v3InvWavelength * fKrESun);
+	gl_Position = gl_ModelViewProjectionMatrix * gl_Vertex;
+	v3Direction = v3CameraPos - v3Pos;
+}
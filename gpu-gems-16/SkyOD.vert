@@ -0,0 +1,79 @@
+//
+// Atmospheric scattering vertex shader, optical depth table version.
+// Does the same work as SkyFromSpace.vert and SkyFromAtmosphere.vert, but looks
+// separate Rayleigh and Mie optical depths up in the table built by
+// CPixelBuffer::MakeOpticalDepthBuffer() instead of calling scale(), so it
+// holds for any radii and scale depths.
+//
+// Author:  Tim Finer
+// Email:   tfiner@csu.fullerton.edu
+//
+
+#include "Atmosphere.glsl"
+
+uniform sampler2D s2OpticalDepth;	// The optical depth table
+uniform float fOpticalDepthSize;	// The table's width and height
+
+const int nSamples = 2;
+const float fSamples = 2.0;
+
+varying vec3 v3Direction;
+
+
+// Returns the Rayleigh density (r), Rayleigh optical depth (g), Mie density (b)
+// and Mie optical depth (a) for a point at fHeight, looking to the top of the
+// atmosphere along a ray with zenith cosine fCos. The densities fall off in the
+// planet's shadow. The mappings must match CPixelBuffer::MakeOpticalDepthBuffer().
+vec4 texOpticalDepth(float fHeight, float fCos)
+{
+	vec2 v2Coord = vec2((fHeight - fInnerRadius) * fScale, 0.5 - 0.5 * fCos) + 0.5 / fOpticalDepthSize;
+	return texture2D(s2OpticalDepth, clamp(v2Coord, 0.5 / fOpticalDepthSize, 1.0 - 0.5 / fOpticalDepthSize));
+}
+
+void main(void)
+{
+	// Get the ray from the camera to the vertex and its length (which is the far point of the ray passing through the atmosphere)
+	vec3 v3Pos = gl_Vertex.xyz;
+	vec3 v3Ray = v3Pos - v3CameraPos;
+	float fFar = length(v3Ray);
+	v3Ray /= fFar;
+
+	// Start where the ray enters the atmosphere, or at the camera if it is already inside
+	float B = 2.0 * dot(v3CameraPos, v3Ray);
+	float C = fCameraHeight2 - fOuterRadius2;
+	float fDet = max(0.0, B*B - 4.0 * C);
+	float fNear = max(0.0, 0.5 * (-B - sqrt(fDet)));
+	vec3 v3Start = v3CameraPos + v3Ray * fNear;
+	fFar -= fNear;
+
+	// The optical depth from the start to a sample is the start's depth to the top less the sample's
+	float fStartHeight = length(v3Start);
+	vec2 v2StartDepth = texOpticalDepth(fStartHeight, dot(v3Ray, v3Start) / fStartHeight).ga;
+
+	// Initialize the scattering loop variables
+	float fSampleLength = fFar / fSamples;
+	float fScaledLength = fSampleLength * fScale;
+	vec3 v3SampleRay = v3Ray * fSampleLength;
+	vec3 v3SamplePoint = v3Start + v3SampleRay * 0.5;
+
+	// Now loop through the sample rays, keeping Rayleigh and Mie apart since their densities differ
+	vec3 v3Rayleigh = vec3(0.0, 0.0, 0.0);
+	vec3 v3Mie = vec3(0.0, 0.0, 0.0);
+	for(int i=0; i<nSamples; i++)
+	{
+		float fHeight = length(v3SamplePoint);
+		vec4 v4Light = texOpticalDepth(fHeight, dot(v3LightPos, v3SamplePoint) / fHeight);
+		vec4 v4Camera = texOpticalDepth(fHeight, dot(v3Ray, v3SamplePoint) / fHeight);
+		vec2 v2Depth = v2StartDepth - v4Camera.ga + v4Light.ga;
+		vec3 v3Attenuate = exp(-(v2Depth.x * fKr4PI * v3InvWavelength + v2Depth.y * fKm4PI));
+		v3Rayleigh += v3Attenuate * v4Light.r;
+		v3Mie += v3Attenuate * v4Light.b;
+		v3SamplePoint += v3SampleRay;
+	}
+
+	// Finally, scale the Mie and Rayleigh colors and set up the varying variables for the pixel shader
+	gl_FrontSecondaryColor.rgb = v3Mie * (fKmESun * fScaledLength);
+	gl_FrontColor.rgb = v3Rayleigh * (v3InvWavelength * (fKrESun * fScaledLength));
+	gl_Position = gl_ModelViewProjectionMatrix * gl_Vertex;
+	v3Direction = v3CameraPos - v3Pos;
+}
@@ -0,0 +1,47 @@
+//
+// Atmospheric scattering vertex shader, optical depth table version.
+// Does the same work as SpaceFromSpace.vert and SpaceFromAtmosphere.vert, but looks
+// separate Rayleigh and Mie optical depths up in the table built by
+// CPixelBuffer::MakeOpticalDepthBuffer() instead of calling scale(), so it
+// holds for any radii and scale depths.
+//
+// Author:  Tim Finer
+// Email:   tfiner@csu.fullerton.edu
+//
+
+#include "Atmosphere.glsl"
+
+uniform sampler2D s2OpticalDepth;	// The optical depth table
+uniform float fOpticalDepthSize;	// The table's width and height
+
+
+// Returns the Rayleigh density (r), Rayleigh optical depth (g), Mie density (b)
+// and Mie optical depth (a) for a point at fHeight, looking to the top of the
+// atmosphere along a ray with zenith cosine fCos. The densities fall off in the
+// planet's shadow. The mappings must match CPixelBuffer::MakeOpticalDepthBuffer().
+vec4 texOpticalDepth(float fHeight, float fCos)
+{
+	vec2 v2Coord = vec2((fHeight - fInnerRadius) * fScale, 0.5 - 0.5 * fCos) + 0.5 / fOpticalDepthSize;
+	return texture2D(s2OpticalDepth, clamp(v2Coord, 0.5 / fOpticalDepthSize, 1.0 - 0.5 / fOpticalDepthSize));
+}
+
+void main(void)
+{
+	// Get the ray from the camera to the vertex
+	vec3 v3Pos = gl_Vertex.xyz;
+	vec3 v3Ray = normalize(v3Pos - v3CameraPos);
+
+	// Start where the ray enters the atmosphere, or at the camera if it is already inside
+	float B = 2.0 * dot(v3CameraPos, v3Ray);
+	float C = fCameraHeight2 - fOuterRadius2;
+	float fDet = max(0.0, B*B - 4.0 * C);
+	float fNear = max(0.0, 0.5 * (-B - sqrt(fDet)));
+	vec3 v3Start = v3CameraPos + v3Ray * fNear;
+
+	// Calculate attenuation from the start to the top of the atmosphere toward the vertex
+	float fStartHeight = length(v3Start);
+	vec2 v2Depth = texOpticalDepth(fStartHeight, dot(v3Ray, v3Start) / fStartHeight).ga;
+	gl_FrontSecondaryColor.rgb = exp(-(v2Depth.x * fKr4PI * v3InvWavelength + v2Depth.y * fKm4PI));
+	gl_Position = gl_ModelViewProjectionMatrix * gl_Vertex;
+	gl_TexCoord[0].st = gl_MultiTexCoord0.st;
+}
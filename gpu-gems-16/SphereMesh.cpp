@@ -0,0 +1,135 @@
+// Sphere mesh kept in GPU buffers.
+//
+// Author:  Tim Finer
+// Email:   tfiner@csu.fullerton.edu
+//
+// CPSC-597 Fall 2015 Master's Project
+//
+
+#include "Master.h"
+#include "SphereMesh.h"
+#include "tfgl/ScopedBinder.h"
+
+
+namespace {
+
+	// Appends the triangles of every stack, skipping the ones that collapse at the poles
+	template <typename Index>
+	std::vector<Index> MakeSphereIndices(int nSlices, int nStacks)
+	{
+		std::vector<Index> indices;
+		indices.reserve(nSlices * (nStacks-1) * 6);
+		for(int nStack=0; nStack<nStacks; nStack++)
+		{
+			for(int nSlice=0; nSlice<nSlices; nSlice++)
+			{
+				Index a = (Index)(nStack * (nSlices+1) + nSlice);
+				Index b = (Index)(a + nSlices + 1);		// One stack further south
+				if(nStack > 0)
+				{
+					indices.push_back(a);
+					indices.push_back(b);
+					indices.push_back(a+1);
+				}
+				if(nStack < nStacks-1)
+				{
+					indices.push_back(a+1);
+					indices.push_back(b);
+					indices.push_back(b+1);
+				}
+			}
+		}
+		return indices;
+	}
+
+}
+
+
+void CSphereMesh::Init(float fRadius, int nSlices, int nStacks)
+{
+	nSlices = Max(nSlices, 3);
+	nStacks = Max(nStacks, 2);
+
+	// Each stack gets a copy of its first vertex at the end, like gluSphere() does for the texture seam
+	std::vector<float> vertices;
+	vertices.reserve((nStacks+1) * (nSlices+1) * 3);
+	for(int nStack=0; nStack<=nStacks; nStack++)
+	{
+		float fPhi = PI * nStack / nStacks;
+		float fRing = fRadius * sinf(fPhi);
+		float z = fRadius * cosf(fPhi);
+		for(int nSlice=0; nSlice<=nSlices; nSlice++)
+		{
+			float fTheta = 2.0f * PI * (nSlice % nSlices) / nSlices;
+			vertices.push_back(fRing * cosf(fTheta));
+			vertices.push_back(fRing * sinf(fTheta));
+			vertices.push_back(z);
+		}
+	}
+	m_nVertices = (int)vertices.size() / 3;
+
+	m_pVAO.reset(new tfgl::VertexArrayObject);
+	tfgl::ScopedBinder<tfgl::VertexArrayObject> bindVAO(*m_pVAO);
+
+	m_pVertices.reset(new tfgl::Buffer(GL_ARRAY_BUFFER));
+	m_pVertices->Bind();
+	m_pVertices->SetStaticData(&vertices[0], vertices.size() * sizeof(float));
+	glEnableVertexAttribArray(0);
+	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), 0);
+	m_pVertices->Unbind();
+
+	// The VAO remembers the element buffer, so it stays bound until the VAO is released
+	m_pIndices.reset(new tfgl::Buffer(GL_ELEMENT_ARRAY_BUFFER));
+	m_pIndices->Bind();
+	if(m_nVertices <= 0x10000)
+	{
+		std::vector<unsigned short> indices = MakeSphereIndices<unsigned short>(nSlices, nStacks);
+		m_pIndices->SetStaticData(&indices[0], indices.size() * sizeof(unsigned short));
+		m_nIndices = (int)indices.size();
+		m_nIndexType = GL_UNSIGNED_SHORT;
+	}
+	else
+	{
+		std::vector<unsigned int> indices = MakeSphereIndices<unsigned int>(nSlices, nStacks);
+		m_pIndices->SetStaticData(&indices[0], indices.size() * sizeof(unsigned int));
+		m_nIndices = (int)indices.size();
+		m_nIndexType = GL_UNSIGNED_INT;
+	}
+}
+
+void CSphereMesh::Draw() const
+{
+	if(!m_pVAO)
+		return;
+	tfgl::ScopedBinder<const tfgl::VertexArrayObject> bindVAO(*m_pVAO);
+	glDrawElements(GL_TRIANGLES, m_nIndices, m_nIndexType, 0);
+}
+
+
+void CSphereLOD::Init(float fRadius, int nBaseStacks)
+{
+	m_fRadius = fRadius;
+	m_nBaseStacks = nBaseStacks;
+	for(int nLevel=0; nLevel<SPHERE_LOD_LEVELS; nLevel++)
+		m_mesh[nLevel].Init(fRadius, (nBaseStacks << nLevel) * 2, nBaseStacks << nLevel);
+	m_nLevel = Min(m_nLevel, SPHERE_LOD_LEVELS-1);
+}
+
+int CSphereLOD::SelectLevel(float fDistance, float fProjectionScale, float fBias)
+{
+	// From inside the sphere (or right on it) some of it is always right in front of the camera
+	float fLevel = (float)(SPHERE_LOD_LEVELS-1);
+	if(fDistance > m_fRadius * 1.001f)
+	{
+		// The silhouette is a circle of this many pixels, cut into 2 * stacks edges
+		float fScreenRadius = fProjectionScale * m_fRadius / sqrtf(fDistance*fDistance - m_fRadius*m_fRadius);
+		float fStacks = PI * fScreenRadius / SPHERE_LOD_PIXELS;
+		fLevel = logf(Max(fStacks / m_nBaseStacks, 1e-3f)) / logf(2.0f);
+	}
+	fLevel = Max(0.0f, Min(fLevel + fBias, (float)(SPHERE_LOD_LEVELS-1)));
+
+	int nWanted = (int)ceilf(fLevel);
+	if(nWanted > m_nLevel || fLevel < m_nLevel - 1 - SPHERE_LOD_HYSTERESIS)
+		m_nLevel = nWanted;
+	return m_nLevel;
+}
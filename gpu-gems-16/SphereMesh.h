@@ -0,0 +1,89 @@
+// Sphere mesh kept in GPU buffers.
+//
+// Author:  Tim Finer
+// Email:   tfiner@csu.fullerton.edu
+//
+// CPSC-597 Fall 2015 Master's Project
+//
+
+#ifndef __SphereMesh_h__
+#define __SphereMesh_h__
+
+#include "tfgl/Buffer.h"
+#include "tfgl/VertexArrayObject.h"
+
+#include <memory>
+
+
+/*******************************************************************************
+* Class: CSphereMesh
+********************************************************************************
+* A UV sphere with the same layout and winding as gluSphere(), built once into
+* a vertex buffer and an index buffer that a VAO ties together. Drawing it is a
+* single glDrawElements() call, so the CPU cost no longer depends on the
+* tessellation. Positions go to generic attribute 0, which gl_Vertex aliases.
+*******************************************************************************/
+class CSphereMesh
+{
+protected:
+	std::unique_ptr<tfgl::VertexArrayObject> m_pVAO;
+	std::unique_ptr<tfgl::Buffer> m_pVertices;
+	std::unique_ptr<tfgl::Buffer> m_pIndices;
+	int m_nVertices;
+	int m_nIndices;
+	unsigned int m_nIndexType;		// GL_UNSIGNED_SHORT or GL_UNSIGNED_INT
+
+public:
+	CSphereMesh()					{ m_nVertices = m_nIndices = 0; m_nIndexType = 0; }
+
+	// nSlices around the z axis and nStacks from pole to pole, as gluSphere()
+	void Init(float fRadius, int nSlices, int nStacks);
+	void Draw() const;
+
+	bool IsValid() const			{ return m_nIndices > 0; }
+	int GetVertexCount() const		{ return m_nVertices; }
+	int GetTriangleCount() const	{ return m_nIndices / 3; }
+};
+
+
+#define SPHERE_LOD_LEVELS		6		// Each level doubles the slices and stacks of the one before
+#define SPHERE_LOD_PIXELS		8.0f	// The longest a silhouette edge should get on screen
+#define SPHERE_LOD_HYSTERESIS	0.3f	// How far past a level boundary to go before dropping to it
+
+
+/*******************************************************************************
+* Class: CSphereLOD
+********************************************************************************
+* A chain of CSphereMesh tessellations of one sphere. Every frame SelectLevel()
+* picks the coarsest level that keeps the silhouette's edges under
+* SPHERE_LOD_PIXELS long, from how big the sphere is on screen. Finer levels
+* are taken as soon as they are needed, but a coarser one only once the camera
+* is SPHERE_LOD_HYSTERESIS of a level past the boundary, so a camera sitting
+* near the boundary doesn't flip between the two every frame.
+*******************************************************************************/
+class CSphereLOD
+{
+protected:
+	CSphereMesh m_mesh[SPHERE_LOD_LEVELS];
+	float m_fRadius;
+	int m_nBaseStacks;
+	int m_nLevel;
+
+public:
+	CSphereLOD()					{ m_fRadius = 0; m_nBaseStacks = 0; m_nLevel = 0; }
+
+	// Level 0 has nBaseStacks stacks, and every level has twice as many slices as stacks
+	void Init(float fRadius, int nBaseStacks);
+
+	// fDistance is from the camera to the sphere's center, fProjectionScale is
+	// the viewport's half height over tan(half the vertical field of view), and
+	// fBias shifts the choice finer (positive) or coarser (negative) in levels
+	int SelectLevel(float fDistance, float fProjectionScale, float fBias=0.0f);
+	void Draw() const				{ m_mesh[m_nLevel].Draw(); }
+
+	int GetLevel() const			{ return m_nLevel; }
+	const CSphereMesh &GetMesh() const	{ return m_mesh[m_nLevel]; }
+	const CSphereMesh &GetMesh(int nLevel) const	{ return m_mesh[nLevel]; }
+};
+
+#endif // __SphereMesh_h__
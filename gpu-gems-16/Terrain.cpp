@@ -0,0 +1,289 @@
+// Procedural terrain for the ground sphere.
+//
+// Author:  Tim Finer
+// Email:   tfiner@csu.fullerton.edu
+//
+// CPSC-597 Fall 2015 Master's Project
+//
+
+#include "Master.h"
+#include "Terrain.h"
+#include "ThreadPool.h"
+#include "tfgl/ScopedBinder.h"
+
+
+namespace {
+
+	const int nSlices = TERRAIN_PATCHES_X * TERRAIN_PATCH_SIZE;
+	const int nStacks = TERRAIN_PATCHES_Y * TERRAIN_PATCH_SIZE;
+	const int nPatchVertices = TERRAIN_PATCH_SIZE + 1;		// Along a side, the edges are shared with the neighbours
+
+	// The unit vector to vertex (nSlice, nStack) of the finest level, worked
+	// out the same way CSphereMesh::Init() does it. Both patches along an edge
+	// get the same vector for it, so their heights match and there are no cracks.
+	void SphereDirection(int nSlice, int nStack, float *pDir)
+	{
+		float fPhi = PI * nStack / nStacks;
+		float fTheta = 2.0f * PI * (nSlice % nSlices) / nSlices;
+		float fRing = sinf(fPhi);
+		pDir[0] = fRing * cosf(fTheta);
+		pDir[1] = fRing * sinf(fTheta);
+		pDir[2] = cosf(fPhi);
+	}
+
+}
+
+
+CTerrain::~CTerrain()
+{
+	// The workers hold references to the patches, so they have to be done with them first
+	m_bCancel = true;
+	for(auto &row : m_patch)
+		for(auto &patch : row)
+			if(patch.fGenerated.valid())
+				patch.fGenerated.wait();
+}
+
+void CTerrain::Init(float fRadius, float fHeight, unsigned int nSeed)
+{
+	m_fRadius = fRadius;
+	m_fHeight = fHeight;
+	m_fractal.Init(nSeed, 1.0f, 2.0f);
+
+	// The finest level's vertices are PI / nStacks radians apart, and any octave finer than that can only alias
+	m_fOctaves = m_fractal.FootprintOctaves(TERRAIN_FREQUENCY * PI / nStacks, 8.0f);
+	m_nMaxPending = Max(1, ThreadPool()->GetThreadCount());
+
+	// Level L has 2 << L quads along a patch's side, stepping over the finer
+	// levels' vertices. At the poles a row of these triangles is degenerate,
+	// which costs next to nothing, and lets every patch share one index buffer.
+	std::vector<unsigned short> indices;
+	for(int nLevel=0; nLevel<SPHERE_LOD_LEVELS; nLevel++)
+	{
+		int nStep = TERRAIN_PATCH_SIZE / (2 << nLevel);
+		m_nLevelStart[nLevel] = (int)indices.size();
+		for(int y=0; y<TERRAIN_PATCH_SIZE; y+=nStep)
+		{
+			for(int x=0; x<TERRAIN_PATCH_SIZE; x+=nStep)
+			{
+				unsigned short a = (unsigned short)(y * nPatchVertices + x);
+				unsigned short b = (unsigned short)(a + nStep * nPatchVertices);	// nStep stacks further south
+				indices.push_back(a);
+				indices.push_back(b);
+				indices.push_back(a + nStep);
+				indices.push_back(a + nStep);
+				indices.push_back(b);
+				indices.push_back(b + nStep);
+			}
+		}
+		m_nLevelCount[nLevel] = (int)indices.size() - m_nLevelStart[nLevel];
+	}
+	m_pIndices.reset(new tfgl::Buffer(GL_ELEMENT_ARRAY_BUFFER));
+	m_pIndices->Bind();
+	m_pIndices->SetStaticData(&indices[0], indices.size() * sizeof(unsigned short));
+	m_pIndices->Unbind();
+
+	// Without worker threads, Submit() would run the patches on the render
+	// thread one by one as Update() queued them, a stall every frame until
+	// they were all done. Taking the whole hit once here is the lesser evil.
+	bool bInline = ThreadPool()->GetThreadCount() == 0;
+	m_tInit = std::chrono::high_resolution_clock::now();
+	std::vector<float> vVertices;
+	for(int nY=0; nY<TERRAIN_PATCHES_Y; nY++)
+	{
+		for(int nX=0; nX<TERRAIN_PATCHES_X; nX++)
+		{
+			STerrainPatch &patch = m_patch[nY][nX];
+			patch.nX = nX;
+			patch.nY = nY;
+			patch.bDisplaced = bInline;
+			patch.pbHeight.Init(nPatchVertices, nPatchVertices, 1, 1, GL_LUMINANCE, GL_FLOAT);
+			if(bInline)
+			{
+				GeneratePatch(patch);
+				UploadVertices(patch, patch.vVertices);
+				std::vector<float>().swap(patch.vVertices);
+			}
+			else
+			{
+				MakeVertices(patch, NULL, vVertices);
+				UploadVertices(patch, vVertices);
+			}
+		}
+	}
+	if(bInline)
+		LogInfo("CTerrain::Init() - No worker threads, generated %d patches of %d x %d heights, %.2f octaves in %.1f ms",
+			TERRAIN_PATCHES_X * TERRAIN_PATCHES_Y, nPatchVertices, nPatchVertices, m_fOctaves,
+			std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - m_tInit).count());
+	else
+		LogInfo("CTerrain::Init() - %d patches of %d x %d heights, %.2f octaves, up to %d generating at once",
+			TERRAIN_PATCHES_X * TERRAIN_PATCHES_Y, nPatchVertices, nPatchVertices, m_fOctaves, m_nMaxPending);
+}
+
+float CTerrain::Height(const float *pDir) const
+{
+	float f[3];
+	for(int i=0; i<3; i++)
+		f[i] = pDir[i] * TERRAIN_FREQUENCY;
+
+	// Land is wherever the hybrid multifractal is above 0, the rest is sea at the base radius.
+	// The ridges run across all of it, but only come up out of the land.
+	float fLand = Max(m_fractal.HybridMultifractal(f, m_fOctaves, 0.0f, 1.0f), 0.0f);
+	float fMountains = m_fractal.RidgedMultifractal(f, m_fOctaves, 0.8f, 2.0f);
+	return m_fHeight * fLand * (0.25f + 0.75f * fMountains);
+}
+
+float CTerrain::GetHeight(const CVector &v) const
+{
+	float fMagnitude = v.Magnitude();
+	float fDir[3] = {v.x / fMagnitude, v.y / fMagnitude, v.z / fMagnitude};
+
+	// The inverse of SphereDirection(), down to which patch the vertex would be in
+	float fTheta = atan2f(fDir[1], fDir[0]);
+	if(fTheta < 0.0f)
+		fTheta += 2.0f * PI;
+	float fPhi = acosf(Max(-1.0f, Min(fDir[2], 1.0f)));
+	int nX = Min((int)(fTheta * nSlices / (2.0f * PI)) / TERRAIN_PATCH_SIZE, TERRAIN_PATCHES_X-1);
+	int nY = Min((int)(fPhi * nStacks / PI) / TERRAIN_PATCH_SIZE, TERRAIN_PATCHES_Y-1);
+	if(!m_patch[nY][nX].bDisplaced)
+		return 0.0f;
+	return Height(fDir);
+}
+
+void CTerrain::GeneratePatch(STerrainPatch &patch)
+{
+	float *pHeight = (float *)patch.pbHeight.GetBuffer();
+	for(int y=0; y<nPatchVertices; y++)
+	{
+		if(m_bCancel)
+			return;
+		for(int x=0; x<nPatchVertices; x++)
+		{
+			float fDir[3];
+			SphereDirection(patch.nX * TERRAIN_PATCH_SIZE + x, patch.nY * TERRAIN_PATCH_SIZE + y, fDir);
+			pHeight[y * nPatchVertices + x] = Height(fDir);
+		}
+	}
+	MakeVertices(patch, pHeight, patch.vVertices);
+}
+
+void CTerrain::MakeVertices(const STerrainPatch &patch, const float *pHeight, std::vector<float> &vVertices) const
+{
+	vVertices.resize(nPatchVertices * nPatchVertices * 3);
+	float *pVertex = &vVertices[0];
+	for(int y=0; y<nPatchVertices; y++)
+	{
+		for(int x=0; x<nPatchVertices; x++)
+		{
+			float fRadius = m_fRadius + (pHeight ? pHeight[y * nPatchVertices + x] : 0.0f);
+			SphereDirection(patch.nX * TERRAIN_PATCH_SIZE + x, patch.nY * TERRAIN_PATCH_SIZE + y, pVertex);
+			for(int i=0; i<3; i++)
+				*pVertex++ *= fRadius;
+		}
+	}
+}
+
+void CTerrain::UploadVertices(STerrainPatch &patch, const std::vector<float> &vVertices)
+{
+	if(patch.pVAO)
+	{
+		patch.pVertices->Bind();
+		patch.pVertices->SetStaticData(&vVertices[0], vVertices.size() * sizeof(float));
+		patch.pVertices->Unbind();
+		return;
+	}
+
+	patch.pVAO.reset(new tfgl::VertexArrayObject);
+	tfgl::ScopedBinder<tfgl::VertexArrayObject> bindVAO(*patch.pVAO);
+	patch.pVertices.reset(new tfgl::Buffer(GL_ARRAY_BUFFER));
+	patch.pVertices->Bind();
+	patch.pVertices->SetStaticData(&vVertices[0], vVertices.size() * sizeof(float));
+	glEnableVertexAttribArray(0);
+	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), 0);
+	patch.pVertices->Unbind();
+
+	// The VAO remembers the element buffer, so it stays bound until the VAO is released
+	m_pIndices->Bind();
+}
+
+void CTerrain::Update(const CVector &vCamera)
+{
+	// A future that isn't ready yet is skipped over, never waited on
+	int nPending = 0, nUploaded = 0;
+	for(auto &row : m_patch)
+	{
+		for(auto &patch : row)
+		{
+			if(!patch.fGenerated.valid())
+				continue;
+			if(patch.fGenerated.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+			{
+				nPending++;
+				continue;
+			}
+			patch.fGenerated.get();
+			UploadVertices(patch, patch.vVertices);
+			std::vector<float>().swap(patch.vVertices);
+			patch.bDisplaced = true;
+			nUploaded++;
+		}
+	}
+	if(nUploaded && GetDisplacedCount() == TERRAIN_PATCHES_X * TERRAIN_PATCHES_Y)
+		LogInfo("CTerrain::Update() - All patches displaced %.1f ms after Init()",
+			std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - m_tInit).count());
+
+	// Keep no more on the pool than it has threads, so the other generators
+	// sharing it still get a turn. Without worker threads, Init() has already
+	// displaced every patch and there is nothing left to queue.
+	CVector vView = vCamera / vCamera.Magnitude();
+	while(nPending < m_nMaxPending)
+	{
+		STerrainPatch *pNext = NULL;
+		float fNearest = -2.0f;
+		for(auto &row : m_patch)
+		{
+			for(auto &patch : row)
+			{
+				if(patch.bDisplaced || patch.fGenerated.valid())
+					continue;
+				float fCenter[3];
+				SphereDirection(patch.nX * TERRAIN_PATCH_SIZE + TERRAIN_PATCH_SIZE/2, patch.nY * TERRAIN_PATCH_SIZE + TERRAIN_PATCH_SIZE/2, fCenter);
+				float fFacing = (vView | CVector(fCenter[0], fCenter[1], fCenter[2]));
+				if(fFacing > fNearest)
+				{
+					fNearest = fFacing;
+					pNext = &patch;
+				}
+			}
+		}
+		if(!pNext)
+			break;
+		pNext->fGenerated = ThreadPool()->Submit([this, pNext]() { GeneratePatch(*pNext); });
+		nPending++;
+	}
+}
+
+void CTerrain::Draw(int nLevel) const
+{
+	nLevel = Max(0, Min(nLevel, SPHERE_LOD_LEVELS-1));
+	const void *pStart = (const void *)(m_nLevelStart[nLevel] * sizeof(unsigned short));
+	for(auto &row : m_patch)
+	{
+		for(auto &patch : row)
+		{
+			if(!patch.pVAO)
+				continue;
+			tfgl::ScopedBinder<const tfgl::VertexArrayObject> bindVAO(*patch.pVAO);
+			glDrawElements(GL_TRIANGLES, m_nLevelCount[nLevel], GL_UNSIGNED_SHORT, pStart);
+		}
+	}
+}
+
+int CTerrain::GetDisplacedCount() const
+{
+	int nCount = 0;
+	for(auto &row : m_patch)
+		for(auto &patch : row)
+			nCount += patch.bDisplaced;
+	return nCount;
+}
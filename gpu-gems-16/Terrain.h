@@ -0,0 +1,106 @@
+// Procedural terrain for the ground sphere.
+//
+// Author:  Tim Finer
+// Email:   tfiner@csu.fullerton.edu
+//
+// CPSC-597 Fall 2015 Master's Project
+//
+
+#ifndef __Terrain_h__
+#define __Terrain_h__
+
+#include "PixelBuffer.h"
+#include "SphereMesh.h"
+#include "tfgl/Buffer.h"
+#include "tfgl/VertexArrayObject.h"
+
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <memory>
+#include <vector>
+
+
+#define TERRAIN_PATCHES_X		8		// Patches around the equator
+#define TERRAIN_PATCHES_Y		4		// Patches from pole to pole
+#define TERRAIN_PATCH_SIZE		(2 << (SPHERE_LOD_LEVELS-1))	// Quads along a patch's side at the finest level
+#define TERRAIN_FREQUENCY		4.0f	// Noise lattice cells per planet radius
+
+
+/*******************************************************************************
+* Class: CTerrain
+********************************************************************************
+* The ground sphere with mountains. The sphere is split along its slices and
+* stacks into TERRAIN_PATCHES_X by TERRAIN_PATCHES_Y patches, and each patch
+* has its own CPixelBuffer of heights above the radius. HybridMultifractal()
+* lays out continents and flat seas, and RidgedMultifractal() raises mountain
+* ranges on the land.
+*
+* The heights are generated on the thread pool, the patches nearest the camera
+* first, and Update() only checks which ones have finished, so the render loop
+* never waits on the noise. Until its heights are in, a patch is drawn as part
+* of the plain sphere. A pool with no worker threads would run each patch on
+* the render thread as it was queued, so then Init() generates them all itself.
+*
+* Level L of Draw() has the same vertices as level L of a CSphereLOD with 8
+* base stacks, so CSphereLOD::SelectLevel() can pick it.
+*******************************************************************************/
+class CTerrain
+{
+protected:
+	struct STerrainPatch
+	{
+		int nX, nY;							// Which patch, counted in patches
+		CPixelBuffer pbHeight;				// (TERRAIN_PATCH_SIZE+1)^2 heights, written by one worker thread
+		std::vector<float> vVertices;		// The displaced vertices, waiting to be uploaded
+		std::future<void> fGenerated;		// Valid from when the heights are queued until they are uploaded
+		bool bDisplaced;					// Set once the mesh has the heights
+		std::unique_ptr<tfgl::VertexArrayObject> pVAO;
+		std::unique_ptr<tfgl::Buffer> pVertices;
+	};
+
+	STerrainPatch m_patch[TERRAIN_PATCHES_Y][TERRAIN_PATCHES_X];
+	CFractalT<3> m_fractal;
+	float m_fRadius;
+	float m_fHeight;					// The highest a mountain can get above m_fRadius
+	float m_fOctaves;					// As many as the finest level's vertices can resolve
+	int m_nMaxPending;					// How many patches may be on the thread pool at once
+	std::atomic<bool> m_bCancel;		// Tells generating patches to give up, for the destructor
+	std::chrono::high_resolution_clock::time_point m_tInit;
+
+	// All the levels' indexes, one after the other, shared by every patch
+	std::unique_ptr<tfgl::Buffer> m_pIndices;
+	int m_nLevelStart[SPHERE_LOD_LEVELS];
+	int m_nLevelCount[SPHERE_LOD_LEVELS];
+
+	// The height above m_fRadius in direction pDir, which must be a unit vector
+	float Height(const float *pDir) const;
+
+	// Runs on a worker thread
+	void GeneratePatch(STerrainPatch &patch);
+
+	// Fills vVertices for patch at m_fRadius plus pHeight, or with no heights if pHeight is NULL
+	void MakeVertices(const STerrainPatch &patch, const float *pHeight, std::vector<float> &vVertices) const;
+	void UploadVertices(STerrainPatch &patch, const std::vector<float> &vVertices);
+
+public:
+	CTerrain()						{ m_fRadius = m_fHeight = m_fOctaves = 0; m_nMaxPending = 0; m_bCancel = false; }
+	~CTerrain();
+
+	// Builds every patch undisplaced, which is cheap, and leaves the noise to Update().
+	// If the thread pool has no workers, it generates all the heights itself instead.
+	void Init(float fRadius, float fHeight, unsigned int nSeed);
+
+	// Uploads any patches that have finished, then queues more, nearest vCamera first
+	void Update(const CVector &vCamera);
+	void Draw(int nLevel) const;
+
+	// The height of the ground above the base radius under v, which needn't be a unit vector.
+	// This is the ground as drawn, so it's 0 until the patch under v has its heights.
+	float GetHeight(const CVector &v) const;
+
+	int GetDisplacedCount() const;
+	int GetTriangleCount(int nLevel) const	{ return TERRAIN_PATCHES_X * TERRAIN_PATCHES_Y * m_nLevelCount[nLevel] / 3; }
+};
+
+#endif // __Terrain_h__
@@ -45,6 +45,8 @@ bool Testbed::InitImpl() {
     //::glClearColor(0.0f, 0.5f, 0.25f, 0.0f);
     //THROW_ON_GL_ERROR();
     engine_.reset(new CGameEngine);
+    start_ = std::chrono::steady_clock::now();
+    lastFrameMs_ = 0;
     return true;
 }
 
@@ -54,7 +56,17 @@ bool Testbed::DrawImpl() {
 
     //glClear(GL_COLOR_BUFFER_BIT);
     //THROW_ON_GL_ERROR();
-   engine_->RenderFrame(1000);
+    const auto elapsed = std::chrono::steady_clock::now() - start_;
+    const int frameMs = static_cast<int>(std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count());
+    engine_->RenderFrame(frameMs - lastFrameMs_);
+    lastFrameMs_ = frameMs;
+
+    // The stats only change once a second, so the title is only set then.
+    const std::string stats = engine_->GetFrameStats();
+    if (!stats.empty() && stats != stats_) {
+        stats_ = stats;
+        SetTitle(GetVersion() + " - " + stats_);
+    }
     return true;
 }
 
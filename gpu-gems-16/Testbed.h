@@ -10,7 +10,9 @@
 #include "tfgl/App.h"
 
 
+#include <chrono>
 #include <memory>
+#include <string>
 
 class CGameEngine;
 
@@ -36,6 +38,14 @@ namespace tft {
         // std::unique_ptr<tfgl::Program>              program_;
         std::unique_ptr<CGameEngine>              engine_;
 
+        // Frame times go to the engine in whole milliseconds since start_, so
+        // frames shorter than a millisecond still add up.
+        std::chrono::steady_clock::time_point       start_;
+        int                                         lastFrameMs_ = 0;
+
+        // The engine's once-a-second frame stats, shown in the title bar.
+        std::string                                 stats_;
+
         virtual std::string GetVersion() const override { return "Testbed 1.0"; }
 
         virtual bool InitImpl() override;
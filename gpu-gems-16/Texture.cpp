@@ -39,25 +39,62 @@ void CTexture::InitStaticMembers(int nSeed, int nSize)
 	CPixelBuffer pb;
 
 	// Initialize the shared cloud cell texture
-	pb.Init(16, 16, 1, 2, GL_LUMINANCE_ALPHA);
-	pb.MakeCloudCell(2, 0);
+	CAssetCache::LoadOrMake(pb, CAssetKey("CloudCell").Add(16).Add(2.0f).Add(0.0f), [&pb]() {
+		pb.Init(16, 16, 1, 2, GL_LUMINANCE_ALPHA);
+		pb.MakeCloudCell(2, 0);
+	});
 	m_tCloudCell.Init(&pb);
 
-	pb.Init(64, 1, 1, 2, GL_LUMINANCE_ALPHA);
-	pb.MakeGlow1D();
+	CAssetCache::LoadOrMake(pb, CAssetKey("Glow1D").Add(64), [&pb]() {
+		pb.Init(64, 1, 1, 2, GL_LUMINANCE_ALPHA);
+		pb.MakeGlow1D();
+	});
 	m_t1DGlow.Init(&pb);
 }
 
+// Float and 16-bit buffers keep their precision on the card, everything else is stored the way GL prefers
+static int GetInternalFormat(CPixelBuffer *pBuffer)
+{
+	static const int nFloat[4] = {GL_LUMINANCE32F_ARB, GL_LUMINANCE_ALPHA32F_ARB, GL_RGB32F_ARB, GL_RGBA32F_ARB};
+	static const int nHalf[4] = {GL_LUMINANCE16F_ARB, GL_LUMINANCE_ALPHA16F_ARB, GL_RGB16F_ARB, GL_RGBA16F_ARB};
+	static const int nShort[4] = {GL_LUMINANCE16, GL_LUMINANCE16_ALPHA16, GL_RGB16, GL_RGBA16};
+	int nChannels = pBuffer->GetChannels();
+	if(nChannels >= 1 && nChannels <= 4)
+	{
+		switch(pBuffer->GetDataType())
+		{
+			case GL_FLOAT: return nFloat[nChannels-1];
+			case GL_HALF_FLOAT: return nHalf[nChannels-1];
+			case GL_UNSIGNED_SHORT: return nShort[nChannels-1];
+		}
+	}
+	return nChannels;
+}
+
 void CTexture::Init(CPixelBuffer *pBuffer, bool bClamp, bool bMipmap)
 {
 	Cleanup();
-	m_nType = pBuffer->GetHeight() == 1 ? GL_TEXTURE_1D : pBuffer->GetHeight() == pBuffer->GetWidth() ? GL_TEXTURE_2D : GL_TEXTURE_RECTANGLE_EXT;
+	if(pBuffer->GetDepth() > 1)
+		m_nType = GL_TEXTURE_3D;
+	else
+		m_nType = pBuffer->GetHeight() == 1 ? GL_TEXTURE_1D : pBuffer->GetHeight() == pBuffer->GetWidth() ? GL_TEXTURE_2D : GL_TEXTURE_RECTANGLE_EXT;
+	int nInternalFormat = GetInternalFormat(pBuffer);
+
+	// GLU's mipmap builders don't know GL_HALF_FLOAT
+	if(pBuffer->GetDataType() == GL_HALF_FLOAT)
+		bMipmap = false;
 
 	glGenTextures(1, &m_nID);
 	Bind();
 	//glTexParameteri(m_nType, GL_TEXTURE_WRAP_R, bClamp ? GL_CLAMP : GL_REPEAT);
 	glTexParameteri(m_nType, GL_TEXTURE_WRAP_S, bClamp ? GL_CLAMP : GL_REPEAT);
 	glTexParameteri(m_nType, GL_TEXTURE_WRAP_T, bClamp ? GL_CLAMP : GL_REPEAT);
+	if(m_nType == GL_TEXTURE_3D)
+	{
+		// GLU has no 3D mipmap builder
+		bMipmap = false;
+		glTexParameteri(m_nType, GL_TEXTURE_WRAP_R, bClamp ? GL_CLAMP_TO_EDGE : GL_REPEAT);
+	}
 	glTexParameteri(m_nType, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 	glTexParameteri(m_nType, GL_TEXTURE_MIN_FILTER, bMipmap ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
 
@@ -65,31 +102,37 @@ void CTexture::Init(CPixelBuffer *pBuffer, bool bClamp, bool bMipmap)
 	{
 		case GL_TEXTURE_1D:
 			if(bMipmap)
-				gluBuild1DMipmaps(m_nType, pBuffer->GetChannels(), pBuffer->GetWidth(), pBuffer->GetFormat(), pBuffer->GetDataType(), pBuffer->GetBuffer());
+				gluBuild1DMipmaps(m_nType, nInternalFormat, pBuffer->GetWidth(), pBuffer->GetFormat(), pBuffer->GetDataType(), pBuffer->GetBuffer());
 			else
-				glTexImage1D(m_nType, 0, pBuffer->GetChannels(), pBuffer->GetWidth(), 0, pBuffer->GetFormat(), pBuffer->GetDataType(), pBuffer->GetBuffer());
+				glTexImage1D(m_nType, 0, nInternalFormat, pBuffer->GetWidth(), 0, pBuffer->GetFormat(), pBuffer->GetDataType(), pBuffer->GetBuffer());
 			break;
 		case GL_TEXTURE_2D:
 		case GL_TEXTURE_RECTANGLE_EXT:
 			if(bMipmap)
-				gluBuild2DMipmaps(m_nType, pBuffer->GetChannels(), pBuffer->GetWidth(), pBuffer->GetHeight(), pBuffer->GetFormat(), pBuffer->GetDataType(), pBuffer->GetBuffer());
+				gluBuild2DMipmaps(m_nType, nInternalFormat, pBuffer->GetWidth(), pBuffer->GetHeight(), pBuffer->GetFormat(), pBuffer->GetDataType(), pBuffer->GetBuffer());
 			else
-				glTexImage2D(m_nType, 0, pBuffer->GetChannels(), pBuffer->GetWidth(), pBuffer->GetHeight(), 0, pBuffer->GetFormat(), pBuffer->GetDataType(), pBuffer->GetBuffer());
+				glTexImage2D(m_nType, 0, nInternalFormat, pBuffer->GetWidth(), pBuffer->GetHeight(), 0, pBuffer->GetFormat(), pBuffer->GetDataType(), pBuffer->GetBuffer());
+			break;
+		case GL_TEXTURE_3D:
+			glTexImage3D(m_nType, 0, nInternalFormat, pBuffer->GetWidth(), pBuffer->GetHeight(), pBuffer->GetDepth(), 0, pBuffer->GetFormat(), pBuffer->GetDataType(), pBuffer->GetBuffer());
 			break;
 	}
 }
 
-void CTexture::Update(CPixelBuffer *pBuffer, int nLevel)
+void CTexture::Upload(CPixelBuffer *pBuffer, int nLevel, const void *pPixels)
 {
 	Bind();
 	switch(m_nType)
 	{
 		case GL_TEXTURE_1D:
-			glTexSubImage1D(m_nType, nLevel, 0, pBuffer->GetWidth(), pBuffer->GetFormat(), pBuffer->GetDataType(), pBuffer->GetBuffer());
+			glTexSubImage1D(m_nType, nLevel, 0, pBuffer->GetWidth(), pBuffer->GetFormat(), pBuffer->GetDataType(), pPixels);
 			break;
 		case GL_TEXTURE_2D:
 		case GL_TEXTURE_RECTANGLE_EXT:
-			glTexSubImage2D(m_nType, nLevel, 0, 0, pBuffer->GetWidth(), pBuffer->GetHeight(), pBuffer->GetFormat(), pBuffer->GetDataType(), pBuffer->GetBuffer());
+			glTexSubImage2D(m_nType, nLevel, 0, 0, pBuffer->GetWidth(), pBuffer->GetHeight(), pBuffer->GetFormat(), pBuffer->GetDataType(), pPixels);
+			break;
+		case GL_TEXTURE_3D:
+			glTexSubImage3D(m_nType, nLevel, 0, 0, 0, pBuffer->GetWidth(), pBuffer->GetHeight(), pBuffer->GetDepth(), pBuffer->GetFormat(), pBuffer->GetDataType(), pPixels);
 			break;
 	}
 }
@@ -131,3 +174,117 @@ void CTexture::UpdateCopy(int x, int y, int nWidth, int nHeight, int nOffx, int
 			break;
 	}
 }
+
+bool CPixelUnpackRing::Init(int nSlotSize, int nSlots)
+{
+	Cleanup();
+	m_nSlotSize = (int)ALIGN(nSlotSize);
+	m_nSlots = nSlots;
+	m_nNext = 0;
+	m_pState = new int[nSlots];
+	m_pFence = new GLsync[nSlots];
+	for(int i=0; i<nSlots; i++)
+	{
+		m_pState[i] = SlotFree;
+		m_pFence[i] = NULL;
+	}
+
+	// Coherent, so nothing has to be flushed between a worker's writes and the copy
+	GLsizeiptr nSize = (GLsizeiptr)m_nSlotSize * nSlots;
+	if(GLEW_ARB_buffer_storage)
+	{
+		GLbitfield nFlags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+		glGenBuffers(1, &m_nBuffer);
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, m_nBuffer);
+		glBufferStorage(GL_PIXEL_UNPACK_BUFFER, nSize, NULL, nFlags);
+		m_pData = (unsigned char *)glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, nSize, nFlags);
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		if(!m_pData)
+		{
+			LogError("CPixelUnpackRing::Init() - Unable to map %d bytes persistently", (int)nSize);
+			glDeleteBuffers(1, &m_nBuffer);
+			m_nBuffer = 0;
+		}
+	}
+	if(!m_pData)
+		m_pData = new unsigned char[nSize];
+	LogInfo("CPixelUnpackRing::Init() - %d slots of %d bytes, %s", nSlots, m_nSlotSize, m_nBuffer ? "persistently mapped" : "in client memory");
+	return m_nBuffer != 0;
+}
+
+void CPixelUnpackRing::Cleanup()
+{
+	if(m_pFence)
+	{
+		for(int i=0; i<m_nSlots; i++)
+			if(m_pFence[i])
+				glDeleteSync(m_pFence[i]);
+		delete[] m_pFence;
+		delete[] m_pState;
+		m_pFence = NULL;
+		m_pState = NULL;
+	}
+	if(m_nBuffer)
+	{
+		// Deleting a mapped buffer unmaps it
+		glDeleteBuffers(1, &m_nBuffer);
+		m_nBuffer = 0;
+	}
+	else
+		delete[] m_pData;
+	m_pData = NULL;
+	m_nSlots = 0;
+}
+
+int CPixelUnpackRing::Acquire()
+{
+	for(int n=0; n<m_nSlots; n++)
+	{
+		int nSlot = (m_nNext + n) % m_nSlots;
+		if(m_pState[nSlot] == SlotCopying)
+		{
+			// A timeout of 0 only asks, it never blocks
+			GLenum nStatus = glClientWaitSync(m_pFence[nSlot], 0, 0);
+			if(nStatus != GL_ALREADY_SIGNALED && nStatus != GL_CONDITION_SATISFIED)
+				continue;
+			glDeleteSync(m_pFence[nSlot]);
+			m_pFence[nSlot] = NULL;
+			m_pState[nSlot] = SlotFree;
+		}
+		if(m_pState[nSlot] == SlotFree)
+		{
+			m_pState[nSlot] = SlotWriting;
+			m_nNext = (nSlot + 1) % m_nSlots;
+			return nSlot;
+		}
+	}
+	return -1;
+}
+
+void CPixelUnpackRing::Discard(int nSlot)
+{
+	_ASSERT(nSlot >= 0 && nSlot < m_nSlots && m_pState[nSlot] == SlotWriting);
+	m_pState[nSlot] = SlotFree;
+}
+
+const void *CPixelUnpackRing::Bind(int nSlot)
+{
+	_ASSERT(nSlot >= 0 && nSlot < m_nSlots && m_pState[nSlot] == SlotWriting);
+	if(!m_nBuffer)
+		return GetData(nSlot);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, m_nBuffer);
+	return (const void *)((size_t)nSlot * m_nSlotSize);
+}
+
+void CPixelUnpackRing::Release(int nSlot)
+{
+	if(!m_nBuffer)
+	{
+		// The copy from client memory is done by the time glTexSubImage*() returns
+		m_pState[nSlot] = SlotFree;
+		return;
+	}
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	m_pFence[nSlot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	m_pState[nSlot] = SlotCopying;
+}
@@ -34,6 +34,65 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "PixelBuffer.h"
 #include "GLUtil.h"
 
+/*******************************************************************************
+* Class: CPixelUnpackRing
+********************************************************************************
+* Streams texels to textures without the driver copying them out of client
+* memory on the render thread. One GL_PIXEL_UNPACK_BUFFER is mapped once,
+* persistently, and split into equal slots. The render thread takes a slot
+* with Acquire(), a worker thread writes the texels straight into GetData(),
+* for instance through a CPixelBuffer initialized on it, and once the worker
+* is done the render thread hands the slot to CTexture::Update() or
+* CTextureArray::Update(), which only issue the copy. A fence behind the copy
+* keeps the slot from being handed out again until the GPU has read it.
+* Acquire() never waits on the GPU: with every slot busy it returns -1 and
+* the caller tries again next frame.
+*
+* Without GL_ARB_buffer_storage the slots are plain memory, and the copies
+* are made from client memory the way they always were.
+*******************************************************************************/
+class CPixelUnpackRing
+{
+protected:
+	enum { SlotFree, SlotWriting, SlotCopying };
+
+	GLuint m_nBuffer;				// 0 without GL_ARB_buffer_storage
+	unsigned char *m_pData;			// The persistent mapping, or client memory
+	int m_nSlotSize;
+	int m_nSlots;
+	int m_nNext;					// Where Acquire() starts looking, so the slots are used in turn
+	int *m_pState;
+	GLsync *m_pFence;				// Set while a slot is SlotCopying
+
+public:
+	CPixelUnpackRing()
+	{
+		m_nBuffer = 0;
+		m_pData = NULL;
+		m_nSlotSize = m_nSlots = m_nNext = 0;
+		m_pState = NULL;
+		m_pFence = NULL;
+	}
+	~CPixelUnpackRing()				{ Cleanup(); }
+
+	// Slots are rounded up to ALIGN_SIZE bytes
+	bool Init(int nSlotSize, int nSlots);
+	void Cleanup();
+
+	bool IsPersistent() const		{ return m_nBuffer != 0; }
+	int GetSlotSize() const			{ return m_nSlotSize; }
+	void *GetData(int nSlot)		{ return m_pData + (size_t)nSlot * m_nSlotSize; }
+
+	// Everything but GetData() is for the render thread
+	int Acquire();
+	void Discard(int nSlot);		// For a slot whose texels will never be copied
+
+	// Bind() leaves the buffer bound and returns what to pass to glTexSubImage*() as the pixels,
+	// Release() unbinds it and fences the copies made since
+	const void *Bind(int nSlot);
+	void Release(int nSlot);
+};
+
 /*******************************************************************************
 * Class: CTexture
 ********************************************************************************
@@ -44,12 +103,15 @@ POSSIBILITY OF SUCH DAMAGE.
 class CTexture
 {
 protected:
-	int m_nType;					// GL_TEXTURE_1D, GL_TEXTURE_2D, or GL_TEXTURE_3D
+	int m_nType;					// GL_TEXTURE_1D, GL_TEXTURE_2D, GL_TEXTURE_RECTANGLE_EXT, or GL_TEXTURE_3D
 	unsigned int m_nID;				// OpenGL-generated texture ID
 
 	static CTexture m_tCloudCell;		// Shared cloud cell texture
 	static CTexture m_t1DGlow;
 
+	// pPixels is client memory, or an offset into the bound GL_PIXEL_UNPACK_BUFFER
+	void Upload(CPixelBuffer *pBuffer, int nLevel, const void *pPixels);
+
 public:
 
 	CTexture()		{ m_nID = -1; }
@@ -82,7 +144,15 @@ public:
 	void Disable()						{ if(m_nID != -1) glDisable(m_nType); }
 
 	void Init(CPixelBuffer *pBuffer, bool bClamp=true, bool bMipmap=true);
-	void Update(CPixelBuffer *pBuffer, int nLevel=0);
+	void Update(CPixelBuffer *pBuffer, int nLevel=0)	{ Upload(pBuffer, nLevel, pBuffer->GetBuffer()); }
+
+	// pBuffer describes the texels a worker wrote to slot nSlot of ring
+	void Update(CPixelBuffer *pBuffer, CPixelUnpackRing &ring, int nSlot, int nLevel=0)
+	{
+		_ASSERT(pBuffer->GetBufferSize() <= ring.GetSlotSize());
+		Upload(pBuffer, nLevel, ring.Bind(nSlot));
+		ring.Release(nSlot);
+	}
 
 	// Use when rendering to texture (either in the back buffer or a CPBuffer)
 	void InitCopy(int x, int y, int nWidth, int nHeight, bool bClamp=true);
@@ -103,6 +173,22 @@ protected:
 	int m_nStackIndex;
 	int *m_pStack;
 
+	void UpdateTile(int nTexture, CPixelBuffer *pBuffer, const void *pPixels)
+	{
+		_ASSERT(nTexture >= 0 && nTexture < m_nStackSize);
+		if(nTexture < 0 || nTexture >= m_nStackSize)
+			return;
+
+		Bind();
+		int x = nTexture % m_nArrayWidth;
+		int y = nTexture / m_nArrayWidth;
+		_ASSERT(pBuffer->GetWidth() == m_nPartitionSize);
+		_ASSERT(pBuffer->GetHeight() == m_nPartitionSize);
+		_ASSERT(pBuffer->GetFormat() == m_nFormat);
+		_ASSERT(pBuffer->GetDataType() == m_nDataType);
+		glTexSubImage2D(GL_TEXTURE_2D, 0, x*m_nPartitionSize, y*m_nPartitionSize, pBuffer->GetWidth(), pBuffer->GetHeight(), pBuffer->GetFormat(), pBuffer->GetDataType(), pPixels);
+	}
+
 public:
 	CTextureArray()
 	{
@@ -160,20 +246,14 @@ public:
 		m_pStack[--m_nStackIndex] = nTexture;
 	}
 
-	void Update(int nTexture, CPixelBuffer *pBuffer)
-	{
-		_ASSERT(nTexture >= 0 && nTexture < m_nStackSize);
-		if(nTexture < 0 || nTexture >= m_nStackSize)
-			return;
+	void Update(int nTexture, CPixelBuffer *pBuffer)	{ UpdateTile(nTexture, pBuffer, pBuffer->GetBuffer()); }
 
-		Bind();
-		int x = nTexture % m_nArrayWidth;
-		int y = nTexture / m_nArrayWidth;
-		_ASSERT(pBuffer->GetWidth() == m_nPartitionSize);
-		_ASSERT(pBuffer->GetHeight() == m_nPartitionSize);
-		_ASSERT(pBuffer->GetFormat() == m_nFormat);
-		_ASSERT(pBuffer->GetDataType() == m_nDataType);
-		glTexSubImage2D(GL_TEXTURE_2D, 0, x*m_nPartitionSize, y*m_nPartitionSize, pBuffer->GetWidth(), pBuffer->GetHeight(), pBuffer->GetFormat(), pBuffer->GetDataType(), pBuffer->GetBuffer());
+	// Streams a tile a worker wrote to slot nSlot of ring, see CPixelUnpackRing
+	void Update(int nTexture, CPixelBuffer *pBuffer, CPixelUnpackRing &ring, int nSlot)
+	{
+		_ASSERT(pBuffer->GetBufferSize() <= ring.GetSlotSize());
+		UpdateTile(nTexture, pBuffer, ring.Bind(nSlot));
+		ring.Release(nSlot);
 	}
 
 	void MapCorners(int nTexture, float fXMin, float fYMin, float fXMax, float fYMax)
@@ -0,0 +1,145 @@
+// Worker thread pool used by the CPU-side table and noise generators.
+//
+// Author:  Tim Finer
+// Email:   tfiner@csu.fullerton.edu
+//
+// CPSC-597 Fall 2015 Master's Project
+//
+
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+
+
+namespace {
+
+	// Shared state for one ParallelFor() call. It is reference counted so that
+	// helper tasks still sitting in the queue after the range has been finished
+	// find nothing left to do instead of touching a dead stack frame.
+	class CParallelJob
+	{
+	protected:
+		std::function<void(int, int)> m_fnRange;
+		int m_nBegin, m_nEnd, m_nGrain, m_nChunks;
+		std::atomic<int> m_nNext;
+		std::atomic<int> m_nDone;
+		std::mutex m_mutex;
+		std::condition_variable m_cvDone;
+
+	public:
+		CParallelJob(const std::function<void(int, int)> &fnRange, int nBegin, int nEnd, int nGrain)
+			: m_fnRange(fnRange), m_nBegin(nBegin), m_nEnd(nEnd), m_nGrain(nGrain), m_nNext(0), m_nDone(0)
+		{
+			m_nChunks = (nEnd - nBegin + nGrain - 1) / nGrain;
+		}
+
+		void Run()
+		{
+			int nChunk;
+			while((nChunk = m_nNext++) < m_nChunks)
+			{
+				int nChunkBegin = m_nBegin + nChunk * m_nGrain;
+				m_fnRange(nChunkBegin, (std::min)(m_nEnd, nChunkBegin + m_nGrain));
+				if(++m_nDone == m_nChunks)
+				{
+					std::lock_guard<std::mutex> lock(m_mutex);
+					m_cvDone.notify_all();
+				}
+			}
+		}
+
+		void Wait()
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_cvDone.wait(lock, [this]() { return m_nDone == m_nChunks; });
+		}
+	};
+
+}
+
+
+CThreadPool::CThreadPool(int nThreads)
+{
+	m_bShutdown = false;
+	if(nThreads <= 0)
+		nThreads = (int)std::thread::hardware_concurrency() - 1;
+	for(int i=0; i<nThreads; i++)
+		m_vThreads.emplace_back(&CThreadPool::WorkerThread, this);
+}
+
+CThreadPool::~CThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_bShutdown = true;
+	}
+	m_cvTask.notify_all();
+	for(auto &t : m_vThreads)
+		t.join();
+}
+
+CThreadPool &CThreadPool::GetMain()
+{
+	static CThreadPool pool;
+	return pool;
+}
+
+void CThreadPool::WorkerThread()
+{
+	for(;;)
+	{
+		std::function<void()> fnTask;
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_cvTask.wait(lock, [this]() { return m_bShutdown || !m_qTasks.empty(); });
+			if(m_qTasks.empty())
+				return;
+			fnTask = std::move(m_qTasks.front());
+			m_qTasks.pop_front();
+		}
+		fnTask();
+	}
+}
+
+void CThreadPool::Enqueue(std::function<void()> fnTask)
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_qTasks.push_back(std::move(fnTask));
+	}
+	m_cvTask.notify_one();
+}
+
+std::future<void> CThreadPool::Submit(std::function<void()> fnTask)
+{
+	// packaged_task is move-only, std::function needs something copyable
+	auto pTask = std::make_shared<std::packaged_task<void()>>(std::move(fnTask));
+	std::future<void> f = pTask->get_future();
+	if(m_vThreads.empty())
+		(*pTask)();
+	else
+		Enqueue([pTask]() { (*pTask)(); });
+	return f;
+}
+
+void CThreadPool::ParallelFor(int nBegin, int nEnd, int nGrain, const std::function<void(int, int)> &fnRange)
+{
+	if(nEnd <= nBegin)
+		return;
+	nGrain = (std::max)(1, nGrain);
+	int nChunks = (nEnd - nBegin + nGrain - 1) / nGrain;
+	if(nChunks == 1 || m_vThreads.empty())
+	{
+		fnRange(nBegin, nEnd);
+		return;
+	}
+
+	auto pJob = std::make_shared<CParallelJob>(fnRange, nBegin, nEnd, nGrain);
+	int nHelpers = (std::min)(nChunks - 1, GetThreadCount());
+	for(int i=0; i<nHelpers; i++)
+		Enqueue([pJob]() { pJob->Run(); });
+	pJob->Run();
+	pJob->Wait();
+}
@@ -0,0 +1,61 @@
+// Worker thread pool used by the CPU-side table and noise generators.
+//
+// Author:  Tim Finer
+// Email:   tfiner@csu.fullerton.edu
+//
+// CPSC-597 Fall 2015 Master's Project
+//
+
+#ifndef __ThreadPool_h__
+#define __ThreadPool_h__
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+/*******************************************************************************
+* Class: CThreadPool
+********************************************************************************
+* A fixed set of worker threads pulling tasks from a shared queue. Use Submit()
+* for fire-and-forget work and ParallelFor() to split a range into chunks. The
+* thread calling ParallelFor() works on the chunks too, so nested calls from a
+* worker thread cannot deadlock the pool. GetMain() returns a pool sized to the
+* number of hardware threads, shared by everything in the process.
+*******************************************************************************/
+class CThreadPool
+{
+protected:
+	std::vector<std::thread> m_vThreads;
+	std::deque<std::function<void()>> m_qTasks;
+	std::mutex m_mutex;
+	std::condition_variable m_cvTask;
+	bool m_bShutdown;
+
+	void WorkerThread();
+	void Enqueue(std::function<void()> fnTask);
+
+public:
+	// nThreads = 0 means one worker per hardware thread, minus the caller
+	CThreadPool(int nThreads=0);
+	~CThreadPool();
+
+	static CThreadPool &GetMain();
+
+	int GetThreadCount() const		{ return (int)m_vThreads.size(); }
+
+	// Queues a task and returns a future that becomes ready when it has run
+	std::future<void> Submit(std::function<void()> fnTask);
+
+	// Calls fnRange(nChunkBegin, nChunkEnd) for consecutive chunks of at most
+	// nGrain items covering [nBegin, nEnd), and returns when all have run
+	void ParallelFor(int nBegin, int nEnd, int nGrain, const std::function<void(int, int)> &fnRange);
+};
+
+inline CThreadPool *ThreadPool()		{ return &CThreadPool::GetMain(); }
+
+#endif // __ThreadPool_h__
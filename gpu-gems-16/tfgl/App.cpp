@@ -50,6 +50,11 @@ void App::Run(int argc, char** argv) {
     }        
 }
 
+void App::SetTitle(const std::string& title) {
+    if (window_)
+        ::glfwSetWindowTitle(window_, title.c_str());
+}
+
 bool App::Init(int argc, char** argv) {
     InitGL();
     return InitImpl();
@@ -32,6 +32,10 @@ namespace tfgl {
         //      while(DrawImpl()) {}
         void Run(int argc, char** argv);
 
+    protected:
+        // Replaces the window's title, for showing status while running.
+        void SetTitle(const std::string& title);
+
 
     private:
         int screenWidth_    = 800;
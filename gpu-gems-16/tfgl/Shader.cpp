@@ -114,7 +114,9 @@ namespace {
         auto line = std::string();
         while(std::getline(ifs, line)) {
             // std::cout << line << "\n";
-            if (line.find("#pragma include") != std::string::npos) {
+            // Only at the start of a line, so a comment mentioning the directive is left alone
+            const auto start = line.find_first_not_of(" \t");
+            if (start != std::string::npos && line.compare(start, 15, "#pragma include") == 0) {
                 PragmaInclude(ss, path, filename, line, lineNum);
             } else {
                 ss << line << "\n";
@@ -38,6 +38,9 @@ namespace tft {
         // the analog that this object represents some state that when this
         // object is destroyed, so is the object in the video card.
         std::unique_ptr<tfgl::Buffer>               buf_;
+        std::unique_ptr<tfgl::Buffer>               ibo_;
+        size_t                                      indexCount_ = 0;
+        unsigned int                                indexType_ = 0;
 
         virtual std::string GetVersion() const override { return "Testbed 1.0"; }
 
@@ -20,9 +20,17 @@
 #include <GL/glew.h>
 
 
+#include <algorithm>
 #include <array>
-#include <iostream>
+#include <atomic>
+#include <cassert>
+#include <chrono>
 #include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <numeric>
+#include <thread>
+#include <vector>
 
 
 using namespace tfgl;
@@ -40,128 +48,232 @@ namespace {
     //     0.0, 1.0, 0.0
     // };
 
-    inline void AddVertex(std::vector<glm::vec3>& v, float v0, float v1, float v2) {
-        v.emplace_back(v0, v1, v2);
+    // An indexed triangle mesh, 3 indices per triangle.  Indices stay 32 bit
+    // while building and are narrowed to 16 bit on upload when they fit.
+    struct Mesh {
+        std::vector<glm::vec3>  vertices_;
+        std::vector<uint32_t>   indices_;
+    };
+
+
+    inline void AddVertex(Mesh& m, float v0, float v1, float v2) {
+        m.vertices_.push_back(glm::normalize(glm::vec3(v0, v1, v2)));
     }
 
-    struct Face {
-        Face(glm::vec3 v0, glm::vec3 v1, glm::vec3 v2) : v0_(v0), v1_(v1), v2_(v2) {}
+    inline void AddFace(Mesh& m, uint32_t v0, uint32_t v1, uint32_t v2) {
+        m.indices_.push_back(v0);
+        m.indices_.push_back(v1);
+        m.indices_.push_back(v2);
+    }
 
-        glm::vec3 v0_;
-        glm::vec3 v1_;
-        glm::vec3 v2_;
-    };
 
-    static_assert(sizeof(Face) == sizeof(GLfloat) * 9, 
-        "Platform doesn't support this directly.");
+    // Calls fn(first, last) on sub-ranges of [0, count) from as many threads
+    // as the hardware has, the calling thread takes the first range.
+    template<typename Fn>
+    void ParallelFor(size_t count, Fn fn) {
+        const auto hardware = std::max(1u, std::thread::hardware_concurrency());
+        const auto threads = std::max(size_t(1), std::min(count, size_t(hardware)));
+        const auto chunk = threads ? (count + threads - 1) / threads : 0;
 
-    inline void AddFace(std::vector<Face>& faces, const glm::vec3& v0, const glm::vec3& v1, const glm::vec3& v2 ) {
-        faces.emplace_back(v0, v1, v2);
+        auto workers = std::vector<std::thread>();
+        for (auto t = size_t(1); t < threads; ++t) {
+            const auto first = std::min(count, t * chunk);
+            workers.emplace_back(fn, first, std::min(count, first + chunk));
+        }
+        fn(size_t(0), std::min(count, chunk));
+        for (auto& w : workers)
+            w.join();
     }
 
 
-    std::vector<Face> SubdivideSphere( const std::vector<Face>& src ) {
-        auto subdiv = std::vector<Face>();
-        subdiv.reserve(src.size() * 4);
+    // Splits every triangle into 4, pushing the new midpoints back out onto
+    // the unit sphere.
+    //
+    // Each edge is shared by two triangles that walk it in opposite directions,
+    // so the one that sees it going from the lower index to the higher owns the
+    // midpoint, and the other finds it in a cache kept per lower index.  No
+    // vertex of an icosphere has more than 6 neighbours, so the cache is a
+    // fixed 6 slots per vertex.  Faces are handled in fixed size blocks; a
+    // block's midpoints are numbered from a prefix sum of the edges each block
+    // owns, so the mesh comes out the same no matter how many threads ran.
+    Mesh SubdivideSphere(const Mesh& src) {
+        const auto maxValence = size_t(6);
+        const auto blockSize = size_t(16384);
+        const auto vertexCount = src.vertices_.size();
+        const auto faceCount = src.indices_.size() / 3;
+        const auto blockCount = (faceCount + blockSize - 1) / blockSize;
+        const auto* faces = src.indices_.data();
 
         /*
                 v2
 
               m2   m1
-                
+
             v0  m0  v1
 
         */
-        for(const auto & f : src) {
-            const auto m0 = (f.v0_ + f.v1_) / 2.0f;
-            const auto m1 = (f.v1_ + f.v2_) / 2.0f;
-            const auto m2 = (f.v2_ + f.v0_) / 2.0f;
-
-            subdiv.emplace_back(f.v0_,    m0,    m1);
-            subdiv.emplace_back(   m0, f.v1_,    m1);
-            subdiv.emplace_back(   m2,    m1, f.v2_);
-            subdiv.emplace_back(   m0,    m1,    m2);
-        }
-        
-
-        return subdiv;
+        auto firstMidpoint = std::vector<uint32_t>(blockCount + 1, 0);
+        ParallelFor(blockCount, [&](size_t first, size_t last) {
+            for (auto block = first; block < last; ++block) {
+                auto owned = uint32_t(0);
+                const auto end = std::min(faceCount, (block + 1) * blockSize);
+                for (auto f = block * blockSize; f < end; ++f)
+                    for (auto k = 0; k < 3; ++k)
+                        owned += faces[f*3 + k] < faces[f*3 + (k+1)%3];
+                firstMidpoint[block + 1] = owned;
+            }
+        });
+        firstMidpoint[0] = uint32_t(vertexCount);
+        std::partial_sum(firstMidpoint.begin(), firstMidpoint.end(), firstMidpoint.begin());
+
+        // A closed mesh has 3 edges for every 2 faces
+        assert(firstMidpoint.back() - vertexCount == faceCount * 3 / 2);
+
+        auto dst = Mesh();
+        dst.vertices_.resize(firstMidpoint.back());
+        dst.indices_.resize(src.indices_.size() * 4);
+        std::copy(src.vertices_.begin(), src.vertices_.end(), dst.vertices_.begin());
+
+        auto cacheCount = std::vector<std::atomic<uint8_t>>(vertexCount);
+        auto cacheEnd = std::vector<uint32_t>(vertexCount * maxValence);
+        auto cacheMidpoint = std::vector<uint32_t>(vertexCount * maxValence);
+
+        // Make the midpoints this block owns, and remember them
+        ParallelFor(blockCount, [&](size_t first, size_t last) {
+            for (auto block = first; block < last; ++block) {
+                auto next = firstMidpoint[block];
+                const auto end = std::min(faceCount, (block + 1) * blockSize);
+                for (auto f = block * blockSize; f < end; ++f) {
+                    for (auto k = 0; k < 3; ++k) {
+                        const auto a = faces[f*3 + k];
+                        const auto b = faces[f*3 + (k+1)%3];
+                        if (a > b)
+                            continue;
+                        dst.vertices_[next] = glm::normalize(src.vertices_[a] + src.vertices_[b]);
+                        const auto slot = a * maxValence + cacheCount[a]++;
+                        assert(cacheCount[a] <= maxValence);
+                        cacheEnd[slot] = b;
+                        cacheMidpoint[slot] = next++;
+                    }
+                }
+            }
+        });
+
+        const auto midpoint = [&](uint32_t a, uint32_t b) {
+            if (a > b)
+                std::swap(a, b);
+            const auto count = size_t(cacheCount[a]);
+            for (auto slot = a * maxValence; slot < a * maxValence + count; ++slot)
+                if (cacheEnd[slot] == b)
+                    return cacheMidpoint[slot];
+            assert(!"Edge missing from the midpoint cache");
+            return uint32_t(0);
+        };
+
+        // Every face writes its own 4 children, keeping the parent's winding
+        ParallelFor(blockCount, [&](size_t first, size_t last) {
+            const auto end = std::min(faceCount, last * blockSize);
+            for (auto f = first * blockSize; f < end; ++f) {
+                const auto v0 = faces[f*3], v1 = faces[f*3 + 1], v2 = faces[f*3 + 2];
+                const auto m0 = midpoint(v0, v1);
+                const auto m1 = midpoint(v1, v2);
+                const auto m2 = midpoint(v2, v0);
+                const uint32_t children[12] = {
+                    v0, m0, m2,
+                    m0, v1, m1,
+                    m2, m1, v2,
+                    m0, m1, m2
+                };
+                std::copy(children, children + 12, dst.indices_.begin() + f*12);
+            }
+        });
+
+        return dst;
     }
 
 
     // Generates an Icosphere, see:
     // http://blog.andreaskahler.com/2009/06/creating-icosphere-mesh-in-code.html
-    std::vector<Face> GenIcoSphere() {
-        auto v = std::vector<glm::vec3>();
-        v.reserve(12 * 3);
+    Mesh GenIcoSphere() {
+        auto m = Mesh();
+        m.vertices_.reserve(12);
+        m.indices_.reserve(20 * 3);
 
         const auto t = (1.0f + sqrt(5.0f)) / 2.0f;
 
-        AddVertex(v, -1.0f,     t,  0.0f);
-        AddVertex(v,  1.0f,     t,  0.0f);
-        AddVertex(v, -1.0f,    -t,  0.0f);
-        AddVertex(v,  1.0f,    -t,  0.0f);
-
-        AddVertex(v,  0.0f, -1.0f,     t);
-        AddVertex(v,  0.0f,  1.0f,     t);
-        AddVertex(v,  0.0f, -1.0f,    -t);
-        AddVertex(v,  0.0f,  1.0f,    -t);
+        AddVertex(m, -1.0f,     t,  0.0f);
+        AddVertex(m,  1.0f,     t,  0.0f);
+        AddVertex(m, -1.0f,    -t,  0.0f);
+        AddVertex(m,  1.0f,    -t,  0.0f);
 
-        AddVertex(v,     t,  0.0f, -1.0f);
-        AddVertex(v,     t,  0.0f,  1.0f);
-        AddVertex(v,    -t,  0.0f, -1.0f);
-        AddVertex(v,    -t,  0.0f,  1.0f);
+        AddVertex(m,  0.0f, -1.0f,     t);
+        AddVertex(m,  0.0f,  1.0f,     t);
+        AddVertex(m,  0.0f, -1.0f,    -t);
+        AddVertex(m,  0.0f,  1.0f,    -t);
 
-        // It would be more efficient to use indices from here
-        // on, but I'm more interested in getting a sphere
-        // rendered more than I am concerned with saving a few
-        // K bytes.
-        auto faces = std::vector<Face>();
-        faces.reserve(20);
+        AddVertex(m,     t,  0.0f, -1.0f);
+        AddVertex(m,     t,  0.0f,  1.0f);
+        AddVertex(m,    -t,  0.0f, -1.0f);
+        AddVertex(m,    -t,  0.0f,  1.0f);
 
         // 5 faces around point 0
-        AddFace(faces, v[ 0], v[11], v[ 5]);
-        AddFace(faces, v[ 0], v[ 5], v[ 1]);
-        AddFace(faces, v[ 0], v[ 1], v[ 7]);
-        AddFace(faces, v[ 0], v[ 7], v[10]);
-        AddFace(faces, v[ 0], v[10], v[11]);
+        AddFace(m,  0, 11,  5);
+        AddFace(m,  0,  5,  1);
+        AddFace(m,  0,  1,  7);
+        AddFace(m,  0,  7, 10);
+        AddFace(m,  0, 10, 11);
 
         // 5 adjacent faces
-        AddFace(faces, v[ 1], v[ 5], v[ 9]);
-        AddFace(faces, v[ 5], v[11], v[ 4]);
-        AddFace(faces, v[11], v[10], v[ 2]);
-        AddFace(faces, v[10], v[ 7], v[ 6]);
-        AddFace(faces, v[ 7], v[ 1], v[ 8]);
+        AddFace(m,  1,  5,  9);
+        AddFace(m,  5, 11,  4);
+        AddFace(m, 11, 10,  2);
+        AddFace(m, 10,  7,  6);
+        AddFace(m,  7,  1,  8);
 
         // 5 faces around point 3
-        AddFace(faces, v[ 3], v[ 9], v[ 4]);
-        AddFace(faces, v[ 3], v[ 4], v[ 2]);
-        AddFace(faces, v[ 3], v[ 2], v[ 6]);
-        AddFace(faces, v[ 3], v[ 6], v[ 8]);
-        AddFace(faces, v[ 3], v[ 8], v[ 9]);
+        AddFace(m,  3,  9,  4);
+        AddFace(m,  3,  4,  2);
+        AddFace(m,  3,  2,  6);
+        AddFace(m,  3,  6,  8);
+        AddFace(m,  3,  8,  9);
 
         // 5 adjacent faces
-        AddFace(faces, v[ 4], v[ 9], v[ 5]);
-        AddFace(faces, v[ 2], v[ 4], v[11]);
-        AddFace(faces, v[ 6], v[ 2], v[10]);
-        AddFace(faces, v[ 8], v[ 6], v[ 7]);
-        AddFace(faces, v[ 9], v[ 8], v[ 1]);  
-        return faces;      
+        AddFace(m,  4,  9,  5);
+        AddFace(m,  2,  4, 11);
+        AddFace(m,  6,  2, 10);
+        AddFace(m,  8,  6,  7);
+        AddFace(m,  9,  8,  1);
+        return m;
     }
 
 
+    // How many times the icosahedron is subdivided, each level has 4x the triangles
+    const auto sphereLevel = 5;
+
+
 } // namespace {
 
 
 struct Testbed::Sphere {
-    Sphere() : faces_(GenIcoSphere()) {
-        faces_ = SubdivideSphere(faces_);
+    explicit Sphere(int level) : mesh_(GenIcoSphere()) {
+        const auto start = std::chrono::steady_clock::now();
+        for (auto i = 0; i < level; ++i)
+            mesh_ = SubdivideSphere(mesh_);
+        const auto elapsed = std::chrono::steady_clock::now() - start;
+
+        const auto bytes = mesh_.vertices_.size() * sizeof(glm::vec3) + mesh_.indices_.size() * sizeof(uint32_t);
+        std::cout   << "Icosphere level " << level << ": "
+                    << mesh_.vertices_.size() << " vertices, "
+                    << mesh_.indices_.size() / 3 << " triangles, "
+                    << bytes / (1024 * 1024) << " MB in "
+                    << std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count() << " ms\n";
     }
 
-    std::vector<Face> faces_;
+    Mesh mesh_;
 };
 
 
-Testbed::Testbed() : earth_(new Sphere) {}
+Testbed::Testbed() : earth_(new Sphere(sphereLevel)) {}
 
 
 Testbed::~Testbed() {}
@@ -177,8 +289,9 @@ void Testbed::InitVAO() {
     buf_.reset(new Buffer(GL_ARRAY_BUFFER));
     ScopedBinder<Buffer> bindBuf(*buf_);
 
-    buf_->SetStaticData(earth_->faces_.data(), 
-        earth_->faces_.size() * sizeof(Face));
+    const auto& mesh = earth_->mesh_;
+    buf_->SetStaticData(mesh.vertices_.data(), 
+        mesh.vertices_.size() * sizeof(glm::vec3));
 
     ::glEnableVertexAttribArray(0);
     THROW_ON_GL_ERROR();
@@ -186,6 +299,19 @@ void Testbed::InitVAO() {
     // Tell the VAO about the format of vertexData:
     ::glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, 0);
     THROW_ON_GL_ERROR();
+
+    // The element buffer stays bound, the VAO keeps track of it.
+    ibo_.reset(new Buffer(GL_ELEMENT_ARRAY_BUFFER));
+    ibo_->Bind();
+    indexCount_ = mesh.indices_.size();
+    if (mesh.vertices_.size() <= 0x10000) {
+        const auto indices = std::vector<uint16_t>(mesh.indices_.begin(), mesh.indices_.end());
+        ibo_->SetStaticData(indices.data(), indices.size() * sizeof(uint16_t));
+        indexType_ = GL_UNSIGNED_SHORT;
+    } else {
+        ibo_->SetStaticData(mesh.indices_.data(), mesh.indices_.size() * sizeof(uint32_t));
+        indexType_ = GL_UNSIGNED_INT;
+    }
 }
 
 
@@ -222,8 +348,8 @@ bool Testbed::DrawImpl() {
 
     ScopedBinder<VertexArrayObject> vao(*vao_);
 
-    // ::glDrawArrays(GL_TRIANGLES, 0, earth_->faces_.size() * 3);
-    ::glDrawArrays(GL_LINES, 0, earth_->faces_.size() * 3);
+    ::glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
+    ::glDrawElements(GL_TRIANGLES, GLsizei(indexCount_), indexType_, 0);
 
     return true;
 }